@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <digest.h>
+#include <digest/server.h>
+#include <digest/credtab.h>
+
+/*
+ * A minimal HTTP/1.1 server protecting every path with digest
+ * authentication, as a reference and as a target for digestload.
+ *
+ *   server [-p port] [-f htdigest file]
+ *
+ * Without -f, the only user is jack with password Passw0rd in realm test.
+ * It listens on 127.0.0.1, runs one epoll loop and keeps connections
+ * alive.
+ */
+
+#define REALM		"test"
+#define BUFFER_SIZE	8192
+#define MAX_EVENTS	256
+
+typedef struct {
+	int fd;
+	size_t length;
+	char buffer[BUFFER_SIZE];
+} connection_s;
+
+static digest_credstore_t store;
+static int have_store = 0;
+static char nonce[33];
+static char challenge[512];
+
+static const char *_methods[] = { NULL, "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE" };
+
+static int
+_lookup(const char *username, const char *realm, char *ha1)
+{
+	if (have_store) {
+		return digest_credstore_lookup(&store, username, realm, ha1);
+	}
+	if (0 != strcmp(username, "jack") || 0 != strcmp(realm, REALM)) {
+		return -1;
+	}
+	strcpy(ha1, "1d860790e2e0921f2c576a503a40b2a0"); /* jack:test:Passw0rd */
+	return 0;
+}
+
+/**
+ * Finds a header in a request and null terminates its value.
+ */
+static char *
+_find_header(char *request, const char *name)
+{
+	size_t len = strlen(name);
+	char *line = strstr(request, "\r\n"), *end;
+
+	while (NULL != line && '\0' != line[2] && '\r' != line[2]) {
+		line += 2;
+		if (NULL == (end = strstr(line, "\r\n"))) {
+			break;
+		}
+		if (0 == strncasecmp(line, name, len) && ':' == line[len]) {
+			line += len + 1;
+			while (' ' == *line) {
+				line++;
+			}
+			*end = '\0';
+			return line;
+		}
+		line = end;
+	}
+
+	return NULL;
+}
+
+/**
+ * Authenticates one request, which ends at the empty line.
+ *
+ * Returns 0 if authenticated, otherwise -1.
+ */
+static int
+_authenticate(char *request)
+{
+	digest_t d;
+	char *sp, *authorization, ha1[33];
+	unsigned int method;
+
+	if (NULL == (sp = strchr(request, ' '))) {
+		return -1;
+	}
+	for (method = 1; method < sizeof (_methods) / sizeof (_methods[0]); ++method) {
+		if (strlen(_methods[method]) == (size_t) (sp - request) && 0 == strncmp(request, _methods[method], sp - request)) {
+			break;
+		}
+	}
+	if (method == sizeof (_methods) / sizeof (_methods[0])) {
+		return -1;
+	}
+
+	if (NULL == (authorization = _find_header(request, "Authorization")) || -1 == digest_is_digest(authorization)) {
+		return -1;
+	}
+
+	digest_init(&d);
+	digest_server_parse_in_place(&d, authorization);
+	digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) (int) method);
+
+	if (NULL == d.username || NULL == d.realm || NULL == d.nonce || 0 != strcmp(d.nonce, nonce)) {
+		return -1;
+	}
+	if (-1 == _lookup(d.username, d.realm, ha1)) {
+		return -1;
+	}
+
+	return digest_server_verify(&d, ha1);
+}
+
+/**
+ * Handles the complete requests in the buffer of a connection.
+ *
+ * Returns 0 to keep the connection open, -1 to close it.
+ */
+static int
+_handle(connection_s *c)
+{
+	char response[1024], *end;
+	size_t request_length;
+	int n;
+
+	while (NULL != (end = memmem(c->buffer, c->length, "\r\n\r\n", 4))) {
+		request_length = end - c->buffer + 4;
+		end[2] = '\0';
+
+		if (0 == _authenticate(c->buffer)) {
+			n = snprintf(response, sizeof (response), "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nok\n");
+		} else {
+			n = snprintf(response, sizeof (response), "HTTP/1.1 401 Unauthorized\r\n"
+			    "WWW-Authenticate: %s\r\nContent-Length: 0\r\n\r\n", challenge);
+		}
+		if (n != write(c->fd, response, n)) {
+			return -1;
+		}
+
+		memmove(c->buffer, c->buffer + request_length, c->length - request_length);
+		c->length -= request_length;
+	}
+
+	return c->length == sizeof (c->buffer) ? -1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct sockaddr_in addr;
+	connection_s *c;
+	digest_t d;
+	int opt, port = 8080, listen_fd, epoll_fd, fd, n, i, one = 1;
+	ssize_t len;
+	FILE *fp;
+	unsigned char bytes[16];
+
+	while (-1 != (opt = getopt(argc, argv, "p:f:"))) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'f':
+			if (-1 == digest_credstore_init(&store, 0) || -1 == digest_credstore_load(&store, optarg)) {
+				fprintf(stderr, "Could not load %s!\n", optarg);
+				exit(1);
+			}
+			have_store = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p port] [-f htdigest file]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	/* One nonce for the lifetime of the server */
+	if (NULL == (fp = fopen("/dev/urandom", "r")) || 1 != fread(bytes, sizeof (bytes), 1, fp)) {
+		fprintf(stderr, "Could not read /dev/urandom!\n");
+		exit(1);
+	}
+	fclose(fp);
+	for (i = 0; i < 16; ++i) {
+		sprintf(nonce + i * 2, "%02x", bytes[i]);
+	}
+
+	digest_init(&d);
+	digest_set_attr(&d, D_ATTR_REALM, (digest_attr_value_t) REALM);
+	digest_set_attr(&d, D_ATTR_NONCE, (digest_attr_value_t) nonce);
+	digest_set_attr(&d, D_ATTR_QOP, (digest_attr_value_t) DIGEST_QOP_AUTH);
+	if (-1 == (int) digest_server_generate_header(&d, challenge, sizeof (challenge))) {
+		fprintf(stderr, "Could not generate the challenge!\n");
+		exit(1);
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+	memset(&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (-1 == bind(listen_fd, (struct sockaddr *) &addr, sizeof (addr)) || -1 == listen(listen_fd, 1024)) {
+		perror("bind");
+		exit(1);
+	}
+
+	epoll_fd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+	printf("Listening on 127.0.0.1:%d\n", port);
+	fflush(stdout);
+
+	for (;;) {
+		n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		for (i = 0; i < n; ++i) {
+			if (NULL == events[i].data.ptr) {
+				while (-1 != (fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK))) {
+					if (NULL == (c = malloc(sizeof (connection_s)))) {
+						close(fd);
+						continue;
+					}
+					setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+					c->fd = fd;
+					c->length = 0;
+					ev.events = EPOLLIN;
+					ev.data.ptr = c;
+					epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+				}
+				continue;
+			}
+
+			c = events[i].data.ptr;
+			while (0 < (len = read(c->fd, c->buffer + c->length, sizeof (c->buffer) - c->length))) {
+				c->length += len;
+				if (-1 == _handle(c)) {
+					len = 0;
+					break;
+				}
+			}
+			if (0 == len || (-1 == len && EAGAIN != errno)) {
+				close(c->fd);
+				free(c);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "parse.h"
+#include "hash.h"
+#include "client.h"
+#include "authcache.h"
+
+struct digest_authcache_entry_s {
+	char *origin;		/* NULL if the entry is free */
+	char *realm;
+	char *domain;
+	char *nonce;
+	char *opaque;
+	char *username;
+	char ha1[33];
+	unsigned int qop;
+	char algorithm;
+	unsigned int userhash;	/* The server asked for a userhash */
+	unsigned int nc;	/* The next nonce count to use */
+	unsigned int cnonce;
+	unsigned long last_used;
+};
+
+typedef struct digest_authcache_entry_s digest_authcache_entry_s;
+
+/**
+ * Duplicates a string, keeping NULL as NULL.
+ *
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int
+_set_string(char **dst, const char *src)
+{
+	char *copy = NULL;
+
+	if (NULL != src && NULL == (copy = strdup(src))) {
+		return -1;
+	}
+
+	free(*dst);
+	*dst = copy;
+	return 0;
+}
+
+static void
+_entry_clear(digest_authcache_entry_s *e)
+{
+	free(e->origin);
+	free(e->realm);
+	free(e->domain);
+	free(e->nonce);
+	free(e->opaque);
+	free(e->username);
+	memset(e, 0, sizeof (digest_authcache_entry_s));
+}
+
+/**
+ * Checks if a URI is in the domain of a protection space.
+ *
+ * domain is the space separated list from the challenge. Its URIs are
+ * either absolute paths, or absolute URIs on the origin.
+ *
+ * Returns 1 if covered, otherwise 0.
+ */
+static int
+_domain_covers(const char *domain, const char *origin, const char *uri)
+{
+	size_t origin_len = strlen(origin), len;
+	const char *cursor = domain, *end, *path;
+
+	if (NULL == domain || '\0' == *domain) {
+		return 1;
+	}
+
+	while ('\0' != *cursor) {
+		while (' ' == *cursor) {
+			cursor++;
+		}
+		if ('\0' == *cursor) {
+			break;
+		}
+		if (NULL == (end = strchr(cursor, ' '))) {
+			end = cursor + strlen(cursor);
+		}
+
+		path = NULL;
+		if ((size_t) (end - cursor) >= origin_len && 0 == strncmp(cursor, origin, origin_len)) {
+			path = cursor + origin_len;
+		} else if ('/' == *cursor) {
+			path = cursor;
+		}
+
+		if (NULL != path) {
+			len = end - path;
+			if (0 == len || 0 == strncmp(uri, path, len)) {
+				return 1;
+			}
+		}
+
+		cursor = end;
+	}
+
+	return 0;
+}
+
+/**
+ * Finds the entry of (origin, realm). The lock must be held.
+ */
+static digest_authcache_entry_s *
+_find_space(digest_authcache_s *ac, const char *origin, const char *realm)
+{
+	unsigned int i;
+
+	for (i = 0; i < ac->max_entries; ++i) {
+		if (NULL != ac->entries[i].origin && 0 == strcmp(ac->entries[i].origin, origin)
+		    && 0 == strcmp(ac->entries[i].realm, realm)) {
+			return &ac->entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Copies the challenge of a parsed context into an entry.
+ *
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int
+_entry_set_challenge(digest_authcache_entry_s *e, const digest_s *dig)
+{
+	if (-1 == _set_string(&e->nonce, dig->nonce)
+	    || -1 == _set_string(&e->opaque, dig->opaque)
+	    || -1 == _set_string(&e->domain, dig->domain)) {
+		return -1;
+	}
+
+	e->qop = dig->qop;
+	e->algorithm = dig->algorithm;
+	e->userhash = dig->userhash;
+	e->nc = 1;
+	e->cnonce = time(NULL) ^ (unsigned int) (size_t) e;
+	return 0;
+}
+
+int
+digest_authcache_init(digest_authcache_t *cache, unsigned int max_entries)
+{
+	digest_authcache_s *ac = (digest_authcache_s *) cache;
+
+	memset(ac, 0, sizeof (digest_authcache_s));
+
+	if (0 == max_entries) {
+		return -1;
+	}
+	if (NULL == (ac->entries = calloc(max_entries, sizeof (digest_authcache_entry_s)))) {
+		return -1;
+	}
+	ac->max_entries = max_entries;
+
+	if (0 != pthread_mutex_init(&ac->lock, NULL)) {
+		free(ac->entries);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+digest_authcache_put(digest_authcache_t *cache, const char *origin, digest_t *digest)
+{
+	digest_authcache_s *ac = (digest_authcache_s *) cache;
+	digest_s *dig = (digest_s *) digest;
+	digest_authcache_entry_s *e;
+	char ha1[52];
+	unsigned int i;
+	int rc = 0;
+
+	if (NULL == origin || -1 == parse_validate_attributes(dig)) {
+		return -1;
+	}
+
+	hash_generate_a1(ha1, dig->username, dig->realm, dig->password);
+
+	pthread_mutex_lock(&ac->lock);
+
+	if (NULL == (e = _find_space(ac, origin, dig->realm))) {
+		/* Take a free entry, or the least recently used one */
+		e = &ac->entries[0];
+		for (i = 0; i < ac->max_entries && NULL != e->origin; ++i) {
+			if (NULL == ac->entries[i].origin || ac->entries[i].last_used < e->last_used) {
+				e = &ac->entries[i];
+			}
+		}
+		_entry_clear(e);
+	}
+
+	if (-1 == _set_string(&e->origin, origin)
+	    || -1 == _set_string(&e->realm, dig->realm)
+	    || -1 == _set_string(&e->username, dig->username)
+	    || -1 == _entry_set_challenge(e, dig)) {
+		_entry_clear(e);
+		rc = -1;
+	} else {
+		strcpy(e->ha1, ha1);
+		e->last_used = ++ac->clock;
+	}
+
+	pthread_mutex_unlock(&ac->lock);
+	return rc;
+}
+
+size_t
+digest_authcache_generate(digest_authcache_t *cache, const char *origin, unsigned int method, const char *uri, char *result, size_t max_length)
+{
+	digest_authcache_s *ac = (digest_authcache_s *) cache;
+	digest_authcache_entry_s *e, *found = NULL;
+	digest_t d;
+	char realm[256], nonce[256], opaque[256], username[256], ha1[33];
+	unsigned int i;
+
+	if (NULL == origin || -1 == _check_string(uri)) {
+		return -1;
+	}
+
+	digest_init(&d);
+
+	pthread_mutex_lock(&ac->lock);
+
+	for (i = 0; i < ac->max_entries; ++i) {
+		e = &ac->entries[i];
+		if (NULL != e->origin && 0 == strcmp(e->origin, origin) && _domain_covers(e->domain, origin, uri)
+		    && (NULL == found || e->last_used > found->last_used)) {
+			found = e;
+		}
+	}
+	if (NULL == found || NULL == found->nonce) {
+		pthread_mutex_unlock(&ac->lock);
+		return -1;
+	}
+
+	/* Copy out, so hashing happens outside of the lock */
+	snprintf(realm, sizeof (realm), "%s", found->realm);
+	snprintf(nonce, sizeof (nonce), "%s", found->nonce);
+	snprintf(username, sizeof (username), "%s", found->username);
+	if (NULL != found->opaque) {
+		snprintf(opaque, sizeof (opaque), "%s", found->opaque);
+		d.opaque = opaque;
+	}
+	strcpy(ha1, found->ha1);
+	d.qop = found->qop;
+	d.algorithm = found->algorithm;
+	d.userhash = found->userhash;
+	d.cnonce = found->cnonce;
+	d.nc = found->nc++;
+	found->last_used = ++ac->clock;
+
+	pthread_mutex_unlock(&ac->lock);
+
+	d.realm = realm;
+	d.nonce = nonce;
+	d.username = username;
+	d.uri = (char *) uri;
+	d.method = method;
+
+	return digest_client_generate_header_ha1(&d, ha1, result, max_length);
+}
+
+int
+digest_authcache_challenge(digest_authcache_t *cache, const char *origin, const char *header_value)
+{
+	digest_authcache_s *ac = (digest_authcache_s *) cache;
+	digest_authcache_entry_s *e;
+	digest_t d;
+	char *copy;
+	int rc = -1;
+
+	if (NULL == origin || -1 == digest_is_digest(header_value) || strlen("Digest ") > strlen(header_value)) {
+		return -1;
+	}
+
+	/* Parse a copy of our own, parse_digest() would leak one */
+	if (NULL == (copy = strdup(header_value))) {
+		return -1;
+	}
+	digest_init(&d);
+	parse_digest_in_place(&d, copy);
+	if (NULL == d.realm) {
+		free(copy);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ac->lock);
+	if (NULL != (e = _find_space(ac, origin, d.realm))) {
+		if (d.stale && NULL != d.nonce && 0 == _entry_set_challenge(e, &d)) {
+			/* Same credentials, new nonce */
+			rc = 0;
+		} else {
+			_entry_clear(e);
+		}
+	}
+	pthread_mutex_unlock(&ac->lock);
+
+	free(copy);
+	return rc;
+}
+
+void
+digest_authcache_destroy(digest_authcache_t *cache)
+{
+	digest_authcache_s *ac = (digest_authcache_s *) cache;
+	unsigned int i;
+
+	for (i = 0; i < ac->max_entries; ++i) {
+		_entry_clear(&ac->entries[i]);
+	}
+	free(ac->entries);
+	pthread_mutex_destroy(&ac->lock);
+	memset(ac, 0, sizeof (digest_authcache_s));
+}
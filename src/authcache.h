@@ -0,0 +1,94 @@
+#ifndef INC_DIGEST_AUTHCACHE_H
+#define INC_DIGEST_AUTHCACHE_H
+#include <pthread.h>
+#include "digest.h"
+
+/*
+ * Client-side preemptive authentication cache.
+ *
+ * Remembers the last challenge, HA1 and nonce count per protection space:
+ * an origin (like "https://api.example.com:443") and a realm, limited to
+ * the URIs in the domain parameter of the challenge if one was sent. New
+ * requests, also on new connections, can then send an Authorization header
+ * right away instead of waiting for a 401.
+ *
+ * The cache is thread-safe and holds at most max_entries spaces, evicting
+ * the least recently used one.
+ */
+
+struct digest_authcache_entry_s;
+
+typedef struct {
+	pthread_mutex_t lock;
+	struct digest_authcache_entry_s *entries;
+	unsigned int max_entries;
+	unsigned long clock;	/* For LRU eviction */
+} digest_authcache_s;
+
+typedef digest_authcache_s digest_authcache_t;
+
+/**
+ * Initiate an authentication cache.
+ *
+ * @param digest_authcache_t *cache The cache to initiate.
+ * @param unsigned int max_entries Maximum number of protection spaces.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_authcache_init(digest_authcache_t *cache, unsigned int max_entries);
+
+/**
+ * Remember the protection space of a challenge.
+ *
+ * Call after a request authenticated with this context succeeded. The
+ * password is not stored, only the HA1.
+ *
+ * @param digest_authcache_t *cache The cache.
+ * @param const char *origin Scheme, host and port of the server.
+ * @param digest_t *digest A context with a parsed challenge, username and
+ *        password.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_authcache_put(digest_authcache_t *cache, const char *origin, digest_t *digest);
+
+/**
+ * Generate a preemptive Authorization header value.
+ *
+ * Uses the cached space that covers the URI and takes the next nonce
+ * count of it.
+ *
+ * @param digest_authcache_t *cache The cache.
+ * @param const char *origin Scheme, host and port of the server.
+ * @param unsigned int method The method of the request, DIGEST_METHOD_*.
+ * @param const char *uri The URI of the request.
+ * @param char *result The buffer to store the generated header value in.
+ *
+ * Returns the number of bytes in the result string. -1 if no cached space
+ * covers the URI, or on failure.
+ */
+extern size_t digest_authcache_generate(digest_authcache_t *cache, const char *origin, unsigned int method, const char *uri, char *result, size_t max_length);
+
+/**
+ * Handle a 401 challenge to a preemptive request.
+ *
+ * With stale=true only the nonce was too old: the new nonce is adopted
+ * and the HA1 is kept, so the request can be retried with
+ * digest_authcache_generate() right away. Otherwise the space is removed.
+ *
+ * @param digest_authcache_t *cache The cache.
+ * @param const char *origin Scheme, host and port of the server.
+ * @param const char *header_value The value of the WWW-Authenticate header.
+ *
+ * @returns int 0 if the request can be retried from the cache, otherwise -1.
+ */
+extern int digest_authcache_challenge(digest_authcache_t *cache, const char *origin, const char *header_value);
+
+/**
+ * Free an authentication cache.
+ *
+ * @param digest_authcache_t *cache The cache to free.
+ */
+extern void digest_authcache_destroy(digest_authcache_t *cache);
+
+#endif  /* INC_DIGEST_AUTHCACHE_H */
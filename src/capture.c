@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+int
+digest_capture_open(digest_capture_t *capture, const char *path)
+{
+	digest_capture_s *cap = (digest_capture_s *) capture;
+	digest_capture_header_s header;
+	int fd;
+
+	if (-1 == (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600))) {
+		return -1;
+	}
+	if (NULL == (cap->fp = fdopen(fd, "w"))) {
+		close(fd);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, DIGEST_CAPTURE_MAGIC, sizeof (DIGEST_CAPTURE_MAGIC));
+	header.version = DIGEST_CAPTURE_VERSION;
+	header.byte_order = DIGEST_CAPTURE_BOM;
+	if (1 != fwrite(&header, sizeof (header), 1, cap->fp)) {
+		fclose(cap->fp);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+digest_capture_add(digest_capture_t *capture, unsigned int kind, unsigned int method, const char *value)
+{
+	digest_capture_s *cap = (digest_capture_s *) capture;
+	digest_capture_record_s record;
+	size_t length;
+	int rc = 0;
+
+	length = strlen(value);
+	if (length > DIGEST_CAPTURE_VALUE_MAX || method > 0xff
+	    || (DIGEST_CAPTURE_CHALLENGE != kind && DIGEST_CAPTURE_AUTHORIZATION != kind)) {
+		return -1;
+	}
+
+	record.kind = kind;
+	record.method = method;
+	record.length = length;
+
+	/* Hold the stream lock, so records of other threads do not interleave */
+	flockfile(cap->fp);
+	if (1 != fwrite(&record, sizeof (record), 1, cap->fp)
+	    || length + 1 != fwrite(value, 1, length + 1, cap->fp)) {
+		rc = -1;
+	}
+	funlockfile(cap->fp);
+
+	return rc;
+}
+
+int
+digest_capture_close(digest_capture_t *capture)
+{
+	digest_capture_s *cap = (digest_capture_s *) capture;
+	int rc;
+
+	rc = ferror(cap->fp) ? -1 : 0;
+	if (0 != fclose(cap->fp)) {
+		rc = -1;
+	}
+	cap->fp = NULL;
+
+	return rc;
+}
+
+int
+digest_replay_open(digest_replay_t *replay, const char *path)
+{
+	digest_replay_s *rp = (digest_replay_s *) replay;
+	const digest_capture_header_s *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(rp, 0, sizeof (digest_replay_s));
+
+	if (-1 == (fd = open(path, O_RDONLY))) {
+		return -1;
+	}
+	if (-1 == fstat(fd, &st) || st.st_size < (off_t) sizeof (digest_capture_header_s)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		return -1;
+	}
+
+	header = (const digest_capture_header_s *) map;
+	if (0 != memcmp(header->magic, DIGEST_CAPTURE_MAGIC, sizeof (DIGEST_CAPTURE_MAGIC))
+	    || DIGEST_CAPTURE_VERSION != header->version
+	    || DIGEST_CAPTURE_BOM != header->byte_order) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	rp->map = map;
+	rp->map_size = st.st_size;
+	rp->offset = sizeof (digest_capture_header_s);
+
+	return 0;
+}
+
+int
+digest_replay_next(digest_replay_t *replay, digest_replay_record_t *record)
+{
+	digest_replay_s *rp = (digest_replay_s *) replay;
+	digest_capture_record_s r;
+	const char *value;
+
+	/* A record cut short ends the capture */
+	if (rp->offset + sizeof (r) > rp->map_size) {
+		return -1;
+	}
+	memcpy(&r, (const char *) rp->map + rp->offset, sizeof (r));
+	value = (const char *) rp->map + rp->offset + sizeof (r);
+	if (rp->offset + sizeof (r) + r.length + 1 > rp->map_size || '\0' != value[r.length]) {
+		return -1;
+	}
+
+	record->kind = r.kind;
+	record->method = r.method;
+	record->length = r.length;
+	record->value = value;
+	rp->offset += sizeof (r) + r.length + 1;
+
+	return 0;
+}
+
+void
+digest_replay_rewind(digest_replay_t *replay)
+{
+	digest_replay_s *rp = (digest_replay_s *) replay;
+
+	rp->offset = sizeof (digest_capture_header_s);
+}
+
+void
+digest_replay_close(digest_replay_t *replay)
+{
+	digest_replay_s *rp = (digest_replay_s *) replay;
+
+	if (NULL != rp->map) {
+		munmap(rp->map, rp->map_size);
+	}
+	rp->map = NULL;
+}
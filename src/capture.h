@@ -0,0 +1,144 @@
+#ifndef INC_DIGEST_CAPTURE_H
+#define INC_DIGEST_CAPTURE_H
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Captures of WWW-Authenticate and Authorization header streams.
+ *
+ * A server records the header values it sends and receives, and the
+ * digestreplay tool pushes them through parsing, generation and
+ * verification again, to benchmark on the real mix of URIs, opaques and
+ * qops. Records are appended as they come; a capture cut short by a crash
+ * ends at its last complete record.
+ *
+ * File layout, host byte order (a byte order mark is checked on open):
+ *
+ *   header   16 bytes, see digest_capture_header_s
+ *   records  4 bytes each, see digest_capture_record_s, followed by the
+ *            header value and a null byte
+ *
+ * Authorization headers hold usernames and responses, so captures are
+ * written readable by the owner only.
+ */
+
+#define DIGEST_CAPTURE_MAGIC	"DGSTCAP"
+#define DIGEST_CAPTURE_VERSION	1
+#define DIGEST_CAPTURE_BOM	0x01020304
+
+/* Kinds of records */
+#define DIGEST_CAPTURE_CHALLENGE	1 /* WWW-Authenticate, sent by a server */
+#define DIGEST_CAPTURE_AUTHORIZATION	2 /* Authorization, sent by a client */
+
+/* The longest header value a record holds */
+#define DIGEST_CAPTURE_VALUE_MAX	65535
+
+typedef struct {
+	char magic[8];			/* DIGEST_CAPTURE_MAGIC */
+	unsigned int version;		/* DIGEST_CAPTURE_VERSION */
+	unsigned int byte_order;	/* DIGEST_CAPTURE_BOM */
+} digest_capture_header_s;
+
+typedef struct {
+	unsigned char kind;		/* DIGEST_CAPTURE_* */
+	unsigned char method;		/* DIGEST_METHOD_* of the request */
+	unsigned short length;		/* Of the value, without the null byte */
+} digest_capture_record_s;
+
+/* A capture being written */
+typedef struct {
+	FILE *fp;
+} digest_capture_s;
+
+typedef digest_capture_s digest_capture_t;
+
+/* A capture mapped for replay */
+typedef struct {
+	void *map;
+	size_t map_size;
+	size_t offset;			/* Of the next record */
+} digest_replay_s;
+
+typedef digest_replay_s digest_replay_t;
+
+/* One record of a replay */
+typedef struct {
+	unsigned int kind;
+	unsigned int method;
+	size_t length;
+	const char *value;		/* Null terminated, in the mapped file */
+} digest_replay_record_t;
+
+/**
+ * Create a capture file.
+ *
+ * An existing file is replaced.
+ *
+ * @param digest_capture_t *capture The capture context to initialize.
+ * @param const char *path Path to the capture file.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_capture_open(digest_capture_t *capture, const char *path);
+
+/**
+ * Append a header value to a capture.
+ *
+ * Safe to call from many threads on the same capture; records are never
+ * interleaved.
+ *
+ * @param digest_capture_t *capture The capture.
+ * @param unsigned int kind DIGEST_CAPTURE_CHALLENGE or
+ *        DIGEST_CAPTURE_AUTHORIZATION.
+ * @param unsigned int method DIGEST_METHOD_* of the request.
+ * @param const char *value The header value, null terminated.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_capture_add(digest_capture_t *capture, unsigned int kind, unsigned int method, const char *value);
+
+/**
+ * Flush and close a capture.
+ *
+ * @param digest_capture_t *capture The capture to close.
+ *
+ * @returns int 0 on success, -1 if records could not be written.
+ */
+extern int digest_capture_close(digest_capture_t *capture);
+
+/**
+ * Map a capture file for replay.
+ *
+ * @param digest_replay_t *replay The replay context to initialize.
+ * @param const char *path Path to the capture file.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_replay_open(digest_replay_t *replay, const char *path);
+
+/**
+ * Read the next record of a replay.
+ *
+ * @param digest_replay_t *replay The replay.
+ * @param digest_replay_record_t *record Filled with the record, which
+ *        points into the mapped file.
+ *
+ * @returns int 0 on success, -1 at the end of the capture.
+ */
+extern int digest_replay_next(digest_replay_t *replay, digest_replay_record_t *record);
+
+/**
+ * Start a replay over from the first record.
+ *
+ * @param digest_replay_t *replay The replay.
+ */
+extern void digest_replay_rewind(digest_replay_t *replay);
+
+/**
+ * Unmap a replay.
+ *
+ * @param digest_replay_t *replay The replay to close.
+ */
+extern void digest_replay_close(digest_replay_t *replay);
+
+#endif  /* INC_DIGEST_CAPTURE_H */
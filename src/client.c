@@ -5,6 +5,10 @@
 #include "parse.h"
 #include "hash.h"
 #include "client.h"
+#include "trace.h"
+
+TRACE_SEMAPHORE(client__header__start);
+TRACE_SEMAPHORE(client__header__done);
 
 int
 digest_client_parse(digest_t *digest, const char *digest_string)
@@ -19,33 +23,24 @@ digest_client_parse(digest_t *digest, const char *digest_string)
 }
 
 /**
- * Generates the Authorization header string.
- *
- * Attributes that must be set manually before calling this function:
- *
- *  - Username
- *  - Password
- *  - URI
- *  - Method
+ * Generates the Authorization header string from a HA1.
  *
- * If not set, NULL will be returned.
+ * The string attributes of dig must have been checked by the caller.
+ * prefix is the MD5 state after "ha1:nonce:", or NULL to hash the whole
+ * response.
  *
  * Returns the number of bytes in the result string.
  */
-size_t
-digest_client_generate_header(digest_t *digest, char *result, size_t max_length)
+static size_t
+_render_header(digest_s *dig, const char *hash_a1, const MD5_CTX *prefix, char *result, size_t max_length)
 {
-	digest_s *dig = (digest_s *) digest;
-	char hash_a1[52], hash_a2[52], hash_res[52];
-	char *qop_value, *algorithm_value, *method_value;
+	char hash_a2[52], hash_res[52], tail[64], userhash[52];
+	unsigned char digest[16];
+	char *qop_value = NULL, *algorithm_value;
+	const char *method_value;
 	size_t result_size; /* The size of the result string */
 	int sz;
 
-	/* Check length of char attributes to prevent buffer overflow */
-	if (-1 == parse_validate_attributes(dig)) {
-		return -1;
-	}
-
 	/* Quality of Protection - qop */
 	if (DIGEST_QOP_AUTH == (DIGEST_QOP_AUTH & dig->qop)) {
 		qop_value = "auth";
@@ -61,49 +56,40 @@ digest_client_generate_header(digest_t *digest, char *result, size_t max_length)
 	}
 
 	/* Set method */
-	switch (dig->method) {
-	case DIGEST_METHOD_OPTIONS:
-		method_value = "OPTIONS";
-		break;
-	case DIGEST_METHOD_GET:
-		method_value = "GET";
-		break;
-	case DIGEST_METHOD_HEAD:
-		method_value = "HEAD";
-		break;
-	case DIGEST_METHOD_POST:
-		method_value = "POST";
-		break;
-	case DIGEST_METHOD_PUT:
-		method_value = "PUT";
-		break;
-	case DIGEST_METHOD_DELETE:
-		method_value = "DELETE";
-		break;
-	case DIGEST_METHOD_TRACE:
-		method_value = "TRACE";
-		break;
-	default:
+	if (NULL == (method_value = parse_method_name(dig->method))) {
 		return -1;
 	}
 
 	/* Generate the hashes */
-	hash_generate_a1(hash_a1, dig->username, dig->realm, dig->password);
-	hash_generate_a2(hash_a2, method_value, dig->uri);
+	hash_generate_a2_cached(hash_a2, method_value, dig->uri);
 
-	if (DIGEST_QOP_NOT_SET != dig->qop) {
+	if (NULL != prefix) {
+		/* Only the part after "ha1:nonce:" differs between requests */
+		if (DIGEST_QOP_NOT_SET != dig->qop) {
+			sz = snprintf(tail, sizeof (tail), "%08x:%08x:%s:%s", dig->nc, dig->cnonce, qop_value, hash_a2);
+		} else {
+			sz = snprintf(tail, sizeof (tail), "%s", hash_a2);
+		}
+		MD5_Tail(digest, prefix, tail, sz);
+		hash_to_hex(hash_res, digest);
+	} else if (DIGEST_QOP_NOT_SET != dig->qop) {
 		hash_generate_response_auth(hash_res, hash_a1, dig->nonce, dig->nc, dig->cnonce, qop_value, hash_a2);
 	} else {
 		hash_generate_response(hash_res, hash_a1, dig->nonce, hash_a2);
 	}
 
+	/* With userhash, the username is not sent */
+	if (dig->userhash) {
+		hash_generate_userhash(userhash, dig->username, dig->realm);
+	}
+
 	/* Generate the minimum digest header string */
 	result_size = snprintf(result, max_length, "Digest username=\"%s\", realm=\"%s\", uri=\"%s\", response=\"%s\"",\
-	    dig->username,\
+	    dig->userhash ? userhash : dig->username,\
 	    dig->realm,\
 	    dig->uri,\
 	    hash_res);
-	if (result_size == -1 || result_size == max_length) {
+	if (result_size == -1 || result_size >= max_length) {
 		return -1;
 	}
 
@@ -120,6 +106,7 @@ digest_client_generate_header(digest_t *digest, char *result, size_t max_length)
 	if (DIGEST_ALGORITHM_NOT_SET != dig->algorithm) {
 		sz = snprintf(result + result_size, max_length - result_size, ", algorithm=\"%s\"",\
 	    	    algorithm_value);
+		result_size += sz;
 		if (sz == -1 || result_size >= max_length) {
 			return -1;
 		}
@@ -132,10 +119,217 @@ digest_client_generate_header(digest_t *digest, char *result, size_t max_length)
 		    dig->nonce,\
 		    dig->cnonce,\
 		    dig->nc);
+		result_size += sz;
 		if (sz == -1 || result_size >= max_length) {
 			return -1;
 		}
 	}
 
+	if (dig->userhash) {
+		sz = snprintf(result + result_size, max_length - result_size, ", userhash=true");
+		result_size += sz;
+		if (sz == -1 || result_size >= max_length) {
+			return -1;
+		}
+	}
+
+	return result_size;
+}
+
+/**
+ * Same as _render_header(), between the client__header probes.
+ */
+static size_t
+_generate_header(digest_s *dig, const char *hash_a1, const MD5_CTX *prefix, char *result, size_t max_length)
+{
+	size_t result_size;
+
+	TRACE3(client__header__start, dig->algorithm, dig->qop, dig->method);
+	result_size = _render_header(dig, hash_a1, prefix, result, max_length);
+	TRACE1(client__header__done, (long) result_size);
+
 	return result_size;
 }
+
+/**
+ * Generates the Authorization header string.
+ *
+ * Attributes that must be set manually before calling this function:
+ *
+ *  - Username
+ *  - Password
+ *  - URI
+ *  - Method
+ *
+ * If not set, NULL will be returned.
+ *
+ * Returns the number of bytes in the result string.
+ */
+size_t
+digest_client_generate_header(digest_t *digest, char *result, size_t max_length)
+{
+	digest_s *dig = (digest_s *) digest;
+	char hash_a1[52];
+
+	/* Check length of char attributes to prevent buffer overflow */
+	if (-1 == parse_validate_attributes(dig)) {
+		return -1;
+	}
+
+	hash_generate_a1(hash_a1, dig->username, dig->realm, dig->password);
+
+	return _generate_header(dig, hash_a1, NULL, result, max_length);
+}
+
+/**
+ * Generates the Authorization header string from a stored HA1 instead of
+ * the password.
+ *
+ * Returns the number of bytes in the result string, -1 on failure.
+ */
+size_t
+digest_client_generate_header_ha1(digest_t *digest, const char *ha1, char *result, size_t max_length)
+{
+	digest_s *dig = (digest_s *) digest;
+
+	/* Check length of char attributes to prevent buffer overflow */
+	if (NULL == ha1 || 32 != strlen(ha1)) {
+		return -1;
+	}
+	if (-1 == _check_string(dig->username) || -1 == _check_string(dig->uri)
+	    || -1 == _check_string(dig->realm)) {
+		return -1;
+	}
+	if (NULL != dig->opaque && 255 < strlen(dig->opaque)) {
+		return -1;
+	}
+	if (DIGEST_QOP_NOT_SET != dig->qop && -1 == _check_string(dig->nonce)) {
+		return -1;
+	}
+
+	return _generate_header(dig, ha1, NULL, result, max_length);
+}
+
+/**
+ * Generates Authorization header strings for many requests at once.
+ *
+ * HA1 and the MD5 state after "ha1:nonce:" are computed once for the
+ * whole batch, and HA2 goes through the HA2 cache. Request i gets the
+ * nonce count nc + i, and its header starts at arena + offsets[i].
+ *
+ * Returns the number of bytes used in arena, -1 on failure, in which case
+ * the nonce count is not changed.
+ */
+size_t
+digest_client_generate_headers_batch(digest_t *digest, const unsigned int *methods, const char *const *uris, size_t n, char *arena, size_t arena_size, size_t *offsets)
+{
+	digest_s *dig = (digest_s *) digest;
+	digest_s req;
+	char hash_a1[52], raw[640];
+	MD5_CTX prefix;
+	size_t used = 0, sz, i;
+	int n_raw;
+
+	/* Validated with the URI of each request below */
+	req = *dig;
+	req.uri = "/";
+	if (0 == n || NULL == dig->nonce || -1 == parse_validate_attributes(&req)) {
+		return -1;
+	}
+
+	hash_generate_a1(hash_a1, dig->username, dig->realm, dig->password);
+
+	n_raw = snprintf(raw, sizeof (raw), "%s:%s:", hash_a1, dig->nonce);
+	if (n_raw >= (int) sizeof (raw)) {
+		return -1;
+	}
+	hash_md5_start_cached(&prefix, raw, n_raw, n_raw);
+
+	for (i = 0; i < n; ++i) {
+		if (-1 == _check_string(uris[i])) {
+			return -1;
+		}
+		req.uri = (char *) uris[i];
+		req.method = methods[i];
+		req.nc = dig->nc + i;
+
+		sz = _generate_header(&req, hash_a1, &prefix, arena + used, arena_size - used);
+		if ((size_t) -1 == sz || used + sz + 1 > arena_size) {
+			return -1;
+		}
+		offsets[i] = used;
+		used += sz + 1;
+	}
+
+	dig->nc += n;
+	return used;
+}
+
+/**
+ * Parses the Authentication-Info header of a response.
+ *
+ * If rspauth is given, it is checked against the request that was sent
+ * with this context. Then the context is made ready for the next request:
+ * nextnonce is adopted with the nonce count reset to 1, or the nonce count
+ * is increased if the nonce stays the same.
+ *
+ * Returns 0 on success, -1 if rspauth is wrong or the header could not be
+ * parsed.
+ */
+int
+digest_client_parse_auth_info(digest_t *digest, const char *header_value)
+{
+	digest_s *dig = (digest_s *) digest;
+	parse_auth_info_s info;
+	char hash_a1[52], hash_a2[52], hash_rsp[52], cnonce[9], copy[DIGEST_AUTH_INFO_MAX + 1];
+	MD5_CTX prefix;
+	size_t length;
+
+	if (NULL == header_value || DIGEST_AUTH_INFO_MAX < (length = strlen(header_value))) {
+		return -1;
+	}
+	/* Tokenize a copy of our own, only nextnonce is kept */
+	memcpy(copy, header_value, length + 1);
+	if (-1 == parse_auth_info(&info, copy)) {
+		return -1;
+	}
+
+	if (NULL != info.rspauth) {
+		if (-1 == parse_validate_attributes(dig) || NULL == dig->nonce) {
+			return -1;
+		}
+
+		sprintf(cnonce, "%08x", dig->cnonce);
+		if (DIGEST_QOP_NOT_SET != dig->qop) {
+			/* The server must echo what we sent */
+			if ((0 != info.nc && info.nc != dig->nc)
+			    || (NULL != info.cnonce && 0 != strcmp(info.cnonce, cnonce))) {
+				return -1;
+			}
+		}
+
+		hash_generate_a1(hash_a1, dig->username, dig->realm, dig->password);
+		if (DIGEST_QOP_NOT_SET != dig->qop) {
+			hash_response_prefix(&prefix, hash_a1, dig->nonce, dig->nc, cnonce, "auth");
+		} else {
+			hash_response_prefix(&prefix, hash_a1, dig->nonce, 0, NULL, NULL);
+		}
+		hash_generate_a2(hash_a2, "", dig->uri);
+		hash_response_finish(hash_rsp, &prefix, hash_a2);
+
+		if (0 != strcmp(hash_rsp, info.rspauth)) {
+			return -1;
+		}
+	}
+
+	if (NULL != info.nextnonce && -1 != _check_string(info.nextnonce)) {
+		/* The header copy goes away, the context holds the nonce itself */
+		strcpy(dig->nonce_buffer, info.nextnonce);
+		dig->nonce = dig->nonce_buffer;
+		dig->nc = 1;
+	} else {
+		dig->nc++;
+	}
+
+	return 0;
+}
@@ -29,4 +29,55 @@ extern int digest_client_parse(digest_t *digest, const char *digest_string);
  */
 extern size_t digest_client_generate_header(digest_t *digest, char *result, size_t max_length);
 
+/**
+ * Generate the Authorization header value from a stored HA1.
+ *
+ * Same as digest_client_generate_header(), but the password is not needed.
+ *
+ * @param digest_t *digest The digest context to generate the header value from.
+ * @param const char *ha1 The HA1 of the user, as 32 hex characters.
+ * @param char *result The buffer to store the generated header value in.
+ *
+ * Returns the number of bytes in the result string. -1 on failure.
+ */
+extern size_t digest_client_generate_header_ha1(digest_t *digest, const char *ha1, char *result, size_t max_length);
+
+/**
+ * Generate Authorization header values for a batch of requests.
+ *
+ * Like calling digest_client_generate_header() once per request, but the
+ * parts that are the same for all of them are hashed once. Request i is
+ * sent with nonce count nc + i, and the nonce count of the context is
+ * advanced past the batch.
+ *
+ * @param digest_t *digest The digest context, with username and password.
+ * @param const unsigned int *methods The method of each request.
+ * @param const char *const *uris The URI of each request.
+ * @param size_t n The number of requests.
+ * @param char *arena The buffer to store the null terminated values in.
+ * @param size_t *offsets Set to where the value of each request starts.
+ *
+ * Returns the number of bytes used in arena. -1 on failure.
+ */
+extern size_t digest_client_generate_headers_batch(digest_t *digest, const unsigned int *methods, const char *const *uris, size_t n, char *arena, size_t arena_size, size_t *offsets);
+
+/* Longest Authentication-Info header value parsed, in bytes */
+#define DIGEST_AUTH_INFO_MAX	1023
+
+/**
+ * Parse the Authentication-Info header of a response.
+ *
+ * Checks rspauth, if given, and prepares the context for the next request.
+ * If the server sent nextnonce, it is used from now on, so a rotated nonce
+ * does not cost a 401 round trip. The nextnonce is copied into the
+ * context; nothing is allocated. Values longer than DIGEST_AUTH_INFO_MAX
+ * fail.
+ *
+ * @param digest_t *digest The digest context the request was generated with.
+ * @param const char *header_value The value of the Authentication-Info header.
+ *
+ * @returns int 0 on success, -1 if rspauth is wrong or parsing failed.
+ */
+extern int digest_client_parse_auth_info(digest_t *digest, const char *header_value);
+
 #endif  /* INC_DIGEST_CLIENT_H */
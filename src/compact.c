@@ -0,0 +1,129 @@
+#include <string.h>
+#include "digest.h"
+#include "compact.h"
+
+/* The whole context must stay in one cache line */
+typedef char _compact_size_check[sizeof (digest_compact_s) == 64 ? 1 : -1];
+
+static const char _hex[] = "0123456789abcdef";
+
+/**
+ * Packs a lowercase hex string into nibbles.
+ *
+ * Returns the number of hex characters, -1 if the string is too long or
+ * not lowercase hex.
+ */
+static int
+_pack_hex(unsigned char *dst, const char *hex)
+{
+	int i, v;
+
+	memset(dst, 0, DIGEST_COMPACT_HEX_MAX / 2);
+	for (i = 0; '\0' != hex[i]; ++i) {
+		if (DIGEST_COMPACT_HEX_MAX == i) {
+			return -1;
+		}
+		if (hex[i] >= '0' && hex[i] <= '9') {
+			v = hex[i] - '0';
+		} else if (hex[i] >= 'a' && hex[i] <= 'f') {
+			v = hex[i] - 'a' + 10;
+		} else {
+			return -1;
+		}
+		dst[i / 2] |= (i & 1) ? v : v << 4;
+	}
+
+	return i;
+}
+
+static void
+_unpack_hex(char *dst, const unsigned char *src, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; ++i) {
+		dst[i] = _hex[(i & 1) ? src[i / 2] & 0x0f : src[i / 2] >> 4];
+	}
+	dst[len] = '\0';
+}
+
+int
+digest_compact_pack(digest_compact_t *compact, digest_t *digest)
+{
+	digest_compact_s *c = (digest_compact_s *) compact;
+	digest_s *dig = (digest_s *) digest;
+	int len;
+
+	memset(c, 0, sizeof (digest_compact_s));
+
+	if (NULL != dig->nonce) {
+		if (-1 == (len = _pack_hex(c->nonce, dig->nonce))) {
+			return -1;
+		}
+		c->nonce_len = len;
+		c->has_nonce = 1;
+	}
+	if (NULL != dig->opaque) {
+		if (-1 == (len = _pack_hex(c->opaque, dig->opaque))) {
+			return -1;
+		}
+		c->opaque_len = len;
+		c->has_opaque = 1;
+	}
+	if (dig->method > 15 || dig->qop > 3 || (unsigned char) dig->algorithm > 3) {
+		return -1;
+	}
+
+	c->realm = dig->realm;
+	c->cnonce = dig->cnonce;
+	c->nc = dig->nc;
+	c->algorithm = dig->algorithm;
+	c->qop = dig->qop;
+	c->method = dig->method;
+	c->stale = 0 != dig->stale;
+	c->userhash = 0 != dig->userhash;
+
+	return 0;
+}
+
+int
+digest_compact_unpack(const digest_compact_t *compact, digest_t *digest, char *buffer)
+{
+	const digest_compact_s *c = (const digest_compact_s *) compact;
+	digest_s *dig = (digest_s *) digest;
+
+	digest_init(dig);
+
+	dig->realm = (char *) c->realm;
+	if (c->has_nonce) {
+		_unpack_hex(buffer, c->nonce, c->nonce_len);
+		dig->nonce = buffer;
+	}
+	if (c->has_opaque) {
+		_unpack_hex(buffer + DIGEST_COMPACT_HEX_MAX + 1, c->opaque, c->opaque_len);
+		dig->opaque = buffer + DIGEST_COMPACT_HEX_MAX + 1;
+	}
+
+	dig->cnonce = c->cnonce;
+	dig->nc = c->nc;
+	dig->algorithm = c->algorithm;
+	dig->qop = c->qop;
+	dig->method = c->method;
+	dig->stale = c->stale;
+	dig->userhash = c->userhash;
+
+	return 0;
+}
+
+int
+digest_compact_nonce_cmp(const digest_compact_t *compact, const char *nonce)
+{
+	const digest_compact_s *c = (const digest_compact_s *) compact;
+	unsigned char packed[DIGEST_COMPACT_HEX_MAX / 2];
+
+	if (NULL == nonce || !c->has_nonce || (int) c->nonce_len != _pack_hex(packed, nonce)) {
+		return -1;
+	}
+
+	return 0 == memcmp(packed, c->nonce, sizeof (packed)) ? 0 : -1;
+}
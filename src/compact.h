@@ -0,0 +1,76 @@
+#ifndef INC_DIGEST_COMPACT_H
+#define INC_DIGEST_COMPACT_H
+#include "digest.h"
+
+/*
+ * Compact digest context.
+ *
+ * A digest_t is about 100 bytes of pointers into scattered strings. Servers
+ * that keep millions of outstanding challenges can store them in this form
+ * instead: one cache line with the nonce and opaque as binary, and the
+ * enumerated attributes packed into a single word.
+ *
+ * Only lowercase hex nonce and opaque values of up to 32 characters can be
+ * packed, which covers MD5 based nonces. The realm is not copied; it must
+ * outlive the compact context, like a server's configured realm does.
+ */
+
+#define DIGEST_COMPACT_HEX_MAX		32
+#define DIGEST_COMPACT_BUFFER_SIZE	(2 * (DIGEST_COMPACT_HEX_MAX + 1))
+
+typedef struct {
+	unsigned char nonce[DIGEST_COMPACT_HEX_MAX / 2];
+	unsigned char opaque[DIGEST_COMPACT_HEX_MAX / 2];
+	const char *realm;
+	unsigned int cnonce;
+	unsigned int nc;
+	unsigned int algorithm:2;
+	unsigned int qop:2;
+	unsigned int method:4;
+	unsigned int stale:1;
+	unsigned int userhash:1;
+	unsigned int has_nonce:1;
+	unsigned int has_opaque:1;
+	unsigned int nonce_len:6;	/* In hex characters */
+	unsigned int opaque_len:6;
+} __attribute__((aligned(64))) digest_compact_s;
+
+typedef digest_compact_s digest_compact_t;
+
+/**
+ * Pack a digest context.
+ *
+ * Strings other than realm, nonce and opaque are not kept.
+ *
+ * @param digest_compact_t *compact The compact context to fill.
+ * @param digest_t *digest The digest context to pack.
+ *
+ * @returns int 0 on success, -1 if the nonce or opaque can not be packed.
+ */
+extern int digest_compact_pack(digest_compact_t *compact, digest_t *digest);
+
+/**
+ * Unpack a compact context into a digest context.
+ *
+ * @param const digest_compact_t *compact The compact context.
+ * @param digest_t *digest The digest context to initiate from it.
+ * @param char *buffer DIGEST_COMPACT_BUFFER_SIZE bytes for the nonce and
+ *        opaque strings, which must live as long as digest.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_compact_unpack(const digest_compact_t *compact, digest_t *digest, char *buffer);
+
+/**
+ * Compare the nonce of a compact context to a nonce string, without
+ * unpacking.
+ *
+ * @param const digest_compact_t *compact The compact context.
+ * @param const char *nonce The nonce, like one parsed from an
+ *        Authorization header.
+ *
+ * @returns int 0 if equal, otherwise -1.
+ */
+extern int digest_compact_nonce_cmp(const digest_compact_t *compact, const char *nonce);
+
+#endif  /* INC_DIGEST_COMPACT_H */
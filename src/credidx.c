@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "credidx.h"
+
+/**
+ * Hashes a (username, realm) pair as "username:realm".
+ */
+static unsigned int
+_credidx_hash(const char *username, size_t username_len, const char *realm, size_t realm_len)
+{
+	unsigned int h = HASH_FNV1A_INIT;
+
+	h = hash_fnv1a(h, username, username_len);
+	h = hash_fnv1a(h, ":", 1);
+	return hash_fnv1a(h, realm, realm_len);
+}
+
+int
+digest_credidx_open(digest_credidx_t *idx, const char *path, int flags)
+{
+	digest_credidx_s *ci = (digest_credidx_s *) idx;
+	const digest_credidx_header_s *hdr;
+	struct stat st;
+	size_t slots_size;
+	void *map;
+	int fd;
+
+	memset(ci, 0, sizeof (digest_credidx_s));
+
+	if (-1 == (fd = open(path, O_RDONLY))) {
+		return -1;
+	}
+	if (-1 == fstat(fd, &st) || st.st_size < (off_t) sizeof (digest_credidx_header_s)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		return -1;
+	}
+
+	/* Validate the header against the file size */
+	hdr = (const digest_credidx_header_s *) map;
+	slots_size = (size_t) hdr->n_slots * sizeof (digest_credidx_slot_s);
+	if (0 != memcmp(hdr->magic, DIGEST_CREDIDX_MAGIC, sizeof (DIGEST_CREDIDX_MAGIC))
+	    || DIGEST_CREDIDX_VERSION != hdr->version
+	    || DIGEST_CREDIDX_BOM != hdr->byte_order
+	    || sizeof (digest_credidx_header_s) != hdr->header_size
+	    || 0 == hdr->n_slots || 0 != (hdr->n_slots & (hdr->n_slots - 1))
+	    || hdr->n_entries > hdr->n_slots
+	    || (size_t) st.st_size != hdr->header_size + slots_size + hdr->pool_size) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	if (DIGEST_CREDIDX_VERIFY & flags) {
+		if (hdr->checksum != hash_fnv1a(HASH_FNV1A_INIT, (const char *) map + hdr->header_size, slots_size + hdr->pool_size)) {
+			munmap(map, st.st_size);
+			return -1;
+		}
+	}
+
+	ci->map = map;
+	ci->map_size = st.st_size;
+	ci->header = hdr;
+	ci->slots = (const digest_credidx_slot_s *) ((const char *) map + hdr->header_size);
+	ci->pool = (const char *) ci->slots + slots_size;
+
+	return 0;
+}
+
+int
+digest_credidx_lookup(const digest_credidx_t *idx, const char *username, const char *realm, char *ha1)
+{
+	const digest_credidx_s *ci = (const digest_credidx_s *) idx;
+	const digest_credidx_slot_s *slot;
+	size_t username_len, realm_len;
+	unsigned int h, mask, i, n;
+
+	if (NULL == ci->map || NULL == username || NULL == realm) {
+		return -1;
+	}
+
+	username_len = strlen(username);
+	realm_len = strlen(realm);
+	h = _credidx_hash(username, username_len, realm, realm_len);
+	mask = ci->header->n_slots - 1;
+
+	/* A corrupt index may have no empty slot to stop at */
+	for (i = h & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n) {
+		slot = &ci->slots[i];
+		if (0 == slot->flags) {
+			return -1;
+		}
+
+		if (slot->hash == h
+		    && slot->username_len == username_len
+		    && slot->realm_len == realm_len
+		    && slot->key_offset + username_len + realm_len <= ci->header->pool_size
+		    && 0 == memcmp(ci->pool + slot->key_offset, username, username_len)
+		    && 0 == memcmp(ci->pool + slot->key_offset + username_len, realm, realm_len)) {
+			hash_to_hex(ha1, slot->ha1);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void
+digest_credidx_close(digest_credidx_t *idx)
+{
+	digest_credidx_s *ci = (digest_credidx_s *) idx;
+
+	if (NULL != ci->map) {
+		munmap(ci->map, ci->map_size);
+	}
+	memset(ci, 0, sizeof (digest_credidx_s));
+}
+
+int
+digest_credidx_build(const char *path, const digest_credential_t *creds, unsigned int n_creds)
+{
+	digest_credidx_header_s hdr;
+	digest_credidx_slot_s *slots, *slot;
+	char *pool, tmp_path[4096];
+	size_t pool_size = 0, username_len, realm_len;
+	unsigned int n_slots = 16, mask, i, j;
+	FILE *fp;
+	int rc = -1;
+
+	/* Keep the load factor at or below 50% */
+	while (n_slots < 2 * (size_t) n_creds) {
+		n_slots <<= 1;
+	}
+	mask = n_slots - 1;
+
+	for (i = 0; i < n_creds; ++i) {
+		pool_size += strlen(creds[i].username) + strlen(creds[i].realm);
+	}
+	if (0xffffffff < pool_size) {
+		return -1;
+	}
+
+	slots = calloc(n_slots, sizeof (digest_credidx_slot_s));
+	pool = malloc(pool_size + 1);
+	if (NULL == slots || NULL == pool) {
+		goto out;
+	}
+
+	pool_size = 0;
+	for (i = 0; i < n_creds; ++i) {
+		username_len = strlen(creds[i].username);
+		realm_len = strlen(creds[i].realm);
+		if (0xffff < username_len || 0xffff < realm_len) {
+			goto out;
+		}
+
+		j = _credidx_hash(creds[i].username, username_len, creds[i].realm, realm_len) & mask;
+		while (0 != slots[j].flags) {
+			j = (j + 1) & mask;
+		}
+
+		slot = &slots[j];
+		if (-1 == hash_from_hex(slot->ha1, creds[i].ha1)) {
+			goto out;
+		}
+		slot->hash = _credidx_hash(creds[i].username, username_len, creds[i].realm, realm_len);
+		slot->key_offset = pool_size;
+		slot->username_len = username_len;
+		slot->realm_len = realm_len;
+		slot->flags = 1;
+
+		memcpy(pool + pool_size, creds[i].username, username_len);
+		memcpy(pool + pool_size + username_len, creds[i].realm, realm_len);
+		pool_size += username_len + realm_len;
+	}
+
+	memset(&hdr, 0, sizeof (hdr));
+	memcpy(hdr.magic, DIGEST_CREDIDX_MAGIC, sizeof (DIGEST_CREDIDX_MAGIC));
+	hdr.version = DIGEST_CREDIDX_VERSION;
+	hdr.byte_order = DIGEST_CREDIDX_BOM;
+	hdr.header_size = sizeof (hdr);
+	hdr.n_entries = n_creds;
+	hdr.n_slots = n_slots;
+	hdr.pool_size = pool_size;
+	hdr.checksum = hash_fnv1a(HASH_FNV1A_INIT, slots, (size_t) n_slots * sizeof (digest_credidx_slot_s));
+	hdr.checksum = hash_fnv1a(hdr.checksum, pool, pool_size);
+
+	if (sizeof (tmp_path) <= (size_t) snprintf(tmp_path, sizeof (tmp_path), "%s.tmp", path)) {
+		goto out;
+	}
+	if (NULL == (fp = fopen(tmp_path, "wb"))) {
+		goto out;
+	}
+	if (1 != fwrite(&hdr, sizeof (hdr), 1, fp)
+	    || n_slots != fwrite(slots, sizeof (digest_credidx_slot_s), n_slots, fp)
+	    || pool_size != fwrite(pool, 1, pool_size, fp)) {
+		fclose(fp);
+		unlink(tmp_path);
+		goto out;
+	}
+	if (0 != fclose(fp) || 0 != rename(tmp_path, path)) {
+		unlink(tmp_path);
+		goto out;
+	}
+
+	rc = 0;
+out:
+	free(slots);
+	free(pool);
+	return rc;
+}
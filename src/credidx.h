@@ -0,0 +1,112 @@
+#ifndef INC_DIGEST_CREDIDX_H
+#define INC_DIGEST_CREDIDX_H
+#include <stddef.h>
+
+/*
+ * Binary credential index.
+ *
+ * A read-only file that maps (username, realm) to a binary HA1. It is opened
+ * with mmap and looked up in place, so nothing is parsed or allocated when a
+ * server starts, no matter how many users there are.
+ *
+ * File layout, host byte order (a byte order mark is checked on open):
+ *
+ *   header   64 bytes, see digest_credidx_header_s
+ *   slots    n_slots * 32 bytes, open addressing with linear probing
+ *   pool     username and realm bytes referenced by the slots
+ */
+
+#define DIGEST_CREDIDX_MAGIC	"DGSTIDX"
+#define DIGEST_CREDIDX_VERSION	1
+#define DIGEST_CREDIDX_BOM	0x01020304
+
+/* Flags for digest_credidx_open() */
+#define DIGEST_CREDIDX_VERIFY	1 /* Check the checksum, reads the whole file */
+
+typedef struct {
+	char magic[8];			/* DIGEST_CREDIDX_MAGIC */
+	unsigned int version;		/* DIGEST_CREDIDX_VERSION */
+	unsigned int byte_order;	/* DIGEST_CREDIDX_BOM */
+	unsigned int header_size;
+	unsigned int n_entries;
+	unsigned int n_slots;		/* Power of two */
+	unsigned int pool_size;
+	unsigned int checksum;		/* FNV-1a of slots and pool */
+	unsigned char reserved[28];
+} digest_credidx_header_s;
+
+typedef struct {
+	unsigned int hash;		/* FNV-1a of "username:realm" */
+	unsigned int key_offset;	/* Offset of the username in the pool */
+	unsigned short username_len;
+	unsigned short realm_len;	/* The realm follows the username */
+	unsigned int flags;		/* 1 if the slot is used */
+	unsigned char ha1[16];
+} digest_credidx_slot_s;
+
+/* An opened index */
+typedef struct {
+	void *map;
+	size_t map_size;
+	const digest_credidx_header_s *header;
+	const digest_credidx_slot_s *slots;
+	const char *pool;
+} digest_credidx_s;
+
+typedef digest_credidx_s digest_credidx_t;
+
+/* One credential, as given to digest_credidx_build() */
+typedef struct {
+	const char *username;
+	const char *realm;
+	const char *ha1;	/* 32 hex characters, as from hash_generate_a1() */
+} digest_credential_t;
+
+/**
+ * Open a credential index file.
+ *
+ * The file is mapped read-only. Only the header is validated, unless
+ * DIGEST_CREDIDX_VERIFY is given.
+ *
+ * @param digest_credidx_t *idx The index context to initialize.
+ * @param const char *path Path to the index file.
+ * @param int flags 0 or DIGEST_CREDIDX_VERIFY.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_credidx_open(digest_credidx_t *idx, const char *path, int flags);
+
+/**
+ * Look up the HA1 of a user.
+ *
+ * @param const digest_credidx_t *idx The opened index.
+ * @param const char *username The username.
+ * @param const char *realm The realm.
+ * @param char *ha1 Buffer of at least 33 bytes, filled with the HA1 as hex.
+ *
+ * @returns int 0 if found, otherwise -1.
+ */
+extern int digest_credidx_lookup(const digest_credidx_t *idx, const char *username, const char *realm, char *ha1);
+
+/**
+ * Unmap a credential index.
+ *
+ * @param digest_credidx_t *idx The index to close.
+ */
+extern void digest_credidx_close(digest_credidx_t *idx);
+
+/**
+ * Write a credential index file.
+ *
+ * The file is written to a temporary name next to path and renamed into
+ * place, so a running server can reopen it at any time.
+ *
+ * @param const char *path Path of the index file to create.
+ * @param const digest_credential_t *creds The credentials.
+ * @param unsigned int n_creds Number of credentials.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_credidx_build(const char *path, const digest_credential_t *creds, unsigned int n_creds);
+
+#endif  /* INC_DIGEST_CREDIDX_H */
@@ -0,0 +1,590 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "md5.h"
+#include "hash.h"
+#include "credtab.h"
+
+typedef struct {
+	unsigned int hash;
+	const char *username;	/* Points into the table buffer */
+	const char *realm;
+	unsigned char ha1[16];
+	unsigned char userhash[16];	/* MD5 of "username:realm", if indexed */
+} digest_credtab_entry_s;
+
+/* A part of the file and what was parsed from it */
+typedef struct {
+	struct digest_credtab_s *tab;
+	char *start;
+	char *end;
+	digest_credtab_entry_s *entries;
+	unsigned int n_entries;
+	int failed;
+} digest_credtab_chunk_s;
+
+struct digest_credtab_s {
+	char *buffer;			/* The file contents, null terminated per field */
+	digest_credtab_chunk_s *chunks;
+	int n_chunks;
+	digest_credtab_entry_s **slots;	/* Open addressing, linear probing */
+	digest_credtab_entry_s **userhash_slots; /* The same, keyed by userhash */
+	unsigned int mask;
+	unsigned int n_entries;
+	int userhash;
+};
+
+static unsigned int _credstore_next_shard = 0;
+static __thread unsigned int _credstore_shard = (unsigned int) -1;
+
+/**
+ * Hashes a (username, realm) pair as "username:realm".
+ */
+static unsigned int
+_credtab_hash(const char *username, const char *realm)
+{
+	unsigned int h = HASH_FNV1A_INIT;
+
+	h = hash_fnv1a(h, username, strlen(username));
+	h = hash_fnv1a(h, ":", 1);
+	return hash_fnv1a(h, realm, strlen(realm));
+}
+
+/**
+ * Parses the lines of one chunk of an htdigest file.
+ *
+ * Lines are split in place. The username ends at the first colon and the
+ * HA1 starts after the last one, so realms may contain colons.
+ */
+static void *
+_credtab_parse_chunk(void *arg)
+{
+	digest_credtab_chunk_s *chunk = (digest_credtab_chunk_s *) arg;
+	digest_credtab_entry_s *entry, *tmp;
+	unsigned int cap = 0;
+	char *line, *eol, *realm, *ha1;
+
+	for (line = chunk->start; line < chunk->end; line = eol + 1) {
+		if (NULL == (eol = memchr(line, '\n', chunk->end - line))) {
+			eol = chunk->end;
+		}
+		*eol = '\0';
+		if (eol > line && '\r' == eol[-1]) {
+			eol[-1] = '\0';
+		}
+
+		if ('\0' == *line || '#' == *line) {
+			continue;
+		}
+		if (NULL == (realm = strchr(line, ':')) || NULL == (ha1 = strrchr(line, ':'))
+		    || ha1 == realm || 32 != strlen(ha1 + 1)) {
+			continue;
+		}
+
+		if (chunk->n_entries == cap) {
+			cap = cap ? cap * 2 : 1024;
+			if (NULL == (tmp = realloc(chunk->entries, cap * sizeof (digest_credtab_entry_s)))) {
+				chunk->failed = 1;
+				return NULL;
+			}
+			chunk->entries = tmp;
+		}
+
+		entry = &chunk->entries[chunk->n_entries];
+		if (-1 == hash_from_hex(entry->ha1, ha1 + 1)) {
+			continue;
+		}
+		if (chunk->tab->userhash) {
+			/* The line up to the HA1 is "username:realm" */
+			MD5_Short(entry->userhash, line, ha1 - line);
+		}
+		*realm++ = '\0';
+		*ha1 = '\0';
+		entry->username = line;
+		entry->realm = realm;
+		entry->hash = _credtab_hash(line, realm);
+		chunk->n_entries++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Inserts an entry into a slot array, keyed by (username, realm) or by
+ * userhash.
+ *
+ * Slots are claimed with compare-and-swap. When two lines have the same
+ * key, the one earlier in the file is kept.
+ */
+static void
+_credtab_insert(digest_credtab_entry_s **slots, unsigned int mask, digest_credtab_entry_s *entry, int by_userhash)
+{
+	digest_credtab_entry_s *cur;
+	unsigned int h, j;
+	int same;
+
+	if (by_userhash) {
+		memcpy(&h, entry->userhash, sizeof (h));
+	} else {
+		h = entry->hash;
+	}
+
+	for (j = h & mask;;) {
+		cur = __atomic_load_n(&slots[j], __ATOMIC_ACQUIRE);
+		if (NULL == cur) {
+			if (__atomic_compare_exchange_n(&slots[j], &cur, entry, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				return;
+			}
+			/* Lost the race, look at the winner */
+		}
+
+		if (by_userhash) {
+			same = 0 == memcmp(cur->userhash, entry->userhash, sizeof (entry->userhash));
+		} else {
+			same = cur->hash == entry->hash && 0 == strcmp(cur->username, entry->username)
+			    && 0 == strcmp(cur->realm, entry->realm);
+		}
+		if (same) {
+			if (cur->username < entry->username
+			    || __atomic_compare_exchange_n(&slots[j], &cur, entry, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				return;
+			}
+			continue;
+		}
+
+		j = (j + 1) & mask;
+	}
+}
+
+/**
+ * Inserts the entries of one chunk into the shared slot arrays.
+ */
+static void *
+_credtab_insert_chunk(void *arg)
+{
+	digest_credtab_chunk_s *chunk = (digest_credtab_chunk_s *) arg;
+	struct digest_credtab_s *tab = chunk->tab;
+	unsigned int i;
+
+	for (i = 0; i < chunk->n_entries; ++i) {
+		_credtab_insert(tab->slots, tab->mask, &chunk->entries[i], 0);
+		if (tab->userhash) {
+			_credtab_insert(tab->userhash_slots, tab->mask, &chunk->entries[i], 1);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Runs a function over all chunks, one thread per chunk.
+ */
+static void
+_credtab_run(struct digest_credtab_s *tab, void *(*fn)(void *))
+{
+	pthread_t threads[tab->n_chunks];
+	int i, started;
+
+	for (started = 1; started < tab->n_chunks; ++started) {
+		if (0 != pthread_create(&threads[started], NULL, fn, &tab->chunks[started])) {
+			break;
+		}
+	}
+
+	/* The calling thread takes the first chunk, and any that failed to start */
+	fn(&tab->chunks[0]);
+	for (i = started; i < tab->n_chunks; ++i) {
+		fn(&tab->chunks[i]);
+	}
+	for (i = 1; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+static void
+_credtab_free(struct digest_credtab_s *tab)
+{
+	int i;
+
+	if (NULL == tab) {
+		return;
+	}
+
+	for (i = 0; i < tab->n_chunks; ++i) {
+		free(tab->chunks[i].entries);
+	}
+	free(tab->chunks);
+	free(tab->slots);
+	free(tab->userhash_slots);
+	free(tab->buffer);
+	free(tab);
+}
+
+/**
+ * Reads an htdigest file and builds a table from it with n_threads threads.
+ *
+ * Returns the new table, or NULL on failure.
+ */
+static struct digest_credtab_s *
+_credtab_load(const char *path, int n_threads, int userhash)
+{
+	struct digest_credtab_s *tab;
+	size_t size = 0, cap = 1 << 16, n;
+	unsigned int n_slots = 16;
+	char *tmp, *cursor;
+	FILE *fp;
+	int i;
+
+	if (NULL == (tab = calloc(1, sizeof (struct digest_credtab_s)))) {
+		return NULL;
+	}
+	tab->userhash = userhash;
+
+	if (NULL == (fp = fopen(path, "r"))) {
+		free(tab);
+		return NULL;
+	}
+	tab->buffer = malloc(cap + 1);
+	while (NULL != tab->buffer && 0 < (n = fread(tab->buffer + size, 1, cap - size, fp))) {
+		size += n;
+		if (size == cap) {
+			cap *= 2;
+			if (NULL == (tmp = realloc(tab->buffer, cap + 1))) {
+				break;
+			}
+			tab->buffer = tmp;
+		}
+	}
+	if (NULL == tab->buffer || ferror(fp) || !feof(fp)) {
+		fclose(fp);
+		_credtab_free(tab);
+		return NULL;
+	}
+	fclose(fp);
+	tab->buffer[size] = '\0';
+
+	/* Small files are not worth a thread each */
+	if ((size_t) n_threads > size / 4096 + 1) {
+		n_threads = size / 4096 + 1;
+	}
+	if (NULL == (tab->chunks = calloc(n_threads, sizeof (digest_credtab_chunk_s)))) {
+		_credtab_free(tab);
+		return NULL;
+	}
+	tab->n_chunks = n_threads;
+
+	/* Split the buffer at line boundaries */
+	cursor = tab->buffer;
+	for (i = 0; i < n_threads; ++i) {
+		tab->chunks[i].tab = tab;
+		tab->chunks[i].start = cursor;
+		if (i == n_threads - 1) {
+			cursor = tab->buffer + size;
+		} else {
+			cursor = tab->buffer + size * (i + 1) / n_threads;
+			if (cursor < tab->chunks[i].start) {
+				cursor = tab->chunks[i].start;
+			}
+			while (cursor < tab->buffer + size && '\n' != *cursor) {
+				cursor++;
+			}
+			if (cursor < tab->buffer + size) {
+				cursor++;
+			}
+		}
+		tab->chunks[i].end = cursor;
+	}
+
+	_credtab_run(tab, _credtab_parse_chunk);
+	for (i = 0; i < n_threads; ++i) {
+		if (tab->chunks[i].failed) {
+			_credtab_free(tab);
+			return NULL;
+		}
+		tab->n_entries += tab->chunks[i].n_entries;
+	}
+
+	/* Keep the load factor at or below 50% */
+	while (n_slots < 2 * (size_t) tab->n_entries) {
+		n_slots <<= 1;
+	}
+	tab->mask = n_slots - 1;
+	tab->slots = calloc(n_slots, sizeof (digest_credtab_entry_s *));
+	if (userhash) {
+		tab->userhash_slots = calloc(n_slots, sizeof (digest_credtab_entry_s *));
+	}
+	if (NULL == tab->slots || (userhash && NULL == tab->userhash_slots)) {
+		_credtab_free(tab);
+		return NULL;
+	}
+
+	_credtab_run(tab, _credtab_insert_chunk);
+
+	/* Duplicates only take one slot */
+	tab->n_entries = 0;
+	for (n = 0; n < n_slots; ++n) {
+		tab->n_entries += (NULL != tab->slots[n]);
+	}
+
+	return tab;
+}
+
+static const digest_credtab_entry_s *
+_credtab_lookup(const struct digest_credtab_s *tab, const char *username, const char *realm)
+{
+	const digest_credtab_entry_s *entry;
+	unsigned int h, j;
+
+	h = _credtab_hash(username, realm);
+	for (j = h & tab->mask; NULL != (entry = tab->slots[j]); j = (j + 1) & tab->mask) {
+		if (entry->hash == h && 0 == strcmp(entry->username, username)
+		    && 0 == strcmp(entry->realm, realm)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static const digest_credtab_entry_s *
+_credtab_lookup_userhash(const struct digest_credtab_s *tab, const unsigned char *userhash)
+{
+	const digest_credtab_entry_s *entry;
+	unsigned int h, j;
+
+	memcpy(&h, userhash, sizeof (h));
+	for (j = h & tab->mask; NULL != (entry = tab->userhash_slots[j]); j = (j + 1) & tab->mask) {
+		if (0 == memcmp(entry->userhash, userhash, sizeof (entry->userhash))) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Marks the calling thread as reading the live table.
+ *
+ * Returns the counter to pass to _credstore_exit().
+ */
+static unsigned long *
+_credstore_enter(digest_credstore_s *cs)
+{
+	unsigned long *counter;
+	unsigned long e;
+
+	if ((unsigned int) -1 == _credstore_shard) {
+		_credstore_shard = __atomic_fetch_add(&_credstore_next_shard, 1, __ATOMIC_RELAXED) % DIGEST_CREDSTORE_SHARDS;
+	}
+
+	e = __atomic_load_n(&cs->epoch, __ATOMIC_SEQ_CST);
+	counter = &cs->readers[e & 1][_credstore_shard].count;
+	__atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
+
+	return counter;
+}
+
+static void
+_credstore_exit(unsigned long *counter)
+{
+	__atomic_fetch_sub(counter, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits until no reader can hold a table that was swapped out before the
+ * call.
+ *
+ * The epoch is flipped twice. Each flip sends new readers to the other
+ * set of counters, so the old set drains even under constant load. A
+ * reader that read the epoch before one flip but counted itself after the
+ * drain check is caught by the second one.
+ */
+static void
+_credstore_synchronize(digest_credstore_s *cs)
+{
+	unsigned long old;
+	int phase, i;
+
+	for (phase = 0; phase < 2; ++phase) {
+		old = __atomic_fetch_add(&cs->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+		for (i = 0; i < DIGEST_CREDSTORE_SHARDS; ++i) {
+			while (0 != __atomic_load_n(&cs->readers[old][i].count, __ATOMIC_ACQUIRE)) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+int
+digest_credstore_init(digest_credstore_t *store, int n_threads)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+
+	memset(cs, 0, sizeof (digest_credstore_s));
+
+	if (0 >= n_threads) {
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	cs->n_threads = 0 < n_threads ? n_threads : 1;
+
+	if (0 != pthread_mutex_init(&cs->reload_lock, NULL)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+digest_credstore_index_userhash(digest_credstore_t *store)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+
+	cs->userhash = 1;
+	return 0;
+}
+
+int
+digest_credstore_load(digest_credstore_t *store, const char *path)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+	struct digest_credtab_s *tab, *old;
+
+	if (NULL == (tab = _credtab_load(path, cs->n_threads, cs->userhash))) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&cs->reload_lock);
+	old = __atomic_exchange_n(&cs->current, tab, __ATOMIC_SEQ_CST);
+	_credstore_synchronize(cs);
+	pthread_mutex_unlock(&cs->reload_lock);
+
+	_credtab_free(old);
+	return 0;
+}
+
+static void *
+_credstore_reload_thread(void *arg)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) arg;
+
+	digest_credstore_load(cs, cs->reload_path);
+	__atomic_store_n(&cs->reloader_state, 2, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+int
+digest_credstore_reload_async(digest_credstore_t *store, const char *path)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+	int state;
+
+	state = __atomic_load_n(&cs->reloader_state, __ATOMIC_ACQUIRE);
+	if (1 == state) {
+		return -1;
+	}
+	if (2 == state) {
+		pthread_join(cs->reloader, NULL);
+	}
+
+	free(cs->reload_path);
+	if (NULL == (cs->reload_path = strdup(path))) {
+		cs->reloader_state = 0;
+		return -1;
+	}
+
+	cs->reloader_state = 1;
+	if (0 != pthread_create(&cs->reloader, NULL, _credstore_reload_thread, cs)) {
+		cs->reloader_state = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+digest_credstore_lookup(digest_credstore_t *store, const char *username, const char *realm, char *ha1)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+	const digest_credtab_entry_s *entry = NULL;
+	struct digest_credtab_s *tab;
+	unsigned long *counter;
+
+	if (NULL == username || NULL == realm) {
+		return -1;
+	}
+
+	counter = _credstore_enter(cs);
+	tab = __atomic_load_n(&cs->current, __ATOMIC_SEQ_CST);
+	if (NULL != tab && NULL != (entry = _credtab_lookup(tab, username, realm))) {
+		hash_to_hex(ha1, entry->ha1);
+	}
+	_credstore_exit(counter);
+
+	return NULL != entry ? 0 : -1;
+}
+
+int
+digest_credstore_lookup_userhash(digest_credstore_t *store, const char *userhash, const char *realm, char *username, size_t username_size, char *ha1)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+	const digest_credtab_entry_s *entry = NULL;
+	struct digest_credtab_s *tab;
+	unsigned char key[16];
+	unsigned long *counter;
+	int rc = -1;
+
+	if (NULL == userhash || NULL == realm || 32 != strlen(userhash) || -1 == hash_from_hex(key, userhash)) {
+		return -1;
+	}
+
+	counter = _credstore_enter(cs);
+	tab = __atomic_load_n(&cs->current, __ATOMIC_SEQ_CST);
+	if (NULL != tab && NULL != tab->userhash_slots && NULL != (entry = _credtab_lookup_userhash(tab, key))
+	    && 0 == strcmp(entry->realm, realm)
+	    && (NULL == username || strlen(entry->username) < username_size)) {
+		if (NULL != username) {
+			strcpy(username, entry->username);
+		}
+		hash_to_hex(ha1, entry->ha1);
+		rc = 0;
+	}
+	_credstore_exit(counter);
+
+	return rc;
+}
+
+unsigned int
+digest_credstore_size(digest_credstore_t *store)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+	struct digest_credtab_s *tab;
+	unsigned long *counter;
+	unsigned int n = 0;
+
+	counter = _credstore_enter(cs);
+	if (NULL != (tab = __atomic_load_n(&cs->current, __ATOMIC_SEQ_CST))) {
+		n = tab->n_entries;
+	}
+	_credstore_exit(counter);
+
+	return n;
+}
+
+void
+digest_credstore_destroy(digest_credstore_t *store)
+{
+	digest_credstore_s *cs = (digest_credstore_s *) store;
+
+	if (0 != __atomic_load_n(&cs->reloader_state, __ATOMIC_ACQUIRE)) {
+		pthread_join(cs->reloader, NULL);
+	}
+
+	_credtab_free(cs->current);
+	free(cs->reload_path);
+	pthread_mutex_destroy(&cs->reload_lock);
+	memset(cs, 0, sizeof (digest_credstore_s));
+}
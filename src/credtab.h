@@ -0,0 +1,136 @@
+#ifndef INC_DIGEST_CREDTAB_H
+#define INC_DIGEST_CREDTAB_H
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * In-memory credential table loaded from an Apache htdigest file
+ * (username:realm:HA1, one per line).
+ *
+ * The file is split across threads, which parse their part and insert into
+ * one lock-free hash table. A credential store holds the live table and can
+ * reload it in the background: the new table is swapped in with a pointer
+ * exchange and the old one is freed once no reader can still see it.
+ * Lookups never block.
+ */
+
+/* Number of reader counters per epoch, spread over cache lines */
+#define DIGEST_CREDSTORE_SHARDS	16
+
+struct digest_credtab_s;
+
+typedef struct {
+	unsigned long count;
+	char pad[64 - sizeof (unsigned long)];
+} digest_credstore_counter_s;
+
+typedef struct {
+	struct digest_credtab_s *current;	/* The live table */
+	unsigned long epoch;
+	digest_credstore_counter_s readers[2][DIGEST_CREDSTORE_SHARDS];
+	pthread_mutex_t reload_lock;		/* Serializes reloads */
+	pthread_t reloader;
+	int reloader_state;			/* 0 none, 1 running, 2 joinable */
+	int n_threads;
+	int userhash;				/* Index userhashes on load */
+	char *reload_path;
+} digest_credstore_s;
+
+typedef digest_credstore_s digest_credstore_t;
+
+/**
+ * Initiate a credential store. The store is empty until loaded.
+ *
+ * @param digest_credstore_t *store The store to initiate.
+ * @param int n_threads Number of threads to load files with, 0 for one
+ *        per online CPU.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_credstore_init(digest_credstore_t *store, int n_threads);
+
+/**
+ * Load an htdigest file and make it the live table.
+ *
+ * Blocks until the file is loaded and the previous table is reclaimed.
+ * Lookups running at the same time are not blocked. Malformed lines are
+ * skipped. If a user is listed twice for a realm, the first line wins.
+ *
+ * @param digest_credstore_t *store The credential store.
+ * @param const char *path Path to the htdigest file.
+ *
+ * @returns int 0 on success, otherwise -1 and the live table is kept.
+ */
+extern int digest_credstore_load(digest_credstore_t *store, const char *path);
+
+/**
+ * Index the userhashes of rfc7616 in tables loaded from now on.
+ *
+ * With the index, a username sent as H(username:realm) is found with one
+ * lookup instead of by hashing every user of the realm. Loading hashes
+ * each line once more.
+ *
+ * @param digest_credstore_t *store The credential store.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_credstore_index_userhash(digest_credstore_t *store);
+
+/**
+ * Reload an htdigest file in a background thread.
+ *
+ * Meant to be called from one control thread, for example on SIGHUP.
+ *
+ * @param digest_credstore_t *store The credential store.
+ * @param const char *path Path to the htdigest file.
+ *
+ * @returns int 0 if the reload was started, -1 if one is already running
+ *          or the thread could not be created.
+ */
+extern int digest_credstore_reload_async(digest_credstore_t *store, const char *path);
+
+/**
+ * Look up the HA1 of a user.
+ *
+ * @param digest_credstore_t *store The credential store.
+ * @param const char *username The username.
+ * @param const char *realm The realm.
+ * @param char *ha1 Buffer of at least 33 bytes, filled with the HA1 as hex.
+ *
+ * @returns int 0 if found, otherwise -1.
+ */
+extern int digest_credstore_lookup(digest_credstore_t *store, const char *username, const char *realm, char *ha1);
+
+/**
+ * Look up a user by the userhash of rfc7616.
+ *
+ * @param digest_credstore_t *store The credential store, with userhashes
+ *        indexed.
+ * @param const char *userhash The username of an Authorization header
+ *        with userhash=true, as 32 hex characters.
+ * @param const char *realm The realm.
+ * @param char *username Buffer for the username, or NULL.
+ * @param size_t username_size The size of the username buffer.
+ * @param char *ha1 Buffer of at least 33 bytes, filled with the HA1 as hex.
+ *
+ * @returns int 0 if found, otherwise -1.
+ */
+extern int digest_credstore_lookup_userhash(digest_credstore_t *store, const char *userhash, const char *realm, char *username, size_t username_size, char *ha1);
+
+/**
+ * Get the number of credentials in the live table.
+ *
+ * @param digest_credstore_t *store The credential store.
+ *
+ * @returns unsigned int The number of credentials.
+ */
+extern unsigned int digest_credstore_size(digest_credstore_t *store);
+
+/**
+ * Free a credential store. Waits for a running background reload.
+ *
+ * @param digest_credstore_t *store The store to free.
+ */
+extern void digest_credstore_destroy(digest_credstore_t *store);
+
+#endif  /* INC_DIGEST_CREDTAB_H */
@@ -58,6 +58,14 @@ digest_get_attr(digest_t *digest, digest_attr_t attr)
 		return &(dig->qop);
 	case D_ATTR_NONCE_COUNT:
 		return &(dig->nc);
+	case D_ATTR_RESPONSE:
+		return dig->response;
+	case D_ATTR_DOMAIN:
+		return dig->domain;
+	case D_ATTR_STALE:
+		return &(dig->stale);
+	case D_ATTR_USERHASH:
+		return &(dig->userhash);
 	default:
 		return NULL;
 	}
@@ -83,6 +91,7 @@ digest_set_attr(digest_t *digest, digest_attr_t attr, const digest_attr_value_t
 		break;
 	case D_ATTR_CNONCE:
 		dig->cnonce = value.number;
+		dig->cnonce_value = NULL;
 		break;
 	case D_ATTR_OPAQUE:
 		dig->opaque = value.string;
@@ -102,6 +111,18 @@ digest_set_attr(digest_t *digest, digest_attr_t attr, const digest_attr_value_t
 	case D_ATTR_NONCE_COUNT:
 		dig->nc = value.number;
 		break;
+	case D_ATTR_RESPONSE:
+		dig->response = value.string;
+		break;
+	case D_ATTR_DOMAIN:
+		dig->domain = value.string;
+		break;
+	case D_ATTR_STALE:
+		dig->stale = value.number;
+		break;
+	case D_ATTR_USERHASH:
+		dig->userhash = value.number;
+		break;
 	default:
 		return -1;
 	}
@@ -13,6 +13,12 @@ typedef struct {
 	char algorithm;
 	unsigned int qop;
 	unsigned int nc;
+	char *response;		/* Parsed from an Authorization header */
+	char *cnonce_value;	/* The cnonce as sent by the client */
+	char *domain;		/* Space separated URIs of the protection space */
+	unsigned int stale;
+	unsigned int userhash;	/* The username is H(username:realm), rfc7616 */
+	char nonce_buffer[256];	/* Holds a generated nonce, or an adopted nextnonce */
 } digest_s;
 
 /* Digest context type (digest struct) */
@@ -32,7 +38,11 @@ typedef enum {
 	D_ATTR_METHOD,		/* int */
 	D_ATTR_ALGORITHM,	/* int */
 	D_ATTR_QOP,		/* int */
-	D_ATTR_NONCE_COUNT	/* int */
+	D_ATTR_NONCE_COUNT,	/* int */
+	D_ATTR_RESPONSE,	/* char * */
+	D_ATTR_DOMAIN,		/* char * */
+	D_ATTR_STALE,		/* int */
+	D_ATTR_USERHASH		/* int */
 } digest_attr_t;
 
 /* Union type for attribute get/set function  */
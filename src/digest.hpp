@@ -0,0 +1,205 @@
+#ifndef INC_DIGEST_HPP
+#define INC_DIGEST_HPP
+
+/*
+ * C++17 layer over libdigest.
+ *
+ * digest::view reads a parsed digest_t through std::string_view accessors,
+ * without copying. digest::context owns a digest_t together with the
+ * header it was parsed from, and can only be moved. The header generators
+ * and verification are inline and write into caller buffers, like the C
+ * functions they call.
+ *
+ * Strings set on a context (username, password, uri) are not copied; they
+ * must outlive it, as with digest_set_attr().
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+extern "C" {
+#include "digest.h"
+#include "client.h"
+#include "server.h"
+}
+
+namespace digest {
+
+enum class method : unsigned int {
+	options = DIGEST_METHOD_OPTIONS,
+	get = DIGEST_METHOD_GET,
+	head = DIGEST_METHOD_HEAD,
+	post = DIGEST_METHOD_POST,
+	put = DIGEST_METHOD_PUT,
+	del = DIGEST_METHOD_DELETE,
+	trace = DIGEST_METHOD_TRACE,
+};
+
+enum class qop : unsigned int {
+	not_set = DIGEST_QOP_NOT_SET,
+	auth = DIGEST_QOP_AUTH,
+	auth_int = DIGEST_QOP_AUTH_INT,
+};
+
+enum class algorithm : char {
+	not_set = DIGEST_ALGORITHM_NOT_SET,
+	md5 = DIGEST_ALGORITHM_MD5,
+};
+
+/* Turns a NULL attribute into an empty view */
+constexpr std::string_view
+to_view(const char *s) noexcept
+{
+	return nullptr != s ? std::string_view(s) : std::string_view();
+}
+
+/* A non-owning, read-only view of a digest context */
+class view {
+public:
+	constexpr explicit view(const digest_t &digest) noexcept : d_(&digest) {}
+
+	std::string_view username() const noexcept { return to_view(d_->username); }
+	std::string_view realm() const noexcept { return to_view(d_->realm); }
+	std::string_view nonce() const noexcept { return to_view(d_->nonce); }
+	std::string_view opaque() const noexcept { return to_view(d_->opaque); }
+	std::string_view uri() const noexcept { return to_view(d_->uri); }
+	std::string_view response() const noexcept { return to_view(d_->response); }
+	std::string_view cnonce() const noexcept { return to_view(d_->cnonce_value); }
+	std::string_view domain() const noexcept { return to_view(d_->domain); }
+
+	digest::method method() const noexcept { return static_cast<digest::method>(d_->method); }
+	digest::qop qop() const noexcept { return static_cast<digest::qop>(d_->qop); }
+	digest::algorithm algorithm() const noexcept { return static_cast<digest::algorithm>(d_->algorithm); }
+	unsigned int nc() const noexcept { return d_->nc; }
+	bool stale() const noexcept { return 0 != d_->stale; }
+	bool userhash() const noexcept { return 0 != d_->userhash; }
+
+	const digest_t *get() const noexcept { return d_; }
+
+private:
+	const digest_t *d_;
+};
+
+/* A digest context that owns the header it was parsed from */
+class context {
+public:
+	context() noexcept { digest_init(&d_); }
+
+	context(const context &) = delete;
+	context &operator=(const context &) = delete;
+
+	context(context &&other) noexcept : d_(other.d_), header_(std::move(other.header_))
+	{
+		adopt_nonce_buffer(other);
+		digest_init(&other.d_);
+	}
+
+	context &operator=(context &&other) noexcept
+	{
+		if (this != &other) {
+			d_ = other.d_;
+			header_ = std::move(other.header_);
+			adopt_nonce_buffer(other);
+			digest_init(&other.d_);
+		}
+		return *this;
+	}
+
+	/* Parse an Authorization header value, for a server */
+	static std::optional<context> parse_authorization(std::string_view header)
+	{
+		context c;
+
+		if (!c.parse(header)) {
+			return std::nullopt;
+		}
+		return c;
+	}
+
+	/* Parse a WWW-Authenticate header value, for a client */
+	static std::optional<context> parse_challenge(std::string_view header)
+	{
+		context c;
+
+		if (!c.parse(header)) {
+			return std::nullopt;
+		}
+		/* The defaults of digest_client_parse() */
+		c.d_.nc = 1;
+		c.d_.cnonce = static_cast<unsigned int>(std::time(nullptr));
+		return c;
+	}
+
+	digest::view view() const noexcept { return digest::view(d_); }
+	digest_t *get() noexcept { return &d_; }
+	const digest_t *get() const noexcept { return &d_; }
+
+	context &username(const char *username) noexcept { d_.username = const_cast<char *>(username); return *this; }
+	context &password(const char *password) noexcept { d_.password = const_cast<char *>(password); return *this; }
+	context &uri(const char *uri) noexcept { d_.uri = const_cast<char *>(uri); return *this; }
+	context &method(digest::method method) noexcept { d_.method = static_cast<unsigned int>(method); return *this; }
+	context &nc(unsigned int nc) noexcept { d_.nc = nc; return *this; }
+
+	/*
+	 * Generate the Authorization header value into buffer. Returns a view
+	 * of it, empty on failure.
+	 */
+	template <std::size_t N>
+	std::string_view authorization(char (&buffer)[N]) noexcept
+	{
+		return result(buffer, digest_client_generate_header(&d_, buffer, N));
+	}
+
+	/* Same as authorization(), from a stored HA1 instead of the password */
+	template <std::size_t N>
+	std::string_view authorization(const char *ha1, char (&buffer)[N]) noexcept
+	{
+		return result(buffer, digest_client_generate_header_ha1(&d_, ha1, buffer, N));
+	}
+
+	/* Verify the response against the HA1 of the user, 32 hex characters */
+	bool verify(const char *ha1) noexcept
+	{
+		return 0 == digest_server_verify(&d_, ha1);
+	}
+
+private:
+	bool parse(std::string_view header)
+	{
+		/* "Digest " and at least one character */
+		if (header.size() < 8) {
+			return false;
+		}
+		header_.reset(new char[header.size() + 1]);
+		std::memcpy(header_.get(), header.data(), header.size());
+		header_[header.size()] = '\0';
+
+		return 0 == digest_is_digest(header_.get())
+		    && -1 != digest_server_parse_in_place(&d_, header_.get());
+	}
+
+	/* A generated nonce points into the context itself */
+	void adopt_nonce_buffer(const context &other) noexcept
+	{
+		if (other.d_.nonce == other.d_.nonce_buffer) {
+			d_.nonce = d_.nonce_buffer;
+		}
+	}
+
+	static std::string_view result(const char *buffer, std::size_t length) noexcept
+	{
+		return static_cast<std::size_t>(-1) != length ? std::string_view(buffer, length) : std::string_view();
+	}
+
+	digest_t d_;
+	std::unique_ptr<char[]> header_;
+};
+
+} /* namespace digest */
+
+#endif  /* INC_DIGEST_HPP */
@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "md5.h"
+#include "hash.h"
+#include "snapstate.h"
+#include "ha2cache.h"
+
+#define SET_WAYS	4
+#define N_SHARDS	64
+#define KEY_WORDS	(DIGEST_HA2_CACHE_KEY_MAX / 8)
+
+/*
+ * One entry. Readers load every field with acquire loads between two reads
+ * of seq, and retry as a miss if seq was odd or changed. Writers make seq
+ * odd, then store every field with release stores, so a reader that sees
+ * a new value also sees the odd seq and does not use it. Ordering the
+ * fields themselves, instead of fencing, is what ThreadSanitizer models;
+ * on x86 both compile to plain moves.
+ */
+typedef struct {
+	unsigned int seq;		/* Odd while being written */
+	unsigned int hash;
+	unsigned int key_len;		/* 0 if empty */
+	unsigned int referenced;	/* CLOCK bit */
+	unsigned long long ha2[2];
+	unsigned long long key[KEY_WORDS];
+} __attribute__((aligned(64))) ha2cache_entry_s;
+
+typedef struct {
+	ha2cache_entry_s *entries;
+	unsigned int set_mask;
+	pthread_mutex_t shards[N_SHARDS];
+} ha2cache_table_s;
+
+static ha2cache_table_s _cache;		/* HA2 of METHOD:URI */
+static ha2cache_table_s _midstate;	/* MD5 state after the first block */
+
+/**
+ * Looks up a key. On a hit, ha2 is filled with the cached value: the
+ * binary HA2, or an MD5 state in the midstate cache.
+ *
+ * Returns 0 on a hit, -1 on a miss.
+ */
+static int
+_cache_get(const ha2cache_entry_s *set, unsigned int hash, const unsigned long long *key, unsigned int key_len, unsigned long long *ha2)
+{
+	const ha2cache_entry_s *e;
+	unsigned int seq, i, w;
+	int match;
+
+	for (i = 0; i < SET_WAYS; ++i) {
+		e = &set[i];
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) || __atomic_load_n(&e->hash, __ATOMIC_ACQUIRE) != hash
+		    || __atomic_load_n(&e->key_len, __ATOMIC_ACQUIRE) != key_len) {
+			continue;
+		}
+
+		match = 1;
+		for (w = 0; w < KEY_WORDS && match; ++w) {
+			match = __atomic_load_n(&e->key[w], __ATOMIC_ACQUIRE) == key[w];
+		}
+		ha2[0] = __atomic_load_n(&e->ha2[0], __ATOMIC_ACQUIRE);
+		ha2[1] = __atomic_load_n(&e->ha2[1], __ATOMIC_ACQUIRE);
+
+		/* The acquire loads above keep this read after them */
+		if (match && seq == __atomic_load_n(&e->seq, __ATOMIC_RELAXED)) {
+			/* Only write the CLOCK bit when it changes, hits stay read-only */
+			if (0 == __atomic_load_n(&e->referenced, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&((ha2cache_entry_s *) e)->referenced, 1, __ATOMIC_RELAXED);
+			}
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Inserts a key into a set, replacing an entry chosen by CLOCK. The shard
+ * lock of the set must be held.
+ */
+static void
+_cache_put(ha2cache_entry_s *set, unsigned int hash, const unsigned long long *key, unsigned int key_len, const unsigned long long *ha2)
+{
+	ha2cache_entry_s *e = NULL;
+	unsigned int i, w, seq;
+
+	/* Another thread may have inserted it while we hashed */
+	for (i = 0; i < SET_WAYS; ++i) {
+		if (set[i].hash == hash && set[i].key_len == key_len && 0 == memcmp(set[i].key, key, sizeof (set[i].key))) {
+			return;
+		}
+	}
+
+	/* Give referenced entries a second chance */
+	for (i = 0; NULL == e; i = (i + 1) % SET_WAYS) {
+		if (0 == set[i].key_len || 0 == __atomic_exchange_n(&set[i].referenced, 0, __ATOMIC_RELAXED)) {
+			e = &set[i];
+		}
+	}
+
+	seq = e->seq;
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+
+	/* Each release store publishes the odd seq with it */
+	__atomic_store_n(&e->hash, hash, __ATOMIC_RELEASE);
+	__atomic_store_n(&e->key_len, key_len, __ATOMIC_RELEASE);
+	__atomic_store_n(&e->referenced, 0, __ATOMIC_RELAXED);
+	for (w = 0; w < KEY_WORDS; ++w) {
+		__atomic_store_n(&e->key[w], key[w], __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&e->ha2[0], ha2[0], __ATOMIC_RELEASE);
+	__atomic_store_n(&e->ha2[1], ha2[1], __ATOMIC_RELEASE);
+
+	__atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int
+_table_init(ha2cache_table_s *table, size_t max_bytes)
+{
+	size_t n_sets = 1;
+	int i;
+
+	if (NULL != table->entries || max_bytes < 4096) {
+		return -1;
+	}
+
+	while (n_sets * 2 * SET_WAYS * sizeof (ha2cache_entry_s) <= max_bytes) {
+		n_sets <<= 1;
+	}
+
+	if (NULL == (table->entries = aligned_alloc(64, n_sets * SET_WAYS * sizeof (ha2cache_entry_s)))) {
+		return -1;
+	}
+	memset(table->entries, 0, n_sets * SET_WAYS * sizeof (ha2cache_entry_s));
+	table->set_mask = n_sets - 1;
+
+	for (i = 0; i < N_SHARDS; ++i) {
+		pthread_mutex_init(&table->shards[i], NULL);
+	}
+
+	return 0;
+}
+
+static void
+_table_destroy(ha2cache_table_s *table)
+{
+	int i;
+
+	if (NULL == table->entries) {
+		return;
+	}
+
+	for (i = 0; i < N_SHARDS; ++i) {
+		pthread_mutex_destroy(&table->shards[i]);
+	}
+	free(table->entries);
+	memset(table, 0, sizeof (ha2cache_table_s));
+}
+
+/**
+ * Hashes a zero padded key a word at a time.
+ */
+static unsigned int
+_key_hash(const unsigned long long *key, unsigned int key_len)
+{
+	unsigned long long hash = key_len;
+	unsigned int w;
+
+	for (w = 0; w < (key_len + 7) / 8; ++w) {
+		hash = (hash ^ key[w]) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+
+	return hash ^ (hash >> 32);
+}
+
+/**
+ * Looks up a zero padded key in a table.
+ *
+ * Returns 0 and fills value on a hit, -1 on a miss.
+ */
+static int
+_table_get(ha2cache_table_s *table, const unsigned long long *key, unsigned int key_len, unsigned long long *value)
+{
+	unsigned int hash = _key_hash(key, key_len);
+
+	return _cache_get(&table->entries[(hash & table->set_mask) * SET_WAYS], hash, key, key_len, value);
+}
+
+static void
+_table_put(ha2cache_table_s *table, const unsigned long long *key, unsigned int key_len, const unsigned long long *value)
+{
+	unsigned int hash = _key_hash(key, key_len);
+	unsigned int set = hash & table->set_mask;
+
+	pthread_mutex_lock(&table->shards[set % N_SHARDS]);
+	_cache_put(&table->entries[set * SET_WAYS], hash, key, key_len, value);
+	pthread_mutex_unlock(&table->shards[set % N_SHARDS]);
+}
+
+int
+digest_ha2_cache_init(size_t max_bytes)
+{
+	return _table_init(&_cache, max_bytes);
+}
+
+void
+digest_ha2_cache_destroy(void)
+{
+	_table_destroy(&_cache);
+}
+
+int
+digest_midstate_cache_init(size_t max_bytes)
+{
+	return _table_init(&_midstate, max_bytes);
+}
+
+void
+digest_midstate_cache_destroy(void)
+{
+	_table_destroy(&_midstate);
+}
+
+static ha2cache_table_s *
+_table_of(int cache)
+{
+	ha2cache_table_s *table = HASH_CACHE_MIDSTATE == cache ? &_midstate : &_cache;
+
+	return NULL != table->entries ? table : NULL;
+}
+
+/**
+ * Calls fn for every entry of a cache, a shard at a time under its lock.
+ *
+ * Returns 0 on success, -1 if the cache is not enabled.
+ */
+int
+hash_cache_visit(int cache, hash_cache_visit_fn fn, void *arg)
+{
+	ha2cache_table_s *table;
+	ha2cache_entry_s *e;
+	unsigned int shard, set, i;
+
+	if (NULL == (table = _table_of(cache))) {
+		return -1;
+	}
+
+	for (shard = 0; shard < N_SHARDS; ++shard) {
+		pthread_mutex_lock(&table->shards[shard]);
+		for (set = shard; set <= table->set_mask; set += N_SHARDS) {
+			for (i = 0; i < SET_WAYS; ++i) {
+				e = &table->entries[set * SET_WAYS + i];
+				if (0 != e->key_len) {
+					fn(arg, e->key, e->key_len, (const unsigned char *) e->ha2);
+				}
+			}
+		}
+		pthread_mutex_unlock(&table->shards[shard]);
+	}
+
+	return 0;
+}
+
+static void
+_count_entry(void *arg, const void *key, unsigned int key_len, const unsigned char *value)
+{
+	++*(size_t *) arg;
+}
+
+size_t
+digest_ha2_cache_entries(void)
+{
+	size_t n = 0;
+
+	hash_cache_visit(HASH_CACHE_HA2, _count_entry, &n);
+	return n;
+}
+
+size_t
+digest_midstate_cache_entries(void)
+{
+	size_t n = 0;
+
+	hash_cache_visit(HASH_CACHE_MIDSTATE, _count_entry, &n);
+	return n;
+}
+
+/**
+ * Inserts an entry into a cache, like a miss would.
+ *
+ * Returns 0 on success, -1 if the cache is not enabled or the key is too
+ * long.
+ */
+int
+hash_cache_insert(int cache, const void *key, unsigned int key_len, const unsigned char *value)
+{
+	unsigned long long padded[KEY_WORDS], v[2];
+	ha2cache_table_s *table;
+
+	if (NULL == (table = _table_of(cache)) || 0 == key_len || key_len > DIGEST_HA2_CACHE_KEY_MAX) {
+		return -1;
+	}
+
+	memset(padded, 0, sizeof (padded));
+	memcpy(padded, key, key_len);
+	memcpy(v, value, sizeof (v));
+	_table_put(table, padded, key_len, v);
+
+	return 0;
+}
+
+/**
+ * Same as hash_generate_a2(), but consults the HA2 cache if it is enabled.
+ *
+ * result is the buffer where to store the generated md5 hash.
+ * Both method and uri should be null terminated strings.
+ */
+void
+hash_generate_a2_cached(char *result, const char *method, const char *uri)
+{
+	unsigned long long key[KEY_WORDS], ha2[2];
+	size_t method_len, uri_len;
+
+	method_len = strlen(method);
+	uri_len = strlen(uri);
+	if (NULL == _cache.entries || method_len + 1 + uri_len > DIGEST_HA2_CACHE_KEY_MAX) {
+		hash_generate_a2(result, method, uri);
+		return;
+	}
+
+	memset(key, 0, sizeof (key));
+	memcpy(key, method, method_len);
+	((char *) key)[method_len] = ':';
+	memcpy((char *) key + method_len + 1, uri, uri_len);
+
+	if (0 == _table_get(&_cache, key, method_len + 1 + uri_len, ha2)) {
+		hash_to_hex(result, (unsigned char *) ha2);
+		return;
+	}
+
+	MD5_Short((unsigned char *) ha2, key, method_len + 1 + uri_len);
+	hash_to_hex(result, (unsigned char *) ha2);
+
+	_table_put(&_cache, key, method_len + 1 + uri_len, ha2);
+}
+
+/**
+ * Starts an MD5 hash of data, like MD5_Init() and MD5_Update().
+ *
+ * fixed_length is how many leading bytes of data are the same across
+ * requests, like "ha1:nonce:" of a response. If the midstate cache is
+ * enabled and they fill the first block, the state after that block is
+ * looked up there instead of being computed.
+ */
+void
+hash_md5_start_cached(MD5_CTX *ctx, const char *data, size_t length, size_t fixed_length)
+{
+#ifndef HAVE_OPENSSL
+	unsigned long long key[KEY_WORDS], state[2];
+	MD5_u32plus *words = (MD5_u32plus *) state;
+
+	if (NULL != _midstate.entries && fixed_length >= 64 && length >= 64) {
+		memset(key, 0, sizeof (key));
+		memcpy(key, data, 64);
+
+		if (0 == _table_get(&_midstate, key, 64, state)) {
+			ctx->a = words[0];
+			ctx->b = words[1];
+			ctx->c = words[2];
+			ctx->d = words[3];
+			ctx->lo = 64;
+			ctx->hi = 0;
+		} else {
+			MD5_Init(ctx);
+			MD5_Update(ctx, data, 64);
+			words[0] = ctx->a;
+			words[1] = ctx->b;
+			words[2] = ctx->c;
+			words[3] = ctx->d;
+			_table_put(&_midstate, key, 64, state);
+		}
+
+		MD5_Update(ctx, data + 64, length - 64);
+		return;
+	}
+#endif
+
+	MD5_Init(ctx);
+	MD5_Update(ctx, data, length);
+}
@@ -0,0 +1,81 @@
+#ifndef INC_DIGEST_HA2CACHE_H
+#define INC_DIGEST_HA2CACHE_H
+#include <stddef.h>
+
+/*
+ * Cache of HA2 values.
+ *
+ * A few (method, URI) pairs, like health checks and polling endpoints,
+ * make up most requests. When the cache is enabled, client header
+ * generation and server verification look HA2 up here instead of hashing
+ * METHOD:URI every time.
+ *
+ * The midstate cache works the same way for the response hash. Clients
+ * reuse a nonce for many requests, and the response starts with
+ * "HA1:nonce:". With a nonce of 30 characters or more, the first 64 byte
+ * MD5 block is the same for all of them, so the MD5 state after it is
+ * cached, keyed by that block, and one compression is saved per request.
+ *
+ * Entries are two cache lines each and grouped in sets of four, with
+ * CLOCK replacement inside a set. Hits take no lock: entries are read
+ * under a sequence counter and only misses lock a shard of the sets.
+ * Pairs longer than DIGEST_HA2_CACHE_KEY_MAX are hashed directly.
+ */
+
+#define DIGEST_HA2_CACHE_KEY_MAX	96	/* Bytes of "METHOD:URI" */
+
+/**
+ * Enable the HA2 cache.
+ *
+ * Call before other threads use the library.
+ *
+ * @param size_t max_bytes Memory to use for entries, at least 4 KiB.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_ha2_cache_init(size_t max_bytes);
+
+/**
+ * Disable the HA2 cache and free it.
+ *
+ * Call when no other threads use the library.
+ */
+extern void digest_ha2_cache_destroy(void);
+
+/**
+ * Count the entries of the HA2 cache.
+ *
+ * Walks the whole cache, a shard at a time under its lock; meant for
+ * monitoring, not for the request path.
+ *
+ * @returns size_t The number of entries, 0 if the cache is not enabled.
+ */
+extern size_t digest_ha2_cache_entries(void);
+
+/**
+ * Enable the midstate cache for response hashes.
+ *
+ * Call before other threads use the library.
+ *
+ * @param size_t max_bytes Memory to use for entries, at least 4 KiB.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_midstate_cache_init(size_t max_bytes);
+
+/**
+ * Disable the midstate cache and free it.
+ *
+ * Call when no other threads use the library.
+ */
+extern void digest_midstate_cache_destroy(void);
+
+/**
+ * Count the entries of the midstate cache, like
+ * digest_ha2_cache_entries().
+ *
+ * @returns size_t The number of entries, 0 if the cache is not enabled.
+ */
+extern size_t digest_midstate_cache_entries(void);
+
+#endif  /* INC_DIGEST_HA2CACHE_H */
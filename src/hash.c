@@ -3,28 +3,25 @@
 #include <string.h>
 #include "md5.h"
 #include "hash.h"
+#include "trace.h"
+
+TRACE_SEMAPHORE(hash__start);
+TRACE_SEMAPHORE(hash__done);
 
 /**
  * Generates an MD5 hash from a string.
  *
- * string needs to be null terminated.
+ * length is the length of string, as returned by sprintf().
  * result is the buffer where to store the md5 hash. The length will always be
  * 32 characters long.
  */
 static void
-_get_md5(const char *string, char *result)
+_get_md5(const char *string, int length, char *result)
 {
-	int i = 0;
 	unsigned char digest[16];
 
-	MD5_CTX context;
-	MD5_Init(&context);
-	MD5_Update(&context, string, strlen(string));
-	MD5_Final(digest, &context);
-
-	for (i = 0; i < 16; ++i) {
-		sprintf(&result[i * 2], "%02x", (unsigned int) digest[i]);
-	}
+	MD5_Short(digest, string, length);
+	hash_to_hex(result, digest);
 }
 
 /**
@@ -37,8 +34,12 @@ void
 hash_generate_a2(char *result, const char *method, const char *uri)
 {
 	char raw[512];
-	sprintf(raw, "%s:%s", method, uri);
-	_get_md5(raw, result);
+	int n;
+
+	n = sprintf(raw, "%s:%s", method, uri);
+	TRACE2(hash__start, TRACE_HASH_A2, n);
+	_get_md5(raw, n, result);
+	TRACE1(hash__done, TRACE_HASH_A2);
 }
 
 /**
@@ -51,8 +52,31 @@ void
 hash_generate_a1(char *result, const char *username, const char *realm, const char *password)
 {
 	char raw[768];
-	sprintf(raw, "%s:%s:%s", username, realm, password);
-	_get_md5(raw, result);
+	int n;
+
+	n = sprintf(raw, "%s:%s:%s", username, realm, password);
+	TRACE2(hash__start, TRACE_HASH_A1, n);
+	_get_md5(raw, n, result);
+	TRACE1(hash__done, TRACE_HASH_A1);
+}
+
+/**
+ * Generates the userhash of rfc7616, which a client sends instead of the
+ * username.
+ *
+ * result is the buffer where to store the generated md5 hash.
+ * Both username and realm should be null terminated strings.
+ */
+void
+hash_generate_userhash(char *result, const char *username, const char *realm)
+{
+	char raw[768];
+	int n;
+
+	n = sprintf(raw, "%s:%s", username, realm);
+	TRACE2(hash__start, TRACE_HASH_USERHASH, n);
+	_get_md5(raw, n, result);
+	TRACE1(hash__done, TRACE_HASH_USERHASH);
 }
 
 /**
@@ -68,8 +92,62 @@ void
 hash_generate_response_auth(char *result, const char *ha1, const char *nonce, unsigned int nc, unsigned int cnonce, const char *qop, const char *ha2)
 {
 	char raw[512];
-	sprintf(raw, "%s:%s:%08x:%08x:%s:%s", ha1, nonce, nc, cnonce, qop, ha2);
-	_get_md5(raw, result);
+	int n;
+
+	n = sprintf(raw, "%s:%s:%08x:%08x:%s:%s", ha1, nonce, nc, cnonce, qop, ha2);
+	TRACE2(hash__start, TRACE_HASH_RESPONSE, n);
+	_get_md5(raw, n, result);
+	TRACE1(hash__done, TRACE_HASH_RESPONSE);
+}
+
+/**
+ * Starts a response hash, up to where HA2 goes.
+ *
+ * The prefix "ha1:nonce:nc:cnonce:qop:" is the same for the response and
+ * for rspauth in Authentication-Info, so one prefix state serves both. If
+ * qop is NULL, the prefix is "ha1:nonce:", as without qop.
+ *
+ * ctx is the MD5 state to initialize.
+ * All other arguments should be null terminated strings.
+ */
+void
+hash_response_prefix(MD5_CTX *ctx, const char *ha1, const char *nonce, unsigned int nc, const char *cnonce, const char *qop)
+{
+	char raw[640];
+	int n;
+
+	if (NULL == qop) {
+		n = snprintf(raw, sizeof (raw), "%s:%s:", ha1, nonce);
+	} else {
+		n = snprintf(raw, sizeof (raw), "%s:%s:%08x:%s:%s:", ha1, nonce, nc, cnonce, qop);
+	}
+	if (n >= (int) sizeof (raw)) {
+		n = sizeof (raw) - 1;
+	}
+
+	/* The response hash is split, hash__done fires in hash_response_finish() */
+	TRACE2(hash__start, TRACE_HASH_RESPONSE, n + 32);
+
+	/* "ha1:nonce:" is the same for every request with this nonce */
+	hash_md5_start_cached(ctx, raw, n, strlen(ha1) + strlen(nonce) + 2);
+}
+
+/**
+ * Finishes a response hash started with hash_response_prefix().
+ *
+ * The prefix state is not modified, so it can be finished again with
+ * another ha2.
+ *
+ * result is the buffer where to store the generated md5 hash.
+ */
+void
+hash_response_finish(char *result, const MD5_CTX *prefix, const char *ha2)
+{
+	unsigned char digest[16];
+
+	MD5_Tail(digest, prefix, ha2, strlen(ha2));
+	hash_to_hex(result, digest);
+	TRACE1(hash__done, TRACE_HASH_RESPONSE);
 }
 
 /**
@@ -85,6 +163,82 @@ void
 hash_generate_response(char *result, const char *ha1, const char *nonce, const char *ha2)
 {
 	char raw[512];
-	sprintf(raw, "%s:%s:%s", ha1, nonce, ha2);
-	_get_md5(raw, result);
+	int n;
+
+	n = sprintf(raw, "%s:%s:%s", ha1, nonce, ha2);
+	TRACE2(hash__start, TRACE_HASH_RESPONSE, n);
+	_get_md5(raw, n, result);
+	TRACE1(hash__done, TRACE_HASH_RESPONSE);
+}
+
+/**
+ * Encodes a 16 byte binary MD5 digest as lowercase hex.
+ *
+ * result is the buffer where to store the hex string, at least 33 bytes. It
+ * will be null terminated.
+ */
+void
+hash_to_hex(char *result, const unsigned char *digest)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < 16; ++i) {
+		result[i * 2] = hex[digest[i] >> 4];
+		result[i * 2 + 1] = hex[digest[i] & 0x0f];
+	}
+	result[32] = '\0';
+}
+
+/**
+ * Decodes a 32 character hex string to a 16 byte binary MD5 digest.
+ *
+ * Both upper and lower case hex digits are accepted.
+ *
+ * Returns 0 on success, -1 if hex is not 32 valid hex digits.
+ */
+int
+hash_from_hex(unsigned char *digest, const char *hex)
+{
+	int i, j, v;
+	char c;
+
+	for (i = 0; i < 16; ++i) {
+		v = 0;
+		for (j = 0; j < 2; ++j) {
+			c = hex[i * 2 + j];
+			v <<= 4;
+			if (c >= '0' && c <= '9') {
+				v |= c - '0';
+			} else if (c >= 'a' && c <= 'f') {
+				v |= c - 'a' + 10;
+			} else if (c >= 'A' && c <= 'F') {
+				v |= c - 'A' + 10;
+			} else {
+				return -1;
+			}
+		}
+		digest[i] = v;
+	}
+
+	return 0;
+}
+
+/**
+ * Continues a 32 bit FNV-1a hash over a buffer.
+ *
+ * Used for the lookup tables, not for anything security related. Start
+ * with HASH_FNV1A_INIT and chain calls to hash several fields.
+ */
+unsigned int
+hash_fnv1a(unsigned int hash, const void *data, size_t length)
+{
+	const unsigned char *p = (const unsigned char *) data;
+
+	while (length--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+
+	return hash;
 }
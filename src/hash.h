@@ -1,9 +1,22 @@
 #ifndef INC_DIGEST_HASH_H
 #define INC_DIGEST_HASH_H
+#include <stddef.h>
+#include "md5.h"
 
 void hash_generate_a2(char *result, const char *method, const char *uri);
+void hash_generate_a2_cached(char *result, const char *method, const char *uri);
 void hash_generate_a1(char *result, const char *username, const char *realm, const char *password);
+void hash_generate_userhash(char *result, const char *username, const char *realm);
 void hash_generate_response_auth(char *result, const char *ha1, const char *nonce, unsigned int nc, unsigned int cnonce, const char *qop, const char *ha2);
+void hash_md5_start_cached(MD5_CTX *ctx, const char *data, size_t length, size_t fixed_length);
+void hash_response_prefix(MD5_CTX *ctx, const char *ha1, const char *nonce, unsigned int nc, const char *cnonce, const char *qop);
+void hash_response_finish(char *result, const MD5_CTX *prefix, const char *ha2);
 void hash_generate_response(char *result, const char *ha1, const char *nonce, const char *ha2);
 
+void hash_to_hex(char *result, const unsigned char *digest);
+int hash_from_hex(unsigned char *digest, const char *hex);
+unsigned int hash_fnv1a(unsigned int hash, const void *data, size_t length);
+
+#define HASH_FNV1A_INIT 2166136261U
+
 #endif  /* INC_DIGEST_HASH_H */
@@ -197,6 +197,26 @@ static const void *body(MD5_CTX *ctx, const void *data, unsigned long size)
   return ptr;
 }
 
+static void output(unsigned char *result, const MD5_CTX *ctx)
+{
+  result[0] = ctx->a;
+  result[1] = ctx->a >> 8;
+  result[2] = ctx->a >> 16;
+  result[3] = ctx->a >> 24;
+  result[4] = ctx->b;
+  result[5] = ctx->b >> 8;
+  result[6] = ctx->b >> 16;
+  result[7] = ctx->b >> 24;
+  result[8] = ctx->c;
+  result[9] = ctx->c >> 8;
+  result[10] = ctx->c >> 16;
+  result[11] = ctx->c >> 24;
+  result[12] = ctx->d;
+  result[13] = ctx->d >> 8;
+  result[14] = ctx->d >> 16;
+  result[15] = ctx->d >> 24;
+}
+
 void MD5_Init(MD5_CTX *ctx)
 {
   ctx->a = 0x67452301;
@@ -273,24 +293,85 @@ void MD5_Final(unsigned char *result, MD5_CTX *ctx)
 
   body(ctx, ctx->buffer, 64);
 
-  result[0] = ctx->a;
-  result[1] = ctx->a >> 8;
-  result[2] = ctx->a >> 16;
-  result[3] = ctx->a >> 24;
-  result[4] = ctx->b;
-  result[5] = ctx->b >> 8;
-  result[6] = ctx->b >> 16;
-  result[7] = ctx->b >> 24;
-  result[8] = ctx->c;
-  result[9] = ctx->c >> 8;
-  result[10] = ctx->c >> 16;
-  result[11] = ctx->c >> 24;
-  result[12] = ctx->d;
-  result[13] = ctx->d >> 8;
-  result[14] = ctx->d >> 16;
-  result[15] = ctx->d >> 24;
+  output(result, ctx);
 
   memset(ctx, 0, sizeof(*ctx));
 }
 
+/*
+ * Pads a message that fits in four blocks and hashes it.  The
+ * message is copied once into a block on the stack, so nothing goes
+ * through ctx->buffer.  The bit count is that of the whole message,
+ * prefix_size bytes of which were hashed into ctx before.
+ */
+static void short_body(unsigned char *result, MD5_CTX *ctx,
+    const unsigned char *prefix, unsigned long prefix_size,
+    const void *data, unsigned long size)
+{
+  union {
+    unsigned char bytes[MD5_SHORT_MAX + 9];
+    MD5_u32plus words[(MD5_SHORT_MAX + 9) / 4];
+  } block;
+  unsigned long used, blocks;
+
+  used = prefix_size + size;
+  blocks = (used + 9 + 63) & ~(unsigned long)0x3f;
+
+  if (prefix_size)
+    memcpy(block.bytes, prefix, prefix_size);
+  memcpy(&block.bytes[prefix_size], data, size);
+  block.bytes[used++] = 0x80;
+  memset(&block.bytes[used], 0, blocks - 8 - used);
+
+  ctx->lo <<= 3;
+  block.bytes[blocks - 8] = ctx->lo;
+  block.bytes[blocks - 7] = ctx->lo >> 8;
+  block.bytes[blocks - 6] = ctx->lo >> 16;
+  block.bytes[blocks - 5] = ctx->lo >> 24;
+  block.bytes[blocks - 4] = ctx->hi;
+  block.bytes[blocks - 3] = ctx->hi >> 8;
+  block.bytes[blocks - 2] = ctx->hi >> 16;
+  block.bytes[blocks - 1] = ctx->hi >> 24;
+
+  body(ctx, block.bytes, blocks);
+  output(result, ctx);
+}
+
+void MD5_Short(unsigned char *result, const void *data, unsigned long size)
+{
+  MD5_CTX ctx;
+
+  MD5_Init(&ctx);
+  if (size > MD5_SHORT_MAX) {
+    MD5_Update(&ctx, data, size);
+    MD5_Final(result, &ctx);
+    return;
+  }
+
+  ctx.lo = size;
+  short_body(result, &ctx, NULL, 0, data, size);
+}
+
+void MD5_Tail(unsigned char *result, const MD5_CTX *prefix,
+    const void *data, unsigned long size)
+{
+  MD5_CTX ctx;
+
+  if ((prefix->lo & 0x3f) + size > MD5_SHORT_MAX) {
+    ctx = *prefix;
+    MD5_Update(&ctx, data, size);
+    MD5_Final(result, &ctx);
+    return;
+  }
+
+  ctx.a = prefix->a;
+  ctx.b = prefix->b;
+  ctx.c = prefix->c;
+  ctx.d = prefix->d;
+  ctx.lo = (prefix->lo + size) & 0x1fffffff;
+  ctx.hi = prefix->hi + (ctx.lo < prefix->lo);
+
+  short_body(result, &ctx, prefix->buffer, prefix->lo & 0x3f, data, size);
+}
+
 #endif
@@ -25,6 +25,19 @@
 
 #ifdef HAVE_OPENSSL
 #include <openssl/md5.h>
+
+#define MD5_SHORT_MAX 247
+#define MD5_Short(result, data, size) \
+  MD5((const unsigned char *)(data), (size), (result))
+
+static inline void MD5_Tail(unsigned char *result, const MD5_CTX *prefix,
+    const void *data, unsigned long size)
+{
+  MD5_CTX ctx = *prefix;
+
+  MD5_Update(&ctx, data, size);
+  MD5_Final(result, &ctx);
+}
 #elif !defined(_MD5_H)
 #define _MD5_H
 
@@ -42,4 +55,17 @@ extern void MD5_Init(MD5_CTX *ctx);
 extern void MD5_Update(MD5_CTX *ctx, const void *data, unsigned long size);
 extern void MD5_Final(unsigned char *result, MD5_CTX *ctx);
 
+/*
+ * One-call MD5.  Messages of up to MD5_SHORT_MAX bytes, which fit in four
+ * blocks with their padding like all usual digest authentication hashes,
+ * skip the streaming state of MD5_Update and MD5_Final.  MD5_Tail finishes
+ * a hash started with MD5_Update the same way, if the buffered and new
+ * bytes together are that short.  The prefix state is not modified.
+ */
+#define MD5_SHORT_MAX 247
+
+extern void MD5_Short(unsigned char *result, const void *data, unsigned long size);
+extern void MD5_Tail(unsigned char *result, const MD5_CTX *prefix,
+    const void *data, unsigned long size);
+
 #endif
@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/random.h>
+#include "md5.h"
+#include "hash.h"
+#include "snapstate.h"
+#include "nonce.h"
+
+#define NONCE_SECRET_MAX	64
+#define NONCE_TIME_LENGTH	8
+#define NONCE_RANDOM_BYTES	6
+#define NONCE_MAC_BYTES		6
+#define NONCE_MAC_OFFSET	(NONCE_TIME_LENGTH + NONCE_RANDOM_BYTES * 2)
+
+/* Ready nonces older than this are replaced, in seconds */
+#define NONCE_REFRESH		1
+
+/* A ring slot; seq tells whose turn it is, like in a Vyukov queue */
+typedef struct {
+	unsigned long seq;
+	time_t issued;
+	char nonce[DIGEST_NONCE_LENGTH];
+} nonce_slot_s;
+
+/* One producer thread fills a ring, any thread takes from it */
+typedef struct {
+	unsigned long head;		/* Next slot to take */
+	char pad[56];
+	unsigned long tail;		/* Next slot to fill, producer only */
+	nonce_slot_s *slots;
+	pthread_t thread;
+} __attribute__((aligned(64))) nonce_ring_s;
+
+static struct {
+	int started;
+	int stopping;
+	unsigned long mask;		/* Ring depth - 1 */
+	int n_rings;
+	nonce_ring_s *rings;
+	unsigned int next_ring;		/* Hands out start rings to threads */
+	unsigned long fallbacks;
+} _supply;
+
+/* The secret outlives the supply, so issued nonces stay valid */
+static unsigned char _secret[NONCE_SECRET_MAX];
+static size_t _secret_length;
+static int _has_secret = 0;
+static pthread_once_t _secret_once = PTHREAD_ONCE_INIT;
+static __thread unsigned int _ring_hint;
+
+static void
+_random_secret(void)
+{
+	/* Keep a secret restored from a snapshot */
+	if (_has_secret) {
+		return;
+	}
+	if (sizeof (_secret) == getrandom(_secret, sizeof (_secret), 0)) {
+		_secret_length = sizeof (_secret);
+		_has_secret = 1;
+	}
+}
+
+static void
+_mac(unsigned char *mac, const char *nonce)
+{
+	unsigned char buffer[NONCE_SECRET_MAX + NONCE_MAC_OFFSET], digest[16];
+
+	memcpy(buffer, _secret, _secret_length);
+	memcpy(buffer + _secret_length, nonce, NONCE_MAC_OFFSET);
+	MD5_Short(digest, buffer, _secret_length + NONCE_MAC_OFFSET);
+	memcpy(mac, digest, NONCE_MAC_BYTES);
+}
+
+static void
+_bytes_to_hex(char *result, const unsigned char *bytes, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < length; ++i) {
+		result[i * 2] = hex[bytes[i] >> 4];
+		result[i * 2 + 1] = hex[bytes[i] & 0xf];
+	}
+}
+
+/**
+ * Builds a nonce from the time and NONCE_RANDOM_BYTES random bytes.
+ * The result is not null terminated.
+ */
+static void
+_build(char *nonce, time_t now, const unsigned char *random)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned long t = (unsigned long) now;
+	unsigned char mac[NONCE_MAC_BYTES];
+	int i;
+
+	for (i = NONCE_TIME_LENGTH - 1; i >= 0; --i) {
+		nonce[i] = hex[t & 0xf];
+		t >>= 4;
+	}
+	_bytes_to_hex(nonce + NONCE_TIME_LENGTH, random, NONCE_RANDOM_BYTES);
+	_mac(mac, nonce);
+	_bytes_to_hex(nonce + NONCE_MAC_OFFSET, mac, NONCE_MAC_BYTES);
+}
+
+/**
+ * Takes the nonce at the head of a ring, if it is ready. With max_issued,
+ * only a nonce issued at or before it is taken.
+ *
+ * Returns 0 on success, -1 if there is none.
+ */
+static int
+_ring_take(nonce_ring_s *r, char *nonce, time_t max_issued)
+{
+	unsigned long pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED), seq;
+	nonce_slot_s *slot;
+
+	for (;;) {
+		slot = &r->slots[pos & _supply.mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq != pos + 1) {
+			if ((long) (seq - (pos + 1)) < 0) {
+				/* Empty */
+				return -1;
+			}
+			/* Another thread took it, try the new head */
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (0 != max_issued && slot->issued > max_issued) {
+			return -1;
+		}
+		if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	if (NULL != nonce) {
+		memcpy(nonce, slot->nonce, DIGEST_NONCE_LENGTH);
+	}
+	/* Hand the slot back to the producer */
+	__atomic_store_n(&slot->seq, pos + _supply.mask + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void *
+_producer(void *arg)
+{
+	nonce_ring_s *r = (nonce_ring_s *) arg;
+	unsigned char random[4096];
+	size_t used = sizeof (random);
+	struct timespec pause = { 0, 1000000 };
+	nonce_slot_s *slot;
+	time_t now;
+
+	while (!__atomic_load_n(&_supply.stopping, __ATOMIC_RELAXED)) {
+		now = time(NULL);
+		slot = &r->slots[r->tail & _supply.mask];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != r->tail) {
+			/* Full, drop a nonce that is getting old or wait */
+			if (-1 == _ring_take(r, NULL, now - NONCE_REFRESH)) {
+				nanosleep(&pause, NULL);
+			}
+			continue;
+		}
+
+		if (used + NONCE_RANDOM_BYTES > sizeof (random)) {
+			if (sizeof (random) != getrandom(random, sizeof (random), 0)) {
+				nanosleep(&pause, NULL);
+				continue;
+			}
+			used = 0;
+		}
+		_build(slot->nonce, now, random + used);
+		used += NONCE_RANDOM_BYTES;
+		slot->issued = now;
+		__atomic_store_n(&slot->seq, r->tail + 1, __ATOMIC_RELEASE);
+		r->tail++;
+	}
+
+	return NULL;
+}
+
+int
+digest_nonce_start(unsigned int depth, int n_threads, const void *secret, size_t secret_length)
+{
+	unsigned long size = 1, i;
+	int n;
+
+	if (_supply.started || secret_length > NONCE_SECRET_MAX || 0 > n_threads) {
+		return -1;
+	}
+
+	memset(&_supply, 0, sizeof (_supply));
+	if (NULL != secret && 0 != secret_length) {
+		memcpy(_secret, secret, secret_length);
+		_secret_length = secret_length;
+		_has_secret = 1;
+	} else {
+		pthread_once(&_secret_once, _random_secret);
+		if (!_has_secret) {
+			return -1;
+		}
+	}
+
+	while (size < depth) {
+		size <<= 1;
+	}
+	_supply.mask = size - 1;
+
+	if (0 < n_threads) {
+		if (NULL == (_supply.rings = aligned_alloc(64, n_threads * sizeof (nonce_ring_s)))) {
+			return -1;
+		}
+		memset(_supply.rings, 0, n_threads * sizeof (nonce_ring_s));
+		for (n = 0; n < n_threads; ++n) {
+			if (NULL == (_supply.rings[n].slots = malloc(size * sizeof (nonce_slot_s)))) {
+				goto fail;
+			}
+			for (i = 0; i < size; ++i) {
+				_supply.rings[n].slots[i].seq = i;
+			}
+		}
+		for (n = 0; n < n_threads; ++n) {
+			if (0 != pthread_create(&_supply.rings[n].thread, NULL, _producer, &_supply.rings[n])) {
+				/* All or nothing: stop the threads that did start */
+				__atomic_store_n(&_supply.stopping, 1, __ATOMIC_RELAXED);
+				while (0 < n--) {
+					pthread_join(_supply.rings[n].thread, NULL);
+				}
+				goto fail;
+			}
+		}
+		_supply.n_rings = n_threads;
+	}
+
+	_supply.started = 1;
+	return 0;
+
+fail:
+	for (n = 0; n < n_threads; ++n) {
+		free(_supply.rings[n].slots);
+	}
+	free(_supply.rings);
+	memset(&_supply, 0, sizeof (_supply));
+	return -1;
+}
+
+int
+digest_nonce_generate(char *nonce)
+{
+	unsigned char random[NONCE_RANDOM_BYTES];
+	int i;
+
+	if (0 < _supply.n_rings) {
+		if (0 == _ring_hint) {
+			_ring_hint = __atomic_add_fetch(&_supply.next_ring, 1, __ATOMIC_RELAXED);
+		}
+		for (i = 0; i < _supply.n_rings; ++i) {
+			if (0 == _ring_take(&_supply.rings[(_ring_hint + i) % _supply.n_rings], nonce, 0)) {
+				nonce[DIGEST_NONCE_LENGTH] = '\0';
+				return 0;
+			}
+		}
+		__atomic_fetch_add(&_supply.fallbacks, 1, __ATOMIC_RELAXED);
+	}
+
+	/* Generate inline */
+	if (!_supply.started) {
+		pthread_once(&_secret_once, _random_secret);
+	}
+	if (!_has_secret || sizeof (random) != getrandom(random, sizeof (random), 0)) {
+		return -1;
+	}
+	_build(nonce, time(NULL), random);
+	nonce[DIGEST_NONCE_LENGTH] = '\0';
+	return 0;
+}
+
+int
+digest_nonce_check(const char *nonce, unsigned int max_age)
+{
+	unsigned char mac[NONCE_MAC_BYTES];
+	char expected[NONCE_MAC_BYTES * 2];
+	unsigned long issued = 0;
+	unsigned char diff = 0;
+	time_t now;
+	int i, c;
+
+	if (!_has_secret || NULL == nonce) {
+		return DIGEST_NONCE_INVALID;
+	}
+	for (i = 0; i < DIGEST_NONCE_LENGTH; ++i) {
+		c = nonce[i];
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+			return DIGEST_NONCE_INVALID;
+		}
+		if (i < NONCE_TIME_LENGTH) {
+			issued = (issued << 4) | (c <= '9' ? c - '0' : c - 'a' + 10);
+		}
+	}
+	if ('\0' != nonce[DIGEST_NONCE_LENGTH]) {
+		return DIGEST_NONCE_INVALID;
+	}
+
+	_mac(mac, nonce);
+	_bytes_to_hex(expected, mac, NONCE_MAC_BYTES);
+	for (i = 0; i < NONCE_MAC_BYTES * 2; ++i) {
+		diff |= expected[i] ^ nonce[NONCE_MAC_OFFSET + i];
+	}
+	if (0 != diff) {
+		return DIGEST_NONCE_INVALID;
+	}
+
+	/* Allow a little clock skew between servers sharing the secret */
+	now = time(NULL);
+	if (issued > (unsigned long) now + 60) {
+		return DIGEST_NONCE_INVALID;
+	}
+	if (0 != max_age && issued + max_age < (unsigned long) now) {
+		return DIGEST_NONCE_STALE;
+	}
+
+	return DIGEST_NONCE_VALID;
+}
+
+/**
+ * Copies the secret out, for snapshots.
+ *
+ * Returns its length, 0 if there is none yet.
+ */
+size_t
+nonce_get_secret(unsigned char *secret, size_t max_length)
+{
+	if (!_has_secret || _secret_length > max_length) {
+		return 0;
+	}
+
+	memcpy(secret, _secret, _secret_length);
+	return _secret_length;
+}
+
+/**
+ * Sets the secret, so nonces issued before a restart stay valid.
+ *
+ * Returns 0 on success, otherwise -1.
+ */
+int
+nonce_set_secret(const unsigned char *secret, size_t length)
+{
+	if (0 == length || length > NONCE_SECRET_MAX) {
+		return -1;
+	}
+
+	memcpy(_secret, secret, length);
+	_secret_length = length;
+	_has_secret = 1;
+	return 0;
+}
+
+unsigned long
+digest_nonce_fallbacks(void)
+{
+	return __atomic_load_n(&_supply.fallbacks, __ATOMIC_RELAXED);
+}
+
+void
+digest_nonce_stop(void)
+{
+	int n;
+
+	if (!_supply.started) {
+		return;
+	}
+
+	__atomic_store_n(&_supply.stopping, 1, __ATOMIC_RELAXED);
+	for (n = 0; n < _supply.n_rings; ++n) {
+		pthread_join(_supply.rings[n].thread, NULL);
+		free(_supply.rings[n].slots);
+	}
+	free(_supply.rings);
+	_supply.rings = NULL;
+	_supply.n_rings = 0;
+	_supply.stopping = 0;
+	_supply.started = 0;
+}
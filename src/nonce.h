@@ -0,0 +1,80 @@
+#ifndef INC_DIGEST_NONCE_H
+#define INC_DIGEST_NONCE_H
+#include <stddef.h>
+
+/*
+ * Server nonces.
+ *
+ * A nonce is 32 lowercase hex characters: the time it was issued, 48
+ * random bits and a 48 bit MAC of both under a server secret. The server
+ * can check a nonce it issued, and how old it is, without keeping state.
+ *
+ * Generating one needs random bytes and a hash, on the 401 path that gets
+ * busiest under attack. With the nonce supply started, background threads
+ * generate nonces ahead of time into rings, and taking one is a few atomic
+ * operations. If the rings run dry, nonces are generated inline.
+ */
+
+#define DIGEST_NONCE_LENGTH	32
+
+/* Results of digest_nonce_check() */
+#define DIGEST_NONCE_VALID	0
+#define DIGEST_NONCE_INVALID	-1
+#define DIGEST_NONCE_STALE	1
+
+/**
+ * Start the nonce supply.
+ *
+ * Call before other threads use the library.
+ *
+ * @param unsigned int depth Nonces kept ready per thread, rounded up to a
+ *        power of two.
+ * @param int n_threads Number of generating threads, 0 for none.
+ * @param const void *secret The MAC key, NULL for the one restored from a
+ *        snapshot or else a random one. Servers that share nonces must
+ *        share the secret.
+ * @param size_t secret_length The length of secret, at most 64 bytes.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_nonce_start(unsigned int depth, int n_threads, const void *secret, size_t secret_length);
+
+/**
+ * Get a new nonce.
+ *
+ * Takes a ready nonce if there is one, otherwise generates it inline.
+ *
+ * @param char *nonce The buffer to store the nonce in,
+ *        DIGEST_NONCE_LENGTH + 1 bytes.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_nonce_generate(char *nonce);
+
+/**
+ * Check a nonce.
+ *
+ * @param const char *nonce The nonce, like one parsed from an
+ *        Authorization header.
+ * @param unsigned int max_age Seconds a nonce is fresh, 0 for no limit.
+ *
+ * @returns int DIGEST_NONCE_VALID, DIGEST_NONCE_STALE if it was issued
+ *          here but is older than max_age, otherwise DIGEST_NONCE_INVALID.
+ */
+extern int digest_nonce_check(const char *nonce, unsigned int max_age);
+
+/**
+ * Get the number of nonces generated inline because the rings were empty.
+ *
+ * @returns unsigned long The number of inline nonces.
+ */
+extern unsigned long digest_nonce_fallbacks(void);
+
+/**
+ * Stop the nonce supply and free it.
+ *
+ * Call when no other threads use the library.
+ */
+extern void digest_nonce_stop(void);
+
+#endif  /* INC_DIGEST_NONCE_H */
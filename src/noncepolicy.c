@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "noncepolicy.h"
+
+/* Tracker use, in percent of the budget, that counts as memory pressure */
+#define NONCE_POLICY_PRESSURE	90
+
+/**
+ * Halves a value, down to min.
+ */
+static unsigned int
+_shorten(unsigned int value, unsigned int min)
+{
+	return value / 2 > min ? value / 2 : min;
+}
+
+/**
+ * Doubles a value, up to max.
+ */
+static unsigned int
+_extend(unsigned int value, unsigned int max)
+{
+	return value < max / 2 ? value * 2 : max;
+}
+
+/**
+ * Moves a value halfway back to base, rounding toward base so it gets
+ * there.
+ */
+static unsigned int
+_relax(unsigned int value, unsigned int base)
+{
+	if (value > base) {
+		return value - (value - base + 1) / 2;
+	}
+	return value + (base - value + 1) / 2;
+}
+
+int
+digest_nonce_policy_init(digest_nonce_policy_t *policy, const digest_nonce_policy_config_t *config)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+	const digest_nonce_policy_config_s *c = (const digest_nonce_policy_config_s *) config;
+
+	if (0 == c->min_lifetime || c->min_lifetime > c->lifetime || c->lifetime > c->max_lifetime) {
+		return -1;
+	}
+	if (0 != c->nc_limit && (0 == c->min_nc_limit || c->min_nc_limit > c->nc_limit || c->nc_limit > c->max_nc_limit)) {
+		return -1;
+	}
+
+	memset(p, 0, sizeof (digest_nonce_policy_s));
+	p->config = *c;
+	if (0 == p->config.interval) {
+		p->config.interval = 1;
+	}
+	p->lifetime = c->lifetime;
+	p->nc_limit = c->nc_limit;
+	p->decision = DIGEST_NONCE_POLICY_BASE;
+	p->last_update = time(NULL);
+	p->next_update = p->last_update + p->config.interval;
+
+	return 0;
+}
+
+void
+digest_nonce_policy_update(digest_nonce_policy_t *policy, time_t now)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+	const digest_nonce_policy_config_s *c = &p->config;
+	unsigned long requests, previous;
+	unsigned int lifetime, nc_limit, load = 0, pressure = 0;
+	time_t next, last, elapsed;
+	int decision;
+
+	/* One thread takes the decision of an interval */
+	next = __atomic_load_n(&p->next_update, __ATOMIC_ACQUIRE);
+	if (now < next || !__atomic_compare_exchange_n(&p->next_update, &next, now + c->interval, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	requests = __atomic_load_n(&p->requests, __ATOMIC_RELAXED);
+	previous = __atomic_exchange_n(&p->requests_at_update, requests, __ATOMIC_RELAXED);
+	last = __atomic_exchange_n(&p->last_update, now, __ATOMIC_RELAXED);
+	elapsed = now > last ? now - last : 1;
+
+	if (0 != c->capacity) {
+		load = (requests - previous) * 100 / ((unsigned long) elapsed * c->capacity);
+	}
+	if (0 != c->tracker_budget) {
+		pressure = __atomic_load_n(&p->tracker_bytes, __ATOMIC_RELAXED) * 100 / c->tracker_budget;
+	}
+
+	lifetime = __atomic_load_n(&p->lifetime, __ATOMIC_RELAXED);
+	nc_limit = __atomic_load_n(&p->nc_limit, __ATOMIC_RELAXED);
+	if (0 != c->tracker_budget && pressure >= NONCE_POLICY_PRESSURE) {
+		/* Tracked nonces expire sooner */
+		decision = DIGEST_NONCE_POLICY_SHORTEN;
+		lifetime = _shorten(lifetime, c->min_lifetime);
+		if (0 != nc_limit) {
+			nc_limit = _shorten(nc_limit, c->min_nc_limit);
+		}
+		__atomic_fetch_add(&p->shortened, 1, __ATOMIC_RELAXED);
+	} else if (0 != c->capacity && load >= 100) {
+		/* Fewer clients have to come back for a new nonce */
+		decision = DIGEST_NONCE_POLICY_EXTEND;
+		lifetime = _extend(lifetime, c->max_lifetime);
+		if (0 != nc_limit) {
+			nc_limit = _extend(nc_limit, c->max_nc_limit);
+		}
+		__atomic_fetch_add(&p->extended, 1, __ATOMIC_RELAXED);
+	} else {
+		decision = DIGEST_NONCE_POLICY_BASE;
+		lifetime = _relax(lifetime, c->lifetime);
+		nc_limit = _relax(nc_limit, c->nc_limit);
+		__atomic_fetch_add(&p->relaxed, 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&p->load, load, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->pressure, pressure, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->decision, decision, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->lifetime, lifetime, __ATOMIC_RELAXED);
+	__atomic_store_n(&p->nc_limit, nc_limit, __ATOMIC_RELAXED);
+}
+
+int
+digest_nonce_policy_check(digest_nonce_policy_t *policy, const char *nonce, unsigned int nc)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+	unsigned int nc_limit;
+	int state;
+
+	__atomic_fetch_add(&p->requests, 1, __ATOMIC_RELAXED);
+	digest_nonce_policy_update(policy, time(NULL));
+
+	state = digest_nonce_check(nonce, __atomic_load_n(&p->lifetime, __ATOMIC_RELAXED));
+	if (DIGEST_NONCE_STALE == state) {
+		__atomic_fetch_add(&p->stale_lifetime, 1, __ATOMIC_RELAXED);
+		return DIGEST_NONCE_STALE;
+	}
+	if (DIGEST_NONCE_VALID != state) {
+		return state;
+	}
+
+	nc_limit = __atomic_load_n(&p->nc_limit, __ATOMIC_RELAXED);
+	if (0 != nc_limit && nc > nc_limit) {
+		__atomic_fetch_add(&p->stale_nc, 1, __ATOMIC_RELAXED);
+		return DIGEST_NONCE_STALE;
+	}
+
+	return DIGEST_NONCE_VALID;
+}
+
+void
+digest_nonce_policy_challenged(digest_nonce_policy_t *policy)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+
+	__atomic_fetch_add(&p->challenges, 1, __ATOMIC_RELAXED);
+}
+
+void
+digest_nonce_policy_set_tracker(digest_nonce_policy_t *policy, size_t bytes)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+
+	__atomic_store_n(&p->tracker_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+unsigned int
+digest_nonce_policy_lifetime(digest_nonce_policy_t *policy)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+
+	return __atomic_load_n(&p->lifetime, __ATOMIC_RELAXED);
+}
+
+unsigned int
+digest_nonce_policy_nc_limit(digest_nonce_policy_t *policy)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+
+	return __atomic_load_n(&p->nc_limit, __ATOMIC_RELAXED);
+}
+
+void
+digest_nonce_policy_metrics(digest_nonce_policy_t *policy, digest_nonce_policy_metrics_t *metrics)
+{
+	digest_nonce_policy_s *p = (digest_nonce_policy_s *) policy;
+
+	metrics->lifetime = __atomic_load_n(&p->lifetime, __ATOMIC_RELAXED);
+	metrics->nc_limit = __atomic_load_n(&p->nc_limit, __ATOMIC_RELAXED);
+	metrics->decision = __atomic_load_n(&p->decision, __ATOMIC_RELAXED);
+	metrics->load = __atomic_load_n(&p->load, __ATOMIC_RELAXED);
+	metrics->pressure = __atomic_load_n(&p->pressure, __ATOMIC_RELAXED);
+	metrics->requests = __atomic_load_n(&p->requests, __ATOMIC_RELAXED);
+	metrics->challenges = __atomic_load_n(&p->challenges, __ATOMIC_RELAXED);
+	metrics->stale_lifetime = __atomic_load_n(&p->stale_lifetime, __ATOMIC_RELAXED);
+	metrics->stale_nc = __atomic_load_n(&p->stale_nc, __ATOMIC_RELAXED);
+	metrics->extended = __atomic_load_n(&p->extended, __ATOMIC_RELAXED);
+	metrics->shortened = __atomic_load_n(&p->shortened, __ATOMIC_RELAXED);
+	metrics->relaxed = __atomic_load_n(&p->relaxed, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,170 @@
+#ifndef INC_DIGEST_NONCEPOLICY_H
+#define INC_DIGEST_NONCEPOLICY_H
+#include <stddef.h>
+#include <time.h>
+#include "nonce.h"
+
+/*
+ * Adaptive nonce lifetime and reuse.
+ *
+ * Short nonce lifetimes cost clients an extra 401 round trip each time a
+ * nonce runs out; long ones make replay tracking keep more state. A nonce
+ * policy sets the lifetime and the highest nonce count a nonce is good for
+ * from what the server sees, once per interval:
+ *
+ *  - Under memory pressure, when the replay tracker of the server uses
+ *    90% or more of its budget, both are halved down to their minimum, so
+ *    tracked nonces expire sooner.
+ *  - Under overload, when requests per second reach the capacity of the
+ *    server, both are doubled up to their maximum, so fewer requests are
+ *    challenged again.
+ *  - Otherwise both move halfway back to their base.
+ *
+ * Memory pressure wins over overload. Nonces stay stateless; the nonce
+ * count limit only uses the nc the client sends, which grows with every
+ * request on a nonce. Checks are thread safe; one thread takes each
+ * decision.
+ */
+
+/* Decisions of a nonce policy */
+#define DIGEST_NONCE_POLICY_BASE	0
+#define DIGEST_NONCE_POLICY_EXTEND	1 /* Under overload */
+#define DIGEST_NONCE_POLICY_SHORTEN	2 /* Under memory pressure */
+
+typedef struct {
+	unsigned int lifetime;		/* Seconds, the base */
+	unsigned int min_lifetime;	/* The shortest, under memory pressure */
+	unsigned int max_lifetime;	/* The longest, under overload */
+	unsigned int nc_limit;		/* Requests per nonce, the base; 0 for no limit */
+	unsigned int min_nc_limit;
+	unsigned int max_nc_limit;
+	unsigned int capacity;		/* Requests per second at overload, 0 to ignore load */
+	size_t tracker_budget;		/* Bytes of replay tracking state, 0 to ignore */
+	unsigned int interval;		/* Seconds between decisions, 0 for 1 */
+} digest_nonce_policy_config_s;
+
+typedef digest_nonce_policy_config_s digest_nonce_policy_config_t;
+
+typedef struct {
+	digest_nonce_policy_config_s config;
+	unsigned int lifetime;
+	unsigned int nc_limit;
+	int decision;			/* DIGEST_NONCE_POLICY_* */
+	unsigned int load;		/* Percent of capacity */
+	unsigned int pressure;		/* Percent of the tracker budget */
+	time_t last_update;
+	time_t next_update;
+	unsigned long requests_at_update;
+	size_t tracker_bytes;
+
+	/* Counters, updated by all threads */
+	unsigned long requests __attribute__((aligned(64)));
+	unsigned long challenges;
+	unsigned long stale_lifetime;
+	unsigned long stale_nc;
+
+	/* Decisions taken */
+	unsigned long extended;
+	unsigned long shortened;
+	unsigned long relaxed;
+} digest_nonce_policy_s;
+
+typedef digest_nonce_policy_s digest_nonce_policy_t;
+
+/* The state of a nonce policy, for monitoring */
+typedef struct {
+	unsigned int lifetime;		/* Seconds */
+	unsigned int nc_limit;		/* 0 for no limit */
+	int decision;			/* DIGEST_NONCE_POLICY_* */
+	unsigned int load;		/* Percent of capacity, in the last interval */
+	unsigned int pressure;		/* Percent of the tracker budget */
+	unsigned long requests;		/* Nonces checked */
+	unsigned long challenges;	/* Challenges sent */
+	unsigned long stale_lifetime;	/* Nonces refused as older than the lifetime */
+	unsigned long stale_nc;		/* Nonces refused as used too often */
+	unsigned long extended;		/* Intervals decided under overload */
+	unsigned long shortened;	/* Intervals decided under memory pressure */
+	unsigned long relaxed;		/* Intervals decided under normal load */
+} digest_nonce_policy_metrics_t;
+
+/**
+ * Initiate a nonce policy.
+ *
+ * @param digest_nonce_policy_t *policy The policy to initiate.
+ * @param const digest_nonce_policy_config_t *config The bounds and
+ *        thresholds. The lifetime and the nc limit must each lie between
+ *        their minimum and maximum.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_nonce_policy_init(digest_nonce_policy_t *policy, const digest_nonce_policy_config_t *config);
+
+/**
+ * Check a nonce and nonce count against the current policy.
+ *
+ * Counts the request toward the load, and takes a decision if the
+ * interval is over.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ * @param const char *nonce The nonce of the Authorization header.
+ * @param unsigned int nc The nonce count of the Authorization header.
+ *
+ * @returns int DIGEST_NONCE_VALID, DIGEST_NONCE_STALE if it was issued
+ *          here but is older than the lifetime or nc is above the limit,
+ *          otherwise DIGEST_NONCE_INVALID.
+ */
+extern int digest_nonce_policy_check(digest_nonce_policy_t *policy, const char *nonce, unsigned int nc);
+
+/**
+ * Count a challenge sent with a new nonce.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ */
+extern void digest_nonce_policy_challenged(digest_nonce_policy_t *policy);
+
+/**
+ * Report the memory the replay tracker of the server uses.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ * @param size_t bytes Bytes in use, compared to the tracker budget.
+ */
+extern void digest_nonce_policy_set_tracker(digest_nonce_policy_t *policy, size_t bytes);
+
+/**
+ * Take a decision if the interval is over.
+ *
+ * Checks do this by themselves; call it from a timer to decide on time
+ * while no requests come in.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ * @param time_t now The current time.
+ */
+extern void digest_nonce_policy_update(digest_nonce_policy_t *policy, time_t now);
+
+/**
+ * Get the current nonce lifetime.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ *
+ * @returns unsigned int Seconds.
+ */
+extern unsigned int digest_nonce_policy_lifetime(digest_nonce_policy_t *policy);
+
+/**
+ * Get the current limit on the nonce count.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ *
+ * @returns unsigned int The highest nc accepted, 0 for no limit.
+ */
+extern unsigned int digest_nonce_policy_nc_limit(digest_nonce_policy_t *policy);
+
+/**
+ * Read the decisions and counters of a policy.
+ *
+ * @param digest_nonce_policy_t *policy The policy.
+ * @param digest_nonce_policy_metrics_t *metrics Filled with the metrics.
+ */
+extern void digest_nonce_policy_metrics(digest_nonce_policy_t *policy, digest_nonce_policy_metrics_t *metrics);
+
+#endif  /* INC_DIGEST_NONCEPOLICY_H */
@@ -1,8 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include "digest.h"
 #include "parse.h"
+#include "trace.h"
+
+TRACE_SEMAPHORE(parse__start);
+TRACE_SEMAPHORE(parse__done);
 
 /**
  * Extracts the value part from a attribute-value pair.
@@ -154,7 +159,10 @@ _tokenize_sentence(char *sentence, char **values, unsigned int max_values)
 				break;
 			}
 			/* Comma should be after */
-			cursor++;
+			if ('\0' == *(++cursor)) {
+				/* End of string */
+				break;
+			}
 		} else {
 			/* Find comma */
 			if (NULL == (cursor = strchr(cursor, ','))) {
@@ -170,22 +178,16 @@ _tokenize_sentence(char *sentence, char **values, unsigned int max_values)
 }
 
 /**
- * Parses a WWW-Authenticate header value to a struct.
- *
- * dig is a pointer to the digest struct to fill the parsed values with.
- * digest_string should be the value from the WWW-Authentication header,
- * null terminated.
- *
- * Returns the hash as a null terminated string. Should be free'd manually.
+ * Parses the authentication parameters of a header value, tokenizing
+ * parameters in place.
  */
-int
-parse_digest(digest_s *dig, const char *digest_string)
+static int
+_parse_parameters(digest_s *dig, char *parameters)
 {
 	int n, i = 0;
-	char *val, *parameters;
-	char *values[12];
+	char *val;
+	char *values[16];
 
-	parameters = _crop_sentence(digest_string);
 	n = _tokenize_sentence(parameters, values, ARRAY_LENGTH(values));
 
 	while (i < n) {
@@ -200,6 +202,9 @@ parse_digest(digest_s *dig, const char *digest_string)
 		} else if (0 == strncmp("qop=", val, strlen("qop="))) {
 			char *qop_options = _dgst_get_val(val);
 			char *qop_values[2];
+			if (NULL == qop_options) {
+				continue;
+			}
 			int n_qops = _split_string_by_comma(qop_options, qop_values, ARRAY_LENGTH(qop_values));
 			while (n_qops-- > 0) {
 				if (0 == strncmp(qop_values[n_qops], "auth", strlen("auth"))) {
@@ -214,15 +219,169 @@ parse_digest(digest_s *dig, const char *digest_string)
 			dig->opaque = _dgst_get_val(val);
 		} else if (0 == strncmp("algorithm=", val, strlen("algorithm="))) {
 			char *algorithm = _dgst_get_val(val);
-			if (0 == strncmp(algorithm, "MD5", strlen("MD5"))) {
+			if (NULL != algorithm && 0 == strncmp(algorithm, "MD5", strlen("MD5"))) {
 				dig->algorithm = DIGEST_ALGORITHM_MD5;
 			}
+		} else if (0 == strncmp("username=", val, strlen("username="))) {
+			dig->username = _dgst_get_val(val);
+		} else if (0 == strncmp("uri=", val, strlen("uri="))) {
+			dig->uri = _dgst_get_val(val);
+		} else if (0 == strncmp("response=", val, strlen("response="))) {
+			dig->response = _dgst_get_val(val);
+		} else if (0 == strncmp("cnonce=", val, strlen("cnonce="))) {
+			char *cnonce = _dgst_get_val(val);
+			if (NULL != cnonce) {
+				dig->cnonce_value = cnonce;
+				dig->cnonce = strtoul(cnonce, NULL, 16);
+			}
+		} else if (0 == strncmp("nc=", val, strlen("nc="))) {
+			char *nc = _dgst_get_val(val);
+			if (NULL != nc) {
+				dig->nc = strtoul(nc, NULL, 16);
+			}
+		} else if (0 == strncmp("domain=", val, strlen("domain="))) {
+			dig->domain = _dgst_get_val(val);
+		} else if (0 == strncmp("stale=", val, strlen("stale="))) {
+			char *stale = _dgst_get_val(val);
+			dig->stale = (NULL != stale && 0 == strcasecmp(stale, "true"));
+		} else if (0 == strncmp("userhash=", val, strlen("userhash="))) {
+			char *userhash = _dgst_get_val(val);
+			dig->userhash = (NULL != userhash && 0 == strcasecmp(userhash, "true"));
 		}
 	}
 
 	return i;
 }
 
+/**
+ * Fires parse__done with the lengths of the parsed fields.
+ */
+static inline void
+_trace_done(const digest_s *dig, int n)
+{
+	if (TRACE_ENABLED(parse__done)) {
+		TRACE5(parse__done, n, trace_length(dig->username), trace_length(dig->uri),\
+		    trace_length(dig->nonce), trace_length(dig->opaque));
+	}
+}
+
+/**
+ * Parses a WWW-Authenticate or Authorization header value to a struct.
+ *
+ * dig is a pointer to the digest struct to fill the parsed values with.
+ * digest_string should be the value from the WWW-Authentication or
+ * Authorization header, null terminated.
+ *
+ * Returns the number of parsed parameters. The parsed strings point into a
+ * copy of digest_string, which is never free'd.
+ */
+int
+parse_digest(digest_s *dig, const char *digest_string)
+{
+	int n;
+
+	if (TRACE_ENABLED(parse__start)) {
+		TRACE1(parse__start, trace_length(digest_string));
+	}
+	n = _parse_parameters(dig, _crop_sentence(digest_string));
+	_trace_done(dig, n);
+
+	return n;
+}
+
+/**
+ * Same as parse_digest(), but tokenizes digest_string itself instead of a
+ * copy. The parsed strings point into digest_string.
+ */
+int
+parse_digest_in_place(digest_s *dig, char *digest_string)
+{
+	int n;
+
+	if (TRACE_ENABLED(parse__start)) {
+		TRACE1(parse__start, trace_length(digest_string));
+	}
+	/* Skip Digest word */
+	n = _parse_parameters(dig, digest_string + 7);
+	_trace_done(dig, n);
+
+	return n;
+}
+
+/**
+ * Parses an Authentication-Info header value.
+ *
+ * info is the struct to fill with the parsed values. header_value is
+ * tokenized in place and the strings point into it.
+ *
+ * Returns the number of parameters parsed, -1 on failure.
+ */
+int
+parse_auth_info(parse_auth_info_s *info, char *header_value)
+{
+	int n, i = 0;
+	char *val;
+	char *values[8];
+
+	memset(info, 0, sizeof (parse_auth_info_s));
+
+	n = _tokenize_sentence(header_value, values, ARRAY_LENGTH(values));
+
+	while (i < n) {
+		val = values[i++];
+
+		if (0 == strncmp("rspauth=", val, strlen("rspauth="))) {
+			info->rspauth = _dgst_get_val(val);
+		} else if (0 == strncmp("nextnonce=", val, strlen("nextnonce="))) {
+			info->nextnonce = _dgst_get_val(val);
+		} else if (0 == strncmp("cnonce=", val, strlen("cnonce="))) {
+			info->cnonce = _dgst_get_val(val);
+		} else if (0 == strncmp("qop=", val, strlen("qop="))) {
+			char *qop = _dgst_get_val(val);
+			if (NULL != qop && 0 == strcmp(qop, "auth")) {
+				info->qop = DIGEST_QOP_AUTH;
+			} else if (NULL != qop && 0 == strcmp(qop, "auth-int")) {
+				info->qop = DIGEST_QOP_AUTH_INT;
+			}
+		} else if (0 == strncmp("nc=", val, strlen("nc="))) {
+			char *nc = _dgst_get_val(val);
+			if (NULL != nc) {
+				info->nc = strtoul(nc, NULL, 16);
+			}
+		}
+	}
+
+	return i;
+}
+
+/**
+ * Gets the HTTP method name of a DIGEST_METHOD_* value.
+ *
+ * Returns the method name, or NULL if the method is unknown.
+ */
+const char *
+parse_method_name(unsigned int method)
+{
+	switch (method) {
+	case DIGEST_METHOD_OPTIONS:
+		return "OPTIONS";
+	case DIGEST_METHOD_GET:
+		return "GET";
+	case DIGEST_METHOD_HEAD:
+		return "HEAD";
+	case DIGEST_METHOD_POST:
+		return "POST";
+	case DIGEST_METHOD_PUT:
+		return "PUT";
+	case DIGEST_METHOD_DELETE:
+		return "DELETE";
+	case DIGEST_METHOD_TRACE:
+		return "TRACE";
+	default:
+		return NULL;
+	}
+}
+
 /**
  * Validates the string values in a digest struct.
  *
@@ -4,7 +4,20 @@
 
 #define ARRAY_LENGTH(a) (sizeof a / sizeof (a[0]))
 
+/* Parsed Authentication-Info header */
+typedef struct {
+	char *rspauth;
+	char *nextnonce;
+	char *cnonce;
+	unsigned int qop;
+	unsigned int nc;
+} parse_auth_info_s;
+
+int _check_string(const char *string);
 int parse_digest(digest_s *dig, const char *digest_string);
+int parse_digest_in_place(digest_s *dig, char *digest_string);
+int parse_auth_info(parse_auth_info_s *info, char *header_value);
 int parse_validate_attributes(digest_s *dig);
+const char *parse_method_name(unsigned int method);
 
 #endif  /* INC_DIGEST_PARSE_H */
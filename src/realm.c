@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "nonce.h"
+#include "realm.h"
+
+/**
+ * Hashes a (host, realm) pair, with a NULL realm for the default realm of
+ * the host.
+ */
+static unsigned int
+_realm_hash(const char *host, const char *realm)
+{
+	unsigned int h = HASH_FNV1A_INIT;
+
+	h = hash_fnv1a(h, host, strlen(host) + 1);
+	if (NULL != realm) {
+		h = hash_fnv1a(h, realm, strlen(realm));
+	}
+	return h;
+}
+
+static digest_realm_s *
+_realm_find(digest_realm_registry_s *reg, const char *host, const char *realm)
+{
+	digest_realm_slot_s *slot;
+	digest_realm_s *r;
+	unsigned int h, j;
+	int any_realm = (NULL == realm);
+
+	h = _realm_hash(host, realm);
+	for (j = h & reg->mask; 0 != (slot = &reg->slots[j])->index; j = (j + 1) & reg->mask) {
+		if (slot->hash != h || slot->any_realm != any_realm) {
+			continue;
+		}
+		r = &reg->realms[slot->index - 1];
+		if (0 == strcmp(r->host, host) && (any_realm || 0 == strcmp(r->realm, realm))) {
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+_realm_insert(digest_realm_registry_s *reg, const char *host, const char *realm, unsigned int index)
+{
+	unsigned int h, j;
+
+	h = _realm_hash(host, realm);
+	for (j = h & reg->mask; 0 != reg->slots[j].index; j = (j + 1) & reg->mask) {
+		/* Probe */
+	}
+	reg->slots[j].hash = h;
+	reg->slots[j].index = index + 1;
+	reg->slots[j].any_realm = (NULL == realm);
+}
+
+static void
+_realm_free(digest_realm_s *r)
+{
+	digest_credstore_destroy(&r->credentials);
+	free(r->host);
+	free(r->realm);
+	free(r->opaque);
+}
+
+int
+digest_realm_registry_init(digest_realm_registry_t *registry, unsigned int max_realms)
+{
+	digest_realm_registry_s *reg = (digest_realm_registry_s *) registry;
+	unsigned int n_slots = 16;
+
+	memset(reg, 0, sizeof (digest_realm_registry_s));
+
+	/* Two keys per realm at most, at a load factor of 50% */
+	while (n_slots < 4 * (size_t) max_realms) {
+		n_slots <<= 1;
+	}
+	reg->realms = calloc(max_realms ? max_realms : 1, sizeof (digest_realm_s));
+	reg->slots = calloc(n_slots, sizeof (digest_realm_slot_s));
+	if (NULL == reg->realms || NULL == reg->slots) {
+		free(reg->realms);
+		free(reg->slots);
+		return -1;
+	}
+	reg->mask = n_slots - 1;
+	reg->max_realms = max_realms;
+
+	return 0;
+}
+
+digest_realm_t *
+digest_realm_add(digest_realm_registry_t *registry, const digest_realm_config_t *config)
+{
+	digest_realm_registry_s *reg = (digest_realm_registry_s *) registry;
+	digest_realm_s *r;
+	digest_t d;
+	const char *host = NULL != config->host ? config->host : "";
+
+	if (reg->n_realms == reg->max_realms || NULL == config->realm
+	    || NULL != _realm_find(reg, host, config->realm)) {
+		return NULL;
+	}
+
+	r = &reg->realms[reg->n_realms];
+	memset(r, 0, sizeof (digest_realm_s));
+	if (-1 == digest_credstore_init(&r->credentials, 0)) {
+		return NULL;
+	}
+	r->host = strdup(host);
+	r->realm = strdup(config->realm);
+	r->opaque = NULL != config->opaque ? strdup(config->opaque) : NULL;
+	if (NULL == r->host || NULL == r->realm || (NULL != config->opaque && NULL == r->opaque)) {
+		goto fail;
+	}
+	r->algorithm = config->algorithm;
+	r->qop = config->qop;
+	r->nonce_lifetime = config->nonce_lifetime;
+	r->userhash = config->userhash;
+	r->nonce_policy = config->nonce_policy;
+
+	if (r->userhash) {
+		digest_credstore_index_userhash(&r->credentials);
+	}
+	if (NULL != config->htdigest && -1 == digest_credstore_load(&r->credentials, config->htdigest)) {
+		goto fail;
+	}
+
+	digest_init(&d);
+	digest_set_attr(&d, D_ATTR_REALM, (digest_attr_value_t) r->realm);
+	digest_set_attr(&d, D_ATTR_OPAQUE, (digest_attr_value_t) r->opaque);
+	digest_set_attr(&d, D_ATTR_ALGORITHM, (digest_attr_value_t) (int) r->algorithm);
+	digest_set_attr(&d, D_ATTR_QOP, (digest_attr_value_t) (int) r->qop);
+	digest_set_attr(&d, D_ATTR_USERHASH, (digest_attr_value_t) r->userhash);
+	if (-1 == digest_challenge_init(&r->challenge, &d, DIGEST_NONCE_LENGTH)) {
+		goto fail;
+	}
+
+	_realm_insert(reg, host, r->realm, reg->n_realms);
+	if (NULL == _realm_find(reg, host, NULL)) {
+		_realm_insert(reg, host, NULL, reg->n_realms);
+	}
+	reg->n_realms++;
+
+	return r;
+
+fail:
+	_realm_free(r);
+	return NULL;
+}
+
+digest_realm_t *
+digest_realm_lookup(digest_realm_registry_t *registry, const char *host, const char *realm)
+{
+	digest_realm_registry_s *reg = (digest_realm_registry_s *) registry;
+	digest_realm_s *r;
+
+	if (NULL != host && '\0' != *host && NULL != (r = _realm_find(reg, host, realm))) {
+		return r;
+	}
+
+	return _realm_find(reg, "", realm);
+}
+
+size_t
+digest_realm_challenge(digest_realm_t *realm, int stale, char *result, size_t max_length)
+{
+	digest_realm_s *r = (digest_realm_s *) realm;
+	char nonce[DIGEST_NONCE_LENGTH + 1];
+
+	if (-1 == digest_nonce_generate(nonce)) {
+		return -1;
+	}
+	if (NULL != r->nonce_policy) {
+		digest_nonce_policy_challenged(r->nonce_policy);
+	}
+
+	return digest_challenge_render(&r->challenge, nonce, stale, result, max_length);
+}
+
+int
+digest_realm_authenticate(digest_realm_t *realm, digest_t *digest)
+{
+	digest_realm_s *r = (digest_realm_s *) realm;
+	digest_s *dig = (digest_s *) digest;
+	char ha1[33];
+	int nonce_state;
+
+	if (NULL == dig->username || NULL == dig->realm || NULL == dig->nonce
+	    || 0 != strcmp(dig->realm, r->realm)) {
+		return DIGEST_REALM_FAILED;
+	}
+
+	/* Hold the client to the policy it was challenged with */
+	if ((DIGEST_QOP_NOT_SET != r->qop && dig->qop != r->qop)
+	    || (DIGEST_ALGORITHM_NOT_SET != dig->algorithm && DIGEST_ALGORITHM_NOT_SET != r->algorithm
+	    && dig->algorithm != r->algorithm)) {
+		return DIGEST_REALM_FAILED;
+	}
+	if (NULL != r->opaque && (NULL == dig->opaque || 0 != strcmp(dig->opaque, r->opaque))) {
+		return DIGEST_REALM_FAILED;
+	}
+
+	if (NULL != r->nonce_policy) {
+		nonce_state = digest_nonce_policy_check(r->nonce_policy, dig->nonce, dig->nc);
+	} else {
+		nonce_state = digest_nonce_check(dig->nonce, r->nonce_lifetime);
+	}
+	if (DIGEST_NONCE_INVALID == nonce_state) {
+		return DIGEST_REALM_FAILED;
+	}
+
+	if (dig->userhash) {
+		if (-1 == digest_credstore_lookup_userhash(&r->credentials, dig->username, r->realm, NULL, 0, ha1)) {
+			return DIGEST_REALM_FAILED;
+		}
+	} else if (-1 == digest_credstore_lookup(&r->credentials, dig->username, r->realm, ha1)) {
+		return DIGEST_REALM_FAILED;
+	}
+	if (-1 == digest_server_verify(digest, ha1)) {
+		return DIGEST_REALM_FAILED;
+	}
+
+	/* Only a correct response learns that the nonce is stale */
+	return DIGEST_NONCE_STALE == nonce_state ? DIGEST_REALM_STALE : DIGEST_REALM_OK;
+}
+
+void
+digest_realm_registry_destroy(digest_realm_registry_t *registry)
+{
+	digest_realm_registry_s *reg = (digest_realm_registry_s *) registry;
+	unsigned int i;
+
+	for (i = 0; i < reg->n_realms; ++i) {
+		_realm_free(&reg->realms[i]);
+	}
+	free(reg->realms);
+	free(reg->slots);
+	memset(reg, 0, sizeof (digest_realm_registry_s));
+}
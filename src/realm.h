@@ -0,0 +1,145 @@
+#ifndef INC_DIGEST_REALM_H
+#define INC_DIGEST_REALM_H
+#include "digest.h"
+#include "server.h"
+#include "credtab.h"
+#include "noncepolicy.h"
+
+/*
+ * Registry of the realms a server protects.
+ *
+ * Each realm has its own policy (algorithm, qop, opaque and nonce
+ * lifetime), credential table and pre-rendered challenge, set up once when
+ * it is added. Realms are found by host and realm with one hash lookup per
+ * request, and used as they are; no digest context is rebuilt.
+ *
+ * Build the registry before serving: adding realms is not thread safe,
+ * lookups, challenges and authentication are.
+ */
+
+/* Results of digest_realm_authenticate() */
+#define DIGEST_REALM_OK		0
+#define DIGEST_REALM_FAILED	-1
+#define DIGEST_REALM_STALE	1
+
+/* The policy of a realm */
+typedef struct {
+	const char *host;		/* The Host header value, NULL for any host */
+	const char *realm;
+	const char *opaque;		/* NULL for none */
+	char algorithm;			/* DIGEST_ALGORITHM_* */
+	unsigned int qop;		/* DIGEST_QOP_* */
+	unsigned int nonce_lifetime;	/* Seconds, 0 for no limit */
+	const char *htdigest;		/* File to load credentials from, or NULL */
+	int userhash;			/* Ask clients to hash usernames, rfc7616 */
+	digest_nonce_policy_t *nonce_policy;	/* Replaces nonce_lifetime, or NULL */
+} digest_realm_config_s;
+
+typedef digest_realm_config_s digest_realm_config_t;
+
+typedef struct {
+	char *host;			/* Empty for any host */
+	char *realm;
+	char *opaque;
+	char algorithm;
+	unsigned int qop;
+	unsigned int nonce_lifetime;
+	int userhash;
+	digest_nonce_policy_t *nonce_policy;
+	digest_credstore_t credentials;
+	digest_challenge_t challenge;
+} digest_realm_s;
+
+typedef digest_realm_s digest_realm_t;
+
+typedef struct {
+	unsigned int hash;
+	unsigned int index;		/* Into realms, plus one; 0 if empty */
+	int any_realm;			/* The default realm of the host */
+} digest_realm_slot_s;
+
+typedef struct {
+	digest_realm_s *realms;
+	unsigned int n_realms;
+	unsigned int max_realms;
+	digest_realm_slot_s *slots;	/* Open addressing, linear probing */
+	unsigned int mask;
+} digest_realm_registry_s;
+
+typedef digest_realm_registry_s digest_realm_registry_t;
+
+/**
+ * Initiate a realm registry.
+ *
+ * @param digest_realm_registry_t *registry The registry to initiate.
+ * @param unsigned int max_realms The number of realms it can hold.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_realm_registry_init(digest_realm_registry_t *registry, unsigned int max_realms);
+
+/**
+ * Add a realm.
+ *
+ * The strings of the config are copied, and its credentials are loaded.
+ * The first realm added for a host is its default realm.
+ *
+ * @param digest_realm_registry_t *registry The registry.
+ * @param const digest_realm_config_t *config The policy of the realm.
+ *
+ * @returns digest_realm_t * The realm, which lives as long as the
+ *          registry, or NULL on failure or if it was already added.
+ */
+extern digest_realm_t * digest_realm_add(digest_realm_registry_t *registry, const digest_realm_config_t *config);
+
+/**
+ * Find the realm of a request.
+ *
+ * Realms of the host are tried first, then realms added for any host.
+ *
+ * @param digest_realm_registry_t *registry The registry.
+ * @param const char *host The Host header value, or NULL.
+ * @param const char *realm The realm of the Authorization header, or NULL
+ *        for the default realm of the host.
+ *
+ * @returns digest_realm_t * The realm, or NULL if there is none.
+ */
+extern digest_realm_t * digest_realm_lookup(digest_realm_registry_t *registry, const char *host, const char *realm);
+
+/**
+ * Generate a WWW-Authenticate header value with a new nonce.
+ *
+ * @param digest_realm_t *realm The realm.
+ * @param int stale Non-zero to add stale=true.
+ * @param char *result The buffer to store the header value in.
+ *
+ * Returns the number of bytes in the result string. -1 on failure.
+ */
+extern size_t digest_realm_challenge(digest_realm_t *realm, int stale, char *result, size_t max_length);
+
+/**
+ * Authenticate a parsed Authorization header against a realm.
+ *
+ * Checks that the header is for the realm and follows its policy, that
+ * the nonce was issued by this server, and the response against the
+ * credentials of the realm. With a nonce policy, the nonce is checked
+ * against its current lifetime and nc limit. The method must be set on the context.
+ *
+ * @param digest_realm_t *realm The realm.
+ * @param digest_t *digest The parsed Authorization header.
+ *
+ * @returns int DIGEST_REALM_OK, DIGEST_REALM_STALE if the response is
+ *          correct but the nonce is older than the nonce lifetime or
+ *          was used too often,
+ *          otherwise DIGEST_REALM_FAILED.
+ */
+extern int digest_realm_authenticate(digest_realm_t *realm, digest_t *digest);
+
+/**
+ * Free a realm registry and the credentials of its realms.
+ *
+ * @param digest_realm_registry_t *registry The registry to free.
+ */
+extern void digest_realm_registry_destroy(digest_realm_registry_t *registry);
+
+#endif  /* INC_DIGEST_REALM_H */
@@ -4,7 +4,14 @@
 #include <time.h>
 #include "parse.h"
 #include "hash.h"
-#include "client.h"
+#include "server.h"
+#include "nonce.h"
+#include "trace.h"
+
+TRACE_SEMAPHORE(server__header__start);
+TRACE_SEMAPHORE(server__header__done);
+TRACE_SEMAPHORE(verify__start);
+TRACE_SEMAPHORE(verify__done);
 
 int
 digest_server_parse(digest_t *digest, const char *digest_string)
@@ -14,41 +21,54 @@ digest_server_parse(digest_t *digest, const char *digest_string)
 	return parse_digest(dig, digest_string);
 }
 
+int
+digest_server_parse_in_place(digest_t *digest, char *digest_string)
+{
+	digest_s *dig = (digest_s *) digest;
+
+	return parse_digest_in_place(dig, digest_string);
+}
+
 int
 digest_server_generate_nonce(digest_t *digest)
 {
-	//digest_s *dig = (digest_s *) digest;
+	digest_s *dig = (digest_s *) digest;
 
-	/* Use srand and base64 or md5.
-	   Do the same with cnonce and opaque.
-	   How should the strings be allocated and free'd? */
+	if (-1 == digest_nonce_generate(dig->nonce_buffer)) {
+		return -1;
+	}
+	dig->nonce = dig->nonce_buffer;
+
+	return 0;
+}
+
+int
+digest_server_generate_ha1(char *ha1, const char *username, const char *realm, const char *password)
+{
+	if (-1 == _check_string(username) || -1 == _check_string(realm) || -1 == _check_string(password)) {
+		return -1;
+	}
 
+	hash_generate_a1(ha1, username, realm, password);
 	return 0;
 }
 
 /**
- * Generates the WWW-Authenticate header string.
- *
- * Attributes that must be set manually before calling this function:
- *
- *  - Realm
- *  - Algorithm
- *  - Nonce
- *
- * If not set, NULL will be returned.
- *
- * Returns the number of bytes in the result string.
+ * Renders the WWW-Authenticate header string, see
+ * digest_server_generate_header().
  */
-size_t
-digest_server_generate_header(digest_t *digest, char *result, size_t max_length)
+static size_t
+_render_header(digest_s *dig, char *result, size_t max_length)
 {
-	digest_s *dig = (digest_s *) digest;
-	char *qop_value, *algorithm_value;
+	char *qop_value = NULL, *algorithm_value;
 	size_t result_size; /* The size of the result string */
 	int sz;
 
 	/* Check length of char attributes to prevent buffer overflow */
-	if (-1 == parse_validate_attributes(dig)) {
+	if (-1 == _check_string(dig->realm) || -1 == _check_string(dig->nonce)) {
+		return -1;
+	}
+	if (NULL != dig->opaque && 255 < strlen(dig->opaque)) {
 		return -1;
 	}
 
@@ -67,8 +87,8 @@ digest_server_generate_header(digest_t *digest, char *result, size_t max_length)
 	}
 
 	/* Generate the minimum digest header string */
-	result_size = snprintf(result, max_length, "Digest realm=\"%s\"", dig->realm);
-	if (result_size == -1 || result_size == max_length) {
+	result_size = snprintf(result, max_length, "Digest realm=\"%s\", nonce=\"%s\"", dig->realm, dig->nonce);
+	if (result_size == -1 || result_size >= max_length) {
 		return -1;
 	}
 
@@ -82,21 +102,336 @@ digest_server_generate_header(digest_t *digest, char *result, size_t max_length)
 	}
 
 	/* Add algorithm */
-	if (DIGEST_ALGORITHM_NOT_SET != dig->algorithm) {
+	if (NULL != algorithm_value) {
 		sz = snprintf(result + result_size, max_length - result_size, ", algorithm=\"%s\"",\
 	    	    algorithm_value);
+		result_size += sz;
+		if (sz == -1 || result_size >= max_length) {
+			return -1;
+		}
+	}
+
+	/* Add qop */
+	if (NULL != qop_value) {
+		sz = snprintf(result + result_size, max_length - result_size, ", qop=\"%s\"", qop_value);
+		result_size += sz;
+		if (sz == -1 || result_size >= max_length) {
+			return -1;
+		}
+	}
+
+	/* Ask the client to hash its username */
+	if (dig->userhash) {
+		sz = snprintf(result + result_size, max_length - result_size, ", userhash=true");
+		result_size += sz;
 		if (sz == -1 || result_size >= max_length) {
 			return -1;
 		}
 	}
 
-	/* If qop is supplied, add nonce, cnonce, nc and qop */
+	/* Tell the client to retry with the new nonce */
+	if (dig->stale) {
+		sz = snprintf(result + result_size, max_length - result_size, ", stale=true");
+		result_size += sz;
+		if (sz == -1 || result_size >= max_length) {
+			return -1;
+		}
+	}
+
+	return result_size;
+}
+
+/**
+ * Generates the WWW-Authenticate header string.
+ *
+ * Attributes that must be set manually before calling this function:
+ *
+ *  - Realm
+ *  - Nonce
+ *
+ * If not set, -1 will be returned.
+ *
+ * Returns the number of bytes in the result string.
+ */
+size_t
+digest_server_generate_header(digest_t *digest, char *result, size_t max_length)
+{
+	digest_s *dig = (digest_s *) digest;
+	size_t result_size;
+
+	TRACE2(server__header__start, dig->algorithm, dig->qop);
+	result_size = _render_header(dig, result, max_length);
+	TRACE1(server__header__done, (long) result_size);
+
+	return result_size;
+}
+
+/**
+ * Pre-renders the WWW-Authenticate header string of a realm configuration.
+ *
+ * The nonce of the template is a run of nonce_length placeholders, which
+ * digest_challenge_render() overwrites.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+digest_challenge_init(digest_challenge_t *challenge, digest_t *digest, size_t nonce_length)
+{
+	digest_challenge_s *ch = (digest_challenge_s *) challenge;
+	digest_s dig = *(digest_s *) digest;
+	char placeholder[256];
+	size_t length;
+
+	if (0 == nonce_length || nonce_length >= sizeof (placeholder)) {
+		return -1;
+	}
+	memset(placeholder, 'x', nonce_length);
+	placeholder[nonce_length] = '\0';
+
+	dig.nonce = placeholder;
+	dig.stale = 0;
+	if (-1 == (int) (length = digest_server_generate_header(&dig, ch->value, sizeof (ch->value)))) {
+		return -1;
+	}
+	/* Leave room for stale=true */
+	if (length + strlen(", stale=true") >= sizeof (ch->value)) {
+		return -1;
+	}
+
+	ch->length = length;
+	ch->nonce_offset = strlen("Digest realm=\"") + strlen(dig.realm) + strlen("\", nonce=\"");
+	ch->nonce_length = nonce_length;
+	return 0;
+}
+
+/**
+ * Renders a WWW-Authenticate header string from a template.
+ *
+ * Only the nonce is written into a copy of the template, and stale=true
+ * is appended if stale is set.
+ *
+ * Returns the number of bytes in the result string, -1 on failure.
+ */
+size_t
+digest_challenge_render(const digest_challenge_t *challenge, const char *nonce, int stale, char *result, size_t max_length)
+{
+	const digest_challenge_s *ch = (const digest_challenge_s *) challenge;
+	size_t length = ch->length;
+
+	if (length + (stale ? 12 : 0) >= max_length || ch->nonce_length != strnlen(nonce, ch->nonce_length + 1)) {
+		return -1;
+	}
+
+	memcpy(result, ch->value, length);
+	memcpy(result + ch->nonce_offset, nonce, ch->nonce_length);
+	if (stale) {
+		memcpy(result + length, ", stale=true", 12);
+		length += 12;
+	}
+	result[length] = '\0';
+
+	return length;
+}
+
+/**
+ * Compares two strings of the same length in constant time.
+ *
+ * Returns 0 if equal, otherwise -1.
+ */
+static int
+_equals(const char *a, const char *b, size_t length)
+{
+	unsigned char diff = 0;
+	size_t i;
+
+	for (i = 0; i < length; ++i) {
+		diff |= a[i] ^ b[i];
+	}
+
+	return 0 == diff ? 0 : -1;
+}
+
+/**
+ * Gets the cnonce of a parsed Authorization header as sent.
+ *
+ * buffer is used when the cnonce was set as a number, at least 9 bytes.
+ *
+ * Returns the cnonce, or NULL if it is too long.
+ */
+static const char *
+_cnonce_value(digest_s *dig, char *buffer)
+{
+	if (NULL == dig->cnonce_value) {
+		sprintf(buffer, "%08x", dig->cnonce);
+		return buffer;
+	}
+	if (-1 == _check_string(dig->cnonce_value)) {
+		return NULL;
+	}
+
+	return dig->cnonce_value;
+}
+
+/**
+ * Checks the parsed fields needed for verification and hashes HA2.
+ *
+ * HA2 only depends on the request, so it can be computed before the HA1 of
+ * the user is known.
+ *
+ * hash_a2 is the buffer where to store HA2, at least 33 bytes.
+ *
+ * Returns 0 on success, -1 if fields are missing or not supported.
+ */
+static int
+_verify_prepare(digest_s *dig, char *hash_a2)
+{
+	const char *method_value;
+
+	if (NULL == dig->response || 32 != strlen(dig->response)) {
+		return -1;
+	}
+	if (-1 == _check_string(dig->username) || -1 == _check_string(dig->uri)
+	    || -1 == _check_string(dig->nonce)) {
+		return -1;
+	}
+	if (NULL == (method_value = parse_method_name(dig->method))) {
+		return -1;
+	}
+	if (DIGEST_QOP_NOT_SET != dig->qop && DIGEST_QOP_AUTH != (DIGEST_QOP_AUTH & dig->qop)) {
+		/* auth-int, which is not supported */
+		return -1;
+	}
+
+	hash_generate_a2_cached(hash_a2, method_value, dig->uri);
+	return 0;
+}
+
+/**
+ * Verifies the response of a prepared Authorization header.
+ *
+ * prefix is filled with the MD5 state after "ha1:nonce:nc:cnonce:qop:",
+ * which rspauth shares with the response.
+ *
+ * Returns 0 if the response is correct, otherwise -1.
+ */
+static int
+_verify_finish(digest_s *dig, const char *ha1, const char *hash_a2, MD5_CTX *prefix)
+{
+	char hash_res[52], cnonce[9];
+	const char *cnonce_value;
+
+	if (NULL == ha1 || 32 != strlen(ha1)) {
+		return -1;
+	}
+
 	if (DIGEST_QOP_NOT_SET != dig->qop) {
-		sz = snprintf(result + result_size, max_length - result_size, ", qop=%s, nonce=\"%s\", cnonce=\"%08x\", nc=%08x",\
-		    qop_value,\
-		    dig->nonce,\
-		    dig->cnonce,\
+		if (NULL == (cnonce_value = _cnonce_value(dig, cnonce))) {
+			return -1;
+		}
+		hash_response_prefix(prefix, ha1, dig->nonce, dig->nc, cnonce_value, "auth");
+	} else {
+		hash_response_prefix(prefix, ha1, dig->nonce, 0, NULL, NULL);
+	}
+
+	hash_response_finish(hash_res, prefix, hash_a2);
+
+	return _equals(hash_res, dig->response, 32);
+}
+
+/**
+ * Verifies the response of a parsed Authorization header.
+ *
+ * Returns 0 if the response is correct, otherwise -1.
+ */
+static int
+_verify(digest_s *dig, const char *ha1, MD5_CTX *prefix)
+{
+	char hash_a2[52];
+	int rc = -1;
+
+	if (TRACE_ENABLED(verify__start)) {
+		TRACE4(verify__start, dig->algorithm, dig->qop, trace_length(dig->username), trace_length(dig->uri));
+	}
+	if (0 == _verify_prepare(dig, hash_a2)) {
+		rc = _verify_finish(dig, ha1, hash_a2, prefix);
+	}
+	TRACE1(verify__done, rc);
+
+	return rc;
+}
+
+/**
+ * Verifies the response of a parsed Authorization header.
+ *
+ * Attributes that must be set before calling this function:
+ *
+ *  - Method, from the HTTP request
+ *  - Username, URI, Nonce and Response, parsed from the header
+ *
+ * ha1 is the stored hash of username:realm:password, as hex.
+ *
+ * Returns 0 if the response is correct, otherwise -1.
+ */
+int
+digest_server_verify(digest_t *digest, const char *ha1)
+{
+	MD5_CTX prefix;
+
+	return _verify((digest_s *) digest, ha1, &prefix);
+}
+
+/**
+ * Verifies a parsed Authorization header and generates the
+ * Authentication-Info header string.
+ *
+ * rspauth is the response hash with an empty method in HA2. Its prefix is
+ * the same as that of the response, so the MD5 state from verification is
+ * reused and only the HA2 part is hashed again.
+ *
+ * nextnonce may be NULL.
+ *
+ * Returns the number of bytes in the result string, -1 if the response is
+ * not correct or the result does not fit.
+ */
+size_t
+digest_server_verify_auth_info(digest_t *digest, const char *ha1, const char *nextnonce, char *result, size_t max_length)
+{
+	digest_s *dig = (digest_s *) digest;
+	char hash_a2[52], hash_rsp[52], cnonce[9];
+	MD5_CTX prefix;
+	size_t result_size; /* The size of the result string */
+	int sz;
+
+	if (-1 == _verify(dig, ha1, &prefix)) {
+		return -1;
+	}
+	if (NULL != nextnonce && -1 == _check_string(nextnonce)) {
+		return -1;
+	}
+
+	hash_generate_a2(hash_a2, "", dig->uri);
+	hash_response_finish(hash_rsp, &prefix, hash_a2);
+
+	result_size = snprintf(result, max_length, "rspauth=\"%s\"", hash_rsp);
+	if (result_size == -1 || result_size >= max_length) {
+		return -1;
+	}
+
+	/* If qop is supplied, echo qop, cnonce and nc */
+	if (DIGEST_QOP_NOT_SET != dig->qop) {
+		sz = snprintf(result + result_size, max_length - result_size, ", qop=auth, cnonce=\"%s\", nc=%08x",\
+		    _cnonce_value(dig, cnonce),\
 		    dig->nc);
+		result_size += sz;
+		if (sz == -1 || result_size >= max_length) {
+			return -1;
+		}
+	}
+
+	/* Add nextnonce */
+	if (NULL != nextnonce) {
+		sz = snprintf(result + result_size, max_length - result_size, ", nextnonce=\"%s\"", nextnonce);
+		result_size += sz;
 		if (sz == -1 || result_size >= max_length) {
 			return -1;
 		}
@@ -104,3 +439,94 @@ digest_server_generate_header(digest_t *digest, char *result, size_t max_length)
 
 	return result_size;
 }
+
+/**
+ * Starts a resumable verification.
+ *
+ * The header is parsed and HA2 is hashed right away. The caller then looks
+ * up the HA1 of the user, for example in an asynchronous datastore, and
+ * finishes with digest_verify_resume().
+ *
+ * Returns DIGEST_VERIFY_NEED_CREDENTIAL, or DIGEST_VERIFY_FAILED if the
+ * header can not be verified at all.
+ */
+int
+digest_verify_start(digest_verify_t *verify, const char *header_value, unsigned int method)
+{
+	digest_verify_s *v = (digest_verify_s *) verify;
+	digest_s *dig = (digest_s *) &v->digest;
+	size_t length;
+
+	digest_init(&v->digest);
+	v->state = DIGEST_VERIFY_FAILED;
+
+	if (-1 == digest_is_digest(header_value)) {
+		return DIGEST_VERIFY_FAILED;
+	}
+	/* Parse a copy of our own, parse_digest() would leak one */
+	length = strlen(header_value);
+	if (DIGEST_VERIFY_HEADER_MAX < length || strlen("Digest ") > length) {
+		return DIGEST_VERIFY_FAILED;
+	}
+	memcpy(v->header, header_value, length + 1);
+	parse_digest_in_place(dig, v->header);
+	dig->method = method;
+
+	if (-1 == _verify_prepare(dig, v->ha2) || -1 == _check_string(dig->realm)) {
+		return DIGEST_VERIFY_FAILED;
+	}
+
+	v->state = DIGEST_VERIFY_NEED_CREDENTIAL;
+	return DIGEST_VERIFY_NEED_CREDENTIAL;
+}
+
+/**
+ * Gets the credential key a suspended verification waits for.
+ *
+ * Returns 0 on success, -1 if the verification is not waiting.
+ */
+int
+digest_verify_key(digest_verify_t *verify, const char **username, const char **realm)
+{
+	digest_verify_s *v = (digest_verify_s *) verify;
+
+	if (DIGEST_VERIFY_NEED_CREDENTIAL != v->state) {
+		return -1;
+	}
+
+	*username = v->digest.username;
+	*realm = v->digest.realm;
+	return 0;
+}
+
+/**
+ * Finishes a suspended verification with the HA1 of the user.
+ *
+ * The header is not parsed again and HA2 is not hashed again. ha1 may be
+ * NULL if the user was not found.
+ *
+ * Returns DIGEST_VERIFY_OK or DIGEST_VERIFY_FAILED.
+ */
+int
+digest_verify_resume(digest_verify_t *verify, const char *ha1)
+{
+	digest_verify_s *v = (digest_verify_s *) verify;
+	MD5_CTX prefix;
+
+	if (DIGEST_VERIFY_NEED_CREDENTIAL != v->state) {
+		return DIGEST_VERIFY_FAILED;
+	}
+
+	if (TRACE_ENABLED(verify__start)) {
+		TRACE4(verify__start, v->digest.algorithm, v->digest.qop, trace_length(v->digest.username),\
+		    trace_length(v->digest.uri));
+	}
+	if (0 == _verify_finish((digest_s *) &v->digest, ha1, v->ha2, &prefix)) {
+		v->state = DIGEST_VERIFY_OK;
+	} else {
+		v->state = DIGEST_VERIFY_FAILED;
+	}
+	TRACE1(verify__done, v->state);
+
+	return v->state;
+}
@@ -12,24 +12,53 @@
  */
 extern int digest_server_parse(digest_t *digest, const char *digest_string);
 
+/**
+ * Parse a digest string without copying it.
+ *
+ * The string is tokenized in place, and the attributes of the context
+ * point into it. Use this to parse many headers without allocating.
+ *
+ * @param digest_t *digest The digest context.
+ * @param char *digest_string The header value, which is modified.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_server_parse_in_place(digest_t *digest, char *digest_string);
+
 /**
  * Generate a nonce for a digest context.
  *
+ * The nonce is taken from the nonce supply, see digest/nonce.h, and stored
+ * in the context itself.
+ *
  * @param digest_t *digest The digest context.
  *
  * @returns int 0 on success, otherwise -1.
  */
 extern int digest_server_generate_nonce(digest_t *digest);
 
+/**
+ * Generate the HA1 of a user, as stored in htdigest files.
+ *
+ * @param char *ha1 Buffer of at least 33 bytes, filled with the HA1 as hex.
+ * @param const char *username The username.
+ * @param const char *realm The realm.
+ * @param const char *password The password.
+ *
+ * @returns int 0 on success, -1 if a string is longer than 255 characters.
+ */
+extern int digest_server_generate_ha1(char *ha1, const char *username, const char *realm, const char *password);
+
 /**
  * Generate the WWW-Authenticate header value.
  *
  * Attributes that must be set manually before calling this function:
  *
  *  - Realm
- *  - Algorithm
  *  - Nonce
  *
+ * Opaque, algorithm, qop, userhash and stale are added if set.
+ *
  * @param digest_t *digest The digest context to generate the header value from.
  * @param char *result The buffer to store the generated header value in.
  *
@@ -37,4 +66,137 @@ extern int digest_server_generate_nonce(digest_t *digest);
  */
 extern size_t digest_server_generate_header(digest_t *digest, char *result, size_t max_length);
 
+/**
+ * Verify the response of a parsed Authorization header.
+ *
+ * Attributes that must be set manually before calling this function:
+ *
+ *  - Method
+ *
+ * The rest is parsed from the Authorization header with
+ * digest_server_parse().
+ *
+ * @param digest_t *digest The digest context.
+ * @param const char *ha1 The stored HA1 of the user, as 32 hex characters.
+ *
+ * @returns int 0 if the response is correct, otherwise -1.
+ */
+extern int digest_server_verify(digest_t *digest, const char *ha1);
+
+/**
+ * Verify a parsed Authorization header and generate the
+ * Authentication-Info header value.
+ *
+ * The value holds rspauth, and qop, cnonce and nc if qop was used. If
+ * nextnonce is given, the client will use it for its next request instead
+ * of waiting for a new challenge.
+ *
+ * @param digest_t *digest The digest context.
+ * @param const char *ha1 The stored HA1 of the user, as 32 hex characters.
+ * @param const char *nextnonce The nonce for the next request, or NULL.
+ * @param char *result The buffer to store the generated header value in.
+ *
+ * Returns the number of bytes in the result string. -1 if the response is
+ * not correct, or on failure.
+ */
+extern size_t digest_server_verify_auth_info(digest_t *digest, const char *ha1, const char *nextnonce, char *result, size_t max_length);
+
+/* A pre-rendered WWW-Authenticate value, with a slot for the nonce */
+#define DIGEST_CHALLENGE_MAX	768
+
+typedef struct {
+	char value[DIGEST_CHALLENGE_MAX];
+	size_t length;		/* Without stale=true */
+	size_t nonce_offset;
+	size_t nonce_length;
+} digest_challenge_s;
+
+typedef digest_challenge_s digest_challenge_t;
+
+/**
+ * Pre-render the WWW-Authenticate value of a realm configuration.
+ *
+ * Realm, opaque, algorithm and qop are taken from the digest context, like
+ * digest_server_generate_header() does. The nonce is left as a slot of
+ * nonce_length characters.
+ *
+ * @param digest_challenge_t *challenge The template to fill.
+ * @param digest_t *digest The digest context with the realm configuration.
+ * @param size_t nonce_length The length of every nonce, in characters.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_challenge_init(digest_challenge_t *challenge, digest_t *digest, size_t nonce_length);
+
+/**
+ * Render a WWW-Authenticate value from a template.
+ *
+ * @param const digest_challenge_t *challenge The template.
+ * @param const char *nonce The nonce, exactly nonce_length characters.
+ * @param int stale Non-zero to add stale=true.
+ * @param char *result The buffer to store the header value in.
+ *
+ * Returns the number of bytes in the result string. -1 on failure.
+ */
+extern size_t digest_challenge_render(const digest_challenge_t *challenge, const char *nonce, int stale, char *result, size_t max_length);
+
+/* States of a resumable verification */
+#define DIGEST_VERIFY_OK		0
+#define DIGEST_VERIFY_FAILED		-1
+#define DIGEST_VERIFY_NEED_CREDENTIAL	1
+
+/* Longest Authorization header a resumable verification takes, in bytes */
+#define DIGEST_VERIFY_HEADER_MAX	2047
+
+/* A resumable verification, waits for the HA1 without blocking */
+typedef struct {
+	digest_t digest;	/* The parsed Authorization header */
+	char ha2[33];
+	int state;
+	char header[DIGEST_VERIFY_HEADER_MAX + 1];	/* The digest points into this copy */
+} digest_verify_s;
+
+typedef digest_verify_s digest_verify_t;
+
+/**
+ * Start a resumable verification.
+ *
+ * Parses the Authorization header and hashes HA2. If the header can be
+ * verified, the verification is suspended until the HA1 of the user is
+ * passed to digest_verify_resume().
+ *
+ * The header is copied into the context, so nothing is allocated and the
+ * context needs no cleanup. Headers longer than DIGEST_VERIFY_HEADER_MAX
+ * fail.
+ *
+ * @param digest_verify_t *verify The verification context.
+ * @param const char *header_value The value of the Authorization header.
+ * @param unsigned int method The method of the request, DIGEST_METHOD_*.
+ *
+ * @returns int DIGEST_VERIFY_NEED_CREDENTIAL or DIGEST_VERIFY_FAILED.
+ */
+extern int digest_verify_start(digest_verify_t *verify, const char *header_value, unsigned int method);
+
+/**
+ * Get the (username, realm) key a suspended verification waits for.
+ *
+ * @param digest_verify_t *verify The verification context.
+ * @param const char **username Set to the username.
+ * @param const char **realm Set to the realm.
+ *
+ * @returns int 0 on success, -1 if the verification is not suspended.
+ */
+extern int digest_verify_key(digest_verify_t *verify, const char **username, const char **realm);
+
+/**
+ * Finish a suspended verification.
+ *
+ * @param digest_verify_t *verify The verification context.
+ * @param const char *ha1 The HA1 of the user as 32 hex characters, or
+ *        NULL if the user was not found.
+ *
+ * @returns int DIGEST_VERIFY_OK or DIGEST_VERIFY_FAILED.
+ */
+extern int digest_verify_resume(digest_verify_t *verify, const char *ha1);
+
 #endif  /* INC_DIGEST_SERVER_H */
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "snapstate.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC		"DIGSNAP"
+#define SNAPSHOT_SECRET_MAX	64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t n_records;
+	uint32_t checksum;		/* FNV-1a of the records, then of this header with it zeroed */
+	uint32_t secret_length;
+	unsigned char secret[SNAPSHOT_SECRET_MAX];
+} snapshot_header_s;
+
+typedef struct {
+	uint32_t cache;			/* HASH_CACHE_* */
+	uint32_t key_len;
+	unsigned char key[HASH_CACHE_KEY_MAX];
+	unsigned char value[HASH_CACHE_VALUE_SIZE];
+} snapshot_record_s;
+
+typedef struct {
+	FILE *fp;
+	int cache;
+	snapshot_header_s header;
+	unsigned int checksum;
+	int failed;
+} snapshot_writer_s;
+
+static void
+_write_record(void *arg, const void *key, unsigned int key_len, const unsigned char *value)
+{
+	snapshot_writer_s *w = (snapshot_writer_s *) arg;
+	snapshot_record_s record;
+
+	memset(&record, 0, sizeof (record));
+	record.cache = w->cache;
+	record.key_len = key_len;
+	memcpy(record.key, key, key_len);
+	memcpy(record.value, value, HASH_CACHE_VALUE_SIZE);
+
+	if (1 != fwrite(&record, sizeof (record), 1, w->fp)) {
+		w->failed = 1;
+	}
+	w->checksum = hash_fnv1a(w->checksum, &record, sizeof (record));
+	w->header.n_records++;
+}
+
+int
+digest_snapshot_save(const char *path)
+{
+	snapshot_writer_s w;
+	char *tmp;
+	int fd;
+
+	if (NULL == (tmp = malloc(strlen(path) + 5))) {
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", path);
+	if (-1 == (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600))) {
+		free(tmp);
+		return -1;
+	}
+	if (NULL == (w.fp = fdopen(fd, "w"))) {
+		close(fd);
+		goto fail;
+	}
+
+	memset(&w.header, 0, sizeof (w.header));
+	memcpy(w.header.magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC));
+	w.header.version = DIGEST_SNAPSHOT_VERSION;
+	w.header.record_size = sizeof (snapshot_record_s);
+	w.header.secret_length = nonce_get_secret(w.header.secret, sizeof (w.header.secret));
+	w.checksum = HASH_FNV1A_INIT;
+	w.failed = 0;
+
+	/* Records first, then the header with their count and checksum */
+	if (0 != fseek(w.fp, sizeof (snapshot_header_s), SEEK_SET)) {
+		w.failed = 1;
+	}
+	for (w.cache = HASH_CACHE_HA2; w.cache <= HASH_CACHE_MIDSTATE; ++w.cache) {
+		hash_cache_visit(w.cache, _write_record, &w);
+	}
+	w.header.checksum = hash_fnv1a(w.checksum, &w.header, sizeof (w.header));
+	if (w.failed || 0 != fseek(w.fp, 0, SEEK_SET) || 1 != fwrite(&w.header, sizeof (w.header), 1, w.fp)
+	    || 0 != fflush(w.fp) || 0 != fsync(fd)) {
+		fclose(w.fp);
+		goto fail;
+	}
+	if (0 != fclose(w.fp) || 0 != rename(tmp, path)) {
+		goto fail;
+	}
+
+	free(tmp);
+	return 0;
+
+fail:
+	unlink(tmp);
+	free(tmp);
+	return -1;
+}
+
+int
+digest_snapshot_load(const char *path)
+{
+	const snapshot_header_s *header;
+	snapshot_header_s unsummed;
+	const snapshot_record_s *records;
+	struct stat st;
+	unsigned char *map;
+	unsigned int checksum, i;
+	int fd, rc = -1;
+
+	if (-1 == (fd = open(path, O_RDONLY))) {
+		return -1;
+	}
+	if (-1 == fstat(fd, &st) || (size_t) st.st_size < sizeof (snapshot_header_s)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		return -1;
+	}
+
+	header = (const snapshot_header_s *) map;
+	records = (const snapshot_record_s *) (map + sizeof (snapshot_header_s));
+	if (0 != memcmp(header->magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC))
+	    || DIGEST_SNAPSHOT_VERSION != header->version || sizeof (snapshot_record_s) != header->record_size
+	    || header->secret_length > SNAPSHOT_SECRET_MAX
+	    || (size_t) st.st_size != sizeof (snapshot_header_s) + (size_t) header->n_records * sizeof (snapshot_record_s)) {
+		goto done;
+	}
+
+	/* Check everything before adopting anything */
+	checksum = HASH_FNV1A_INIT;
+	for (i = 0; i < header->n_records; ++i) {
+		if (records[i].cache > HASH_CACHE_MIDSTATE || 0 == records[i].key_len
+		    || records[i].key_len > HASH_CACHE_KEY_MAX) {
+			goto done;
+		}
+		checksum = hash_fnv1a(checksum, &records[i], sizeof (snapshot_record_s));
+	}
+	unsummed = *header;
+	unsummed.checksum = 0;
+	if (hash_fnv1a(checksum, &unsummed, sizeof (unsummed)) != header->checksum) {
+		goto done;
+	}
+
+	if (0 != header->secret_length) {
+		nonce_set_secret(header->secret, header->secret_length);
+	}
+	for (i = 0; i < header->n_records; ++i) {
+		hash_cache_insert(records[i].cache, records[i].key, records[i].key_len, records[i].value);
+	}
+	rc = 0;
+
+done:
+	munmap(map, st.st_size);
+	return rc;
+}
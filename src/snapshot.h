@@ -0,0 +1,45 @@
+#ifndef INC_DIGEST_SNAPSHOT_H
+#define INC_DIGEST_SNAPSHOT_H
+
+/*
+ * Snapshots of server state, for warm restarts.
+ *
+ * A snapshot holds the nonce secret and the entries of the HA2 and
+ * midstate caches. Saved on shutdown and loaded on startup, nonces issued
+ * before the restart stay valid, so clients are not challenged again, and
+ * the caches start warm.
+ *
+ * The file is versioned and checksummed, header included, in the byte
+ * order of the machine that wrote it. A snapshot that does not match is
+ * refused as a whole. It holds the nonce secret and state derived from HA1
+ * values, so it is written readable by the owner only.
+ */
+
+#define DIGEST_SNAPSHOT_VERSION	2
+
+/**
+ * Save a snapshot.
+ *
+ * The file is written next to path and renamed over it, so a crash never
+ * leaves half a snapshot.
+ *
+ * @param const char *path Path to the snapshot file.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_snapshot_save(const char *path);
+
+/**
+ * Load a snapshot.
+ *
+ * Call after enabling the caches and before digest_nonce_start(), which
+ * then keeps the restored secret. Entries of caches that are not enabled
+ * are skipped.
+ *
+ * @param const char *path Path to the snapshot file.
+ *
+ * @returns int 0 on success, otherwise -1 and nothing is restored.
+ */
+extern int digest_snapshot_load(const char *path);
+
+#endif  /* INC_DIGEST_SNAPSHOT_H */
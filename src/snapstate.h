@@ -0,0 +1,25 @@
+#ifndef INC_DIGEST_SNAPSTATE_H
+#define INC_DIGEST_SNAPSTATE_H
+#include <stddef.h>
+
+/*
+ * Library state saved and restored by snapshots: the entries of the HA2
+ * and midstate caches, and the nonce secret. Not installed.
+ */
+
+#define HASH_CACHE_HA2		0
+#define HASH_CACHE_MIDSTATE	1
+#define HASH_CACHE_KEY_MAX	96
+#define HASH_CACHE_VALUE_SIZE	16
+
+typedef void (*hash_cache_visit_fn)(void *arg, const void *key, unsigned int key_len, const unsigned char *value);
+
+/* In ha2cache.c */
+int hash_cache_visit(int cache, hash_cache_visit_fn fn, void *arg);
+int hash_cache_insert(int cache, const void *key, unsigned int key_len, const unsigned char *value);
+
+/* In nonce.c */
+size_t nonce_get_secret(unsigned char *secret, size_t max_length);
+int nonce_set_secret(const unsigned char *secret, size_t length);
+
+#endif  /* INC_DIGEST_SNAPSTATE_H */
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+#include "throttle.h"
+
+#define TOKEN_ONE	16	/* Tokens are stored with 4 fractional bits */
+#define FILTER_HASHES	7
+
+#define BUCKET_TAG(s)		((unsigned int) ((s) >> 48))
+#define BUCKET_TOKENS(s)	((unsigned int) ((s) >> 32) & 0xffff)
+#define BUCKET_TIME(s)		((unsigned int) (s))
+#define BUCKET(tag, tokens, time) \
+	(((unsigned long long) (tag) << 48) | ((unsigned long long) (tokens) << 32) | (time))
+
+/**
+ * Returns a millisecond clock. Wraps around, so only differences are used.
+ */
+static unsigned int
+_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned int) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/**
+ * Hashes a (username, client key) pair.
+ */
+static unsigned int
+_key_hash(const char *username, const char *client_key)
+{
+	unsigned int h = HASH_FNV1A_INIT;
+
+	h = hash_fnv1a(h, username, strlen(username));
+	h = hash_fnv1a(h, ":", 1);
+	return hash_fnv1a(h, client_key, strlen(client_key));
+}
+
+/**
+ * Gets the tokens in a bucket at time now, after refilling.
+ */
+static unsigned int
+_bucket_tokens(const digest_throttle_s *th, unsigned long long state, unsigned int now)
+{
+	double tokens;
+	unsigned int elapsed;
+
+	if (0 == state) {
+		return th->burst;
+	}
+
+	elapsed = now - BUCKET_TIME(state);
+	if (0x80000000 <= elapsed) {
+		/* The clock went backwards, or the bucket is very old */
+		return th->burst;
+	}
+
+	tokens = BUCKET_TOKENS(state) + elapsed * th->rate;
+	return tokens < th->burst ? (unsigned int) tokens : th->burst;
+}
+
+/**
+ * Computes the two base hashes of a username for the filter. Bit i is
+ * (h1 + i * h2) modulo the filter size.
+ */
+static void
+_filter_hashes(const char *username, unsigned int *h1, unsigned int *h2)
+{
+	size_t len = strlen(username);
+
+	*h1 = hash_fnv1a(HASH_FNV1A_INIT, username, len);
+	*h2 = hash_fnv1a(*h1 ^ 0x5bd1e995, username, len) | 1;
+}
+
+/**
+ * Checks if a username may be in the filter.
+ *
+ * Returns 1 if it may be, 0 if it is certainly not.
+ */
+static int
+_filter_contains(const digest_throttle_s *th, const char *username)
+{
+	unsigned int h1, h2, bit;
+	int i;
+
+	_filter_hashes(username, &h1, &h2);
+
+	for (i = 0; i < FILTER_HASHES; ++i) {
+		bit = (h1 + i * h2) & th->filter_mask;
+		if (0 == (__atomic_load_n(&th->filter[bit >> 6], __ATOMIC_RELAXED) & (1ULL << (bit & 63)))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int
+digest_throttle_init(digest_throttle_t *throttle, unsigned int n_keys, unsigned int n_users, double rate, unsigned int burst)
+{
+	digest_throttle_s *th = (digest_throttle_s *) throttle;
+	unsigned int n_sets = 1, n_bits = 1024;
+
+	memset(th, 0, sizeof (digest_throttle_s));
+
+	/* Also refuses NaN */
+	if (0 == burst || 4095 < burst || !(0 < rate)) {
+		return -1;
+	}
+
+	while (n_sets * DIGEST_THROTTLE_SET_SIZE < n_keys && n_sets < 0x10000000) {
+		n_sets <<= 1;
+	}
+	/* About ten bits per user gives 1% false positives with seven hashes */
+	while (n_bits < 10 * (unsigned long long) n_users && n_bits < 0x80000000) {
+		n_bits <<= 1;
+	}
+
+	th->buckets = aligned_alloc(64, (size_t) n_sets * DIGEST_THROTTLE_SET_SIZE * sizeof (unsigned long long));
+	th->filter = calloc(n_bits / 64, sizeof (unsigned long long));
+	if (NULL == th->buckets || NULL == th->filter) {
+		digest_throttle_destroy(th);
+		return -1;
+	}
+	memset(th->buckets, 0, (size_t) n_sets * DIGEST_THROTTLE_SET_SIZE * sizeof (unsigned long long));
+
+	th->set_mask = n_sets - 1;
+	th->filter_mask = n_bits - 1;
+	th->rate = rate * TOKEN_ONE / 1000;
+	th->burst = burst * TOKEN_ONE;
+
+	return 0;
+}
+
+void
+digest_throttle_add_user(digest_throttle_t *throttle, const char *username)
+{
+	digest_throttle_s *th = (digest_throttle_s *) throttle;
+	unsigned int h1, h2, bit;
+	int i;
+
+	_filter_hashes(username, &h1, &h2);
+
+	for (i = 0; i < FILTER_HASHES; ++i) {
+		bit = (h1 + i * h2) & th->filter_mask;
+		__atomic_fetch_or(&th->filter[bit >> 6], 1ULL << (bit & 63), __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&th->check_users, 1, __ATOMIC_RELEASE);
+}
+
+int
+digest_throttle_check(digest_throttle_t *throttle, const char *username, const char *client_key)
+{
+	digest_throttle_s *th = (digest_throttle_s *) throttle;
+	unsigned long long *set, state;
+	unsigned int h, tag, i;
+
+	if (NULL == username) {
+		return DIGEST_THROTTLE_UNKNOWN_USER;
+	}
+	if (__atomic_load_n(&th->check_users, __ATOMIC_ACQUIRE) && !_filter_contains(th, username)) {
+		return DIGEST_THROTTLE_UNKNOWN_USER;
+	}
+
+	h = _key_hash(username, NULL != client_key ? client_key : "");
+	tag = ((h * 2654435761U) >> 16) | 1;
+	set = &th->buckets[(h & th->set_mask) * DIGEST_THROTTLE_SET_SIZE];
+
+	for (i = 0; i < DIGEST_THROTTLE_SET_SIZE; ++i) {
+		state = __atomic_load_n(&set[i], __ATOMIC_RELAXED);
+		if (BUCKET_TAG(state) == tag) {
+			if (TOKEN_ONE > _bucket_tokens(th, state, _now_ms())) {
+				return DIGEST_THROTTLE_LIMITED;
+			}
+			break;
+		}
+	}
+
+	return DIGEST_THROTTLE_PASS;
+}
+
+void
+digest_throttle_fail(digest_throttle_t *throttle, const char *username, const char *client_key)
+{
+	digest_throttle_s *th = (digest_throttle_s *) throttle;
+	unsigned long long *set, state, victim_state, next;
+	unsigned int h, tag, now, i, victim, tokens, victim_tokens;
+
+	if (NULL == username) {
+		return;
+	}
+
+	h = _key_hash(username, NULL != client_key ? client_key : "");
+	tag = ((h * 2654435761U) >> 16) | 1;
+	set = &th->buckets[(h & th->set_mask) * DIGEST_THROTTLE_SET_SIZE];
+	now = _now_ms();
+
+	do {
+		/* Find the bucket of the key, or the fullest one to take over */
+		victim = 0;
+		victim_tokens = 0;
+		victim_state = 0;
+		for (i = 0; i < DIGEST_THROTTLE_SET_SIZE; ++i) {
+			state = __atomic_load_n(&set[i], __ATOMIC_RELAXED);
+			tokens = _bucket_tokens(th, state, now);
+			if (BUCKET_TAG(state) == tag) {
+				victim = i;
+				victim_state = state;
+				victim_tokens = tokens;
+				break;
+			}
+			if (0 == i || tokens > victim_tokens) {
+				victim = i;
+				victim_state = state;
+				victim_tokens = tokens;
+			}
+		}
+		if (BUCKET_TAG(victim_state) != tag) {
+			victim_tokens = th->burst;
+		}
+
+		tokens = TOKEN_ONE < victim_tokens ? victim_tokens - TOKEN_ONE : 0;
+		next = BUCKET(tag, tokens, now);
+	} while (!__atomic_compare_exchange_n(&set[victim], &victim_state, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void
+digest_throttle_destroy(digest_throttle_t *throttle)
+{
+	digest_throttle_s *th = (digest_throttle_s *) throttle;
+
+	free(th->buckets);
+	free(th->filter);
+	memset(th, 0, sizeof (digest_throttle_s));
+}
@@ -0,0 +1,96 @@
+#ifndef INC_DIGEST_THROTTLE_H
+#define INC_DIGEST_THROTTLE_H
+
+/*
+ * Pre-hash rejection throttle.
+ *
+ * Meant to be checked right after digest_server_parse(), before any
+ * credential lookup or hashing:
+ *
+ *  - A Bloom filter of known usernames rejects unknown users. It has no
+ *    false negatives, so known users are never rejected by it.
+ *  - A token bucket per (username, client key) limits failed attempts.
+ *    A token is only taken when verification fails, so well-behaved
+ *    clients are never throttled.
+ *
+ * Both are lock-free. Buckets live in sets of one cache line each. A key
+ * maps to one set and takes over the fullest bucket in it when it is not
+ * there yet, so the table is bounded and forgets idle keys first.
+ */
+
+/* Results of digest_throttle_check() */
+#define DIGEST_THROTTLE_PASS		0
+#define DIGEST_THROTTLE_UNKNOWN_USER	1
+#define DIGEST_THROTTLE_LIMITED		2
+
+/* Buckets per set, 8 bytes each */
+#define DIGEST_THROTTLE_SET_SIZE	8
+
+typedef struct {
+	unsigned long long *buckets;	/* tag:16 | tokens:16 | time:32 */
+	unsigned int set_mask;
+	unsigned long long *filter;	/* Bloom filter bits */
+	unsigned int filter_mask;	/* Number of bits - 1 */
+	double rate;			/* Tokens per millisecond, fixed point */
+	unsigned int burst;		/* Bucket size, fixed point */
+	int check_users;		/* 0 until a user is added */
+} digest_throttle_s;
+
+typedef digest_throttle_s digest_throttle_t;
+
+/**
+ * Initiate a throttle.
+ *
+ * @param digest_throttle_t *throttle The throttle to initiate.
+ * @param unsigned int n_keys Expected number of tracked (username, client
+ *        key) pairs. Rounded up to a power of two.
+ * @param unsigned int n_users Expected number of known users, sizes the
+ *        Bloom filter for about 1% false positives.
+ * @param double rate Failed attempts per second allowed in the long run,
+ *        above 0. May be below 1.
+ * @param unsigned int burst Failed attempts allowed at once, at most 4095.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_throttle_init(digest_throttle_t *throttle, unsigned int n_keys, unsigned int n_users, double rate, unsigned int burst);
+
+/**
+ * Add a known username to the filter. Thread-safe.
+ *
+ * Until the first user is added, the filter lets all users pass.
+ *
+ * @param digest_throttle_t *throttle The throttle.
+ * @param const char *username The username.
+ */
+extern void digest_throttle_add_user(digest_throttle_t *throttle, const char *username);
+
+/**
+ * Check if a request should be verified at all. Does not write to memory.
+ *
+ * @param digest_throttle_t *throttle The throttle.
+ * @param const char *username The username from the Authorization header.
+ * @param const char *client_key Identifies the client, for example the
+ *        remote address.
+ *
+ * @returns int DIGEST_THROTTLE_PASS, DIGEST_THROTTLE_UNKNOWN_USER or
+ *          DIGEST_THROTTLE_LIMITED.
+ */
+extern int digest_throttle_check(digest_throttle_t *throttle, const char *username, const char *client_key);
+
+/**
+ * Record a failed verification, taking a token from the bucket.
+ *
+ * @param digest_throttle_t *throttle The throttle.
+ * @param const char *username The username from the Authorization header.
+ * @param const char *client_key Identifies the client.
+ */
+extern void digest_throttle_fail(digest_throttle_t *throttle, const char *username, const char *client_key);
+
+/**
+ * Free a throttle.
+ *
+ * @param digest_throttle_t *throttle The throttle to free.
+ */
+extern void digest_throttle_destroy(digest_throttle_t *throttle);
+
+#endif  /* INC_DIGEST_THROTTLE_H */
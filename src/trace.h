@@ -0,0 +1,74 @@
+#ifndef INC_DIGEST_TRACE_H
+#define INC_DIGEST_TRACE_H
+#include <string.h>
+
+/*
+ * Static tracepoints (USDT) for bpftrace, perf and SystemTap.
+ *
+ * Probes are in the "libdigest" provider. With <sys/sdt.h> each probe is a
+ * single nop in the code and a note in the library; arguments that cost
+ * something to compute are guarded by TRACE_ENABLED(), which reads the
+ * semaphore of the probe, set by the tracer while it is attached. Without
+ * <sys/sdt.h>, or with -DDIGEST_NO_SDT, probes compile to nothing.
+ *
+ * Probes, with their arguments:
+ *
+ *   parse__start(length)
+ *   parse__done(parameters, username length, uri length, nonce length, opaque length)
+ *   hash__start(kind, input length)
+ *   hash__done(kind)
+ *   client__header__start(algorithm, qop, method)
+ *   client__header__done(length or -1 on failure)
+ *   server__header__start(algorithm, qop)
+ *   server__header__done(length or -1 on failure)
+ *   verify__start(algorithm, qop, username length, uri length)
+ *   verify__done(0 if correct or -1)
+ *
+ * Each probe fires from one source file, which defines its semaphore with
+ * TRACE_SEMAPHORE().
+ */
+
+/* Kinds of hash__start and hash__done */
+#define TRACE_HASH_A1		1
+#define TRACE_HASH_A2		2
+#define TRACE_HASH_RESPONSE	3
+#define TRACE_HASH_USERHASH	4
+
+#if !defined(DIGEST_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DIGEST_SDT 1
+#endif
+#endif
+
+#ifdef DIGEST_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define TRACE_SEMAPHORE(name) \
+	unsigned short libdigest_##name##_semaphore __attribute__((unused, section(".probes")))
+#define TRACE_ENABLED(name) __builtin_expect(libdigest_##name##_semaphore, 0)
+
+#define TRACE1(name, a) DTRACE_PROBE1(libdigest, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(libdigest, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(libdigest, name, a, b, c)
+#define TRACE4(name, a, b, c, d) DTRACE_PROBE4(libdigest, name, a, b, c, d)
+#define TRACE5(name, a, b, c, d, e) DTRACE_PROBE5(libdigest, name, a, b, c, d, e)
+#else
+#define TRACE_SEMAPHORE(name) struct _trace_##name
+#define TRACE_ENABLED(name) 0
+
+#define TRACE1(name, a) do {} while (0)
+#define TRACE2(name, a, b) do {} while (0)
+#define TRACE3(name, a, b, c) do {} while (0)
+#define TRACE4(name, a, b, c, d) do {} while (0)
+#define TRACE5(name, a, b, c, d, e) do {} while (0)
+#endif
+
+/* The length of an optional string argument */
+static inline long
+trace_length(const char *s)
+{
+	return NULL != s ? (long) strlen(s) : 0;
+}
+
+#endif  /* INC_DIGEST_TRACE_H */
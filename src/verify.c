@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "server.h"
+#include "verify.h"
+
+typedef struct digest_verify_job_s {
+	digest_t *digest;
+	digest_verify_cb cb;
+	void *userdata;
+	int result;
+	struct digest_verify_job_s *next;
+} digest_verify_job_s;
+
+/* A worker queue, on its own cache line */
+typedef struct {
+	pthread_mutex_t lock;
+	digest_verify_job_s *head;
+	digest_verify_job_s *tail;
+	unsigned int count;
+} __attribute__((aligned(64))) digest_verify_queue_s;
+
+static struct {
+	int started;
+	int stopping;
+	int n_workers;			/* Number of queues */
+	int n_started;			/* Number of threads, others' queues are stolen from */
+	pthread_t *workers;
+	digest_verify_queue_s *queues;
+	unsigned int next_queue;	/* Round robin for submit */
+
+	/* Idle workers sleep here */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	int n_idle;
+	unsigned long pending;		/* Jobs in all queues */
+
+	digest_verify_job_s *done;	/* Finished jobs, newest first */
+	int event_fd;
+
+	digest_lookup_fn lookup;
+	digest_lookup_fn lookup_userhash;	/* NULL if userhash is not supported */
+	void *lookup_arg;
+} _pool;
+
+/**
+ * Takes up to max jobs from the head of a queue.
+ *
+ * Returns the jobs as a list, NULL if the queue is empty.
+ */
+static digest_verify_job_s *
+_queue_take(digest_verify_queue_s *q, unsigned int max)
+{
+	digest_verify_job_s *first, *last;
+	unsigned int n;
+
+	pthread_mutex_lock(&q->lock);
+	if (NULL == (first = q->head)) {
+		pthread_mutex_unlock(&q->lock);
+		return NULL;
+	}
+
+	last = first;
+	for (n = 1; n < max && NULL != last->next; ++n) {
+		last = last->next;
+	}
+	q->head = last->next;
+	if (NULL == q->head) {
+		q->tail = NULL;
+	}
+	__atomic_fetch_sub(&q->count, n, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&q->lock);
+
+	last->next = NULL;
+	__atomic_fetch_sub(&_pool.pending, n, __ATOMIC_RELAXED);
+	return first;
+}
+
+/**
+ * Takes jobs for worker self: a batch from its own queue, or else half of
+ * the jobs of the first other queue that has any.
+ */
+static digest_verify_job_s *
+_worker_take(int self)
+{
+	digest_verify_job_s *jobs;
+	unsigned int count;
+	int i, victim;
+
+	if (NULL != (jobs = _queue_take(&_pool.queues[self], DIGEST_VERIFY_BATCH))) {
+		return jobs;
+	}
+
+	for (i = 1; i < _pool.n_workers; ++i) {
+		victim = (self + i) % _pool.n_workers;
+		count = __atomic_load_n(&_pool.queues[victim].count, __ATOMIC_RELAXED);
+		if (0 == count) {
+			continue;
+		}
+		count = (count + 1) / 2;
+		if (NULL != (jobs = _queue_take(&_pool.queues[victim], count < DIGEST_VERIFY_BATCH ? count : DIGEST_VERIFY_BATCH))) {
+			return jobs;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Verifies a batch of jobs and publishes them on the completion queue
+ * with a single eventfd write.
+ */
+static void
+_worker_run_batch(digest_verify_job_s *jobs)
+{
+	digest_verify_job_s *job, *last = NULL, *head;
+	digest_lookup_fn lookup;
+	digest_s *dig;
+	char ha1[33];
+	uint64_t one = 1;
+
+	for (job = jobs; NULL != job; job = job->next) {
+		dig = (digest_s *) job->digest;
+		job->result = -1;
+		/* With userhash, the username is H(username:realm) */
+		lookup = dig->userhash ? _pool.lookup_userhash : _pool.lookup;
+		if (NULL != lookup && NULL != dig->username && NULL != dig->realm
+		    && 0 == lookup(_pool.lookup_arg, dig->username, dig->realm, ha1)) {
+			job->result = digest_server_verify(job->digest, ha1);
+		}
+		last = job;
+	}
+
+	/* Push the whole batch onto the completion stack */
+	head = __atomic_load_n(&_pool.done, __ATOMIC_RELAXED);
+	do {
+		last->next = head;
+	} while (!__atomic_compare_exchange_n(&_pool.done, &head, jobs, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	while (-1 == write(_pool.event_fd, &one, sizeof (one)) && EINTR == errno) {
+		/* Retry */
+	}
+}
+
+static void *
+_worker(void *arg)
+{
+	int self = (int) (long) arg;
+	digest_verify_job_s *jobs;
+
+	for (;;) {
+		if (NULL != (jobs = _worker_take(self))) {
+			_worker_run_batch(jobs);
+			continue;
+		}
+
+		/*
+		 * Count as idle before looking at pending. A submitter counts
+		 * pending before looking at n_idle, so either we see its job or
+		 * it sees us and signals under the lock.
+		 */
+		pthread_mutex_lock(&_pool.idle_lock);
+		__atomic_fetch_add(&_pool.n_idle, 1, __ATOMIC_SEQ_CST);
+		while (0 == __atomic_load_n(&_pool.pending, __ATOMIC_SEQ_CST) && !_pool.stopping) {
+			pthread_cond_wait(&_pool.idle_cond, &_pool.idle_lock);
+		}
+		__atomic_fetch_sub(&_pool.n_idle, 1, __ATOMIC_RELAXED);
+		if (0 == __atomic_load_n(&_pool.pending, __ATOMIC_SEQ_CST) && _pool.stopping) {
+			pthread_mutex_unlock(&_pool.idle_lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&_pool.idle_lock);
+	}
+}
+
+int
+digest_verify_pool_start(int n_threads, digest_lookup_fn lookup, void *lookup_arg)
+{
+	int i;
+
+	if (_pool.started || NULL == lookup) {
+		return -1;
+	}
+
+	memset(&_pool, 0, sizeof (_pool));
+	if (0 >= n_threads) {
+		n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (0 >= n_threads) {
+		n_threads = 1;
+	}
+
+	_pool.lookup = lookup;
+	_pool.lookup_arg = lookup_arg;
+	if (-1 == (_pool.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+		return -1;
+	}
+
+	_pool.queues = aligned_alloc(64, n_threads * sizeof (digest_verify_queue_s));
+	_pool.workers = calloc(n_threads, sizeof (pthread_t));
+	if (NULL == _pool.queues || NULL == _pool.workers) {
+		goto fail;
+	}
+	memset(_pool.queues, 0, n_threads * sizeof (digest_verify_queue_s));
+	for (i = 0; i < n_threads; ++i) {
+		pthread_mutex_init(&_pool.queues[i].lock, NULL);
+	}
+	pthread_mutex_init(&_pool.idle_lock, NULL);
+	pthread_cond_init(&_pool.idle_cond, NULL);
+
+	_pool.n_workers = n_threads;
+	for (i = 0; i < n_threads; ++i) {
+		if (0 != pthread_create(&_pool.workers[i], NULL, _worker, (void *) (long) i)) {
+			break;
+		}
+	}
+	if (0 == (_pool.n_started = i)) {
+		goto fail;
+	}
+
+	_pool.started = 1;
+	return 0;
+
+fail:
+	free(_pool.queues);
+	free(_pool.workers);
+	close(_pool.event_fd);
+	memset(&_pool, 0, sizeof (_pool));
+	return -1;
+}
+
+int
+digest_verify_pool_lookup_userhash(digest_lookup_fn lookup)
+{
+	if (!_pool.started) {
+		return -1;
+	}
+
+	_pool.lookup_userhash = lookup;
+	return 0;
+}
+
+int
+digest_verify_pool_fd(void)
+{
+	return _pool.started ? _pool.event_fd : -1;
+}
+
+int
+digest_verify_submit(digest_t *digest, digest_verify_cb cb, void *userdata)
+{
+	digest_verify_job_s *job;
+	digest_verify_queue_s *q;
+
+	if (!_pool.started || NULL == cb) {
+		return -1;
+	}
+	if (NULL == (job = malloc(sizeof (digest_verify_job_s)))) {
+		return -1;
+	}
+	job->digest = digest;
+	job->cb = cb;
+	job->userdata = userdata;
+	job->next = NULL;
+
+	q = &_pool.queues[__atomic_fetch_add(&_pool.next_queue, 1, __ATOMIC_RELAXED) % _pool.n_workers];
+	pthread_mutex_lock(&q->lock);
+	if (NULL == q->tail) {
+		q->head = job;
+	} else {
+		q->tail->next = job;
+	}
+	q->tail = job;
+	__atomic_fetch_add(&q->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_pool.pending, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&q->lock);
+
+	/* Only wake a worker if one is asleep */
+	if (0 < __atomic_load_n(&_pool.n_idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&_pool.idle_lock);
+		pthread_cond_signal(&_pool.idle_cond);
+		pthread_mutex_unlock(&_pool.idle_lock);
+	}
+
+	return 0;
+}
+
+int
+digest_verify_complete(void)
+{
+	digest_verify_job_s *jobs, *job, *prev = NULL, *next;
+	uint64_t value;
+	int n = 0;
+
+	if (!_pool.started) {
+		return 0;
+	}
+
+	/* Reset the eventfd before taking the jobs, so none are missed */
+	while (-1 == read(_pool.event_fd, &value, sizeof (value)) && EINTR == errno) {
+		/* Retry */
+	}
+
+	jobs = __atomic_exchange_n(&_pool.done, NULL, __ATOMIC_ACQUIRE);
+
+	/* Reverse, so callbacks run in the order the batches finished */
+	for (job = jobs; NULL != job; job = next) {
+		next = job->next;
+		job->next = prev;
+		prev = job;
+	}
+
+	for (job = prev; NULL != job; job = next) {
+		next = job->next;
+		job->cb(job->digest, job->result, job->userdata);
+		free(job);
+		n++;
+	}
+
+	return n;
+}
+
+void
+digest_verify_pool_stop(void)
+{
+	int i;
+
+	if (!_pool.started) {
+		return;
+	}
+
+	pthread_mutex_lock(&_pool.idle_lock);
+	_pool.stopping = 1;
+	pthread_cond_broadcast(&_pool.idle_cond);
+	pthread_mutex_unlock(&_pool.idle_lock);
+
+	for (i = 0; i < _pool.n_started; ++i) {
+		pthread_join(_pool.workers[i], NULL);
+	}
+
+	digest_verify_complete();
+
+	for (i = 0; i < _pool.n_workers; ++i) {
+		pthread_mutex_destroy(&_pool.queues[i].lock);
+	}
+	pthread_mutex_destroy(&_pool.idle_lock);
+	pthread_cond_destroy(&_pool.idle_cond);
+	free(_pool.queues);
+	free(_pool.workers);
+	close(_pool.event_fd);
+	memset(&_pool, 0, sizeof (_pool));
+}
@@ -0,0 +1,95 @@
+#ifndef INC_DIGEST_VERIFY_H
+#define INC_DIGEST_VERIFY_H
+#include "digest.h"
+
+/*
+ * Asynchronous verification.
+ *
+ * Verification is offloaded to a library-managed pool of worker threads,
+ * so event-loop threads do not stall on credential lookups and hashing.
+ * Each worker has its own queue and steals from the others when it runs
+ * dry. Workers take jobs in batches and signal finished batches on an
+ * eventfd, which the event loop polls for reading and then calls
+ * digest_verify_complete() to run the callbacks on its own thread.
+ */
+
+/* Number of jobs a worker takes from a queue at once */
+#define DIGEST_VERIFY_BATCH	16
+
+/**
+ * Looks up the HA1 of a user, as 32 hex characters plus a null byte.
+ *
+ * Called from worker threads. Returns 0 if found, otherwise -1.
+ */
+typedef int (*digest_lookup_fn)(void *arg, const char *username, const char *realm, char *ha1);
+
+/**
+ * Called on the event-loop thread with the result of a verification, 0 if
+ * the response was correct, otherwise -1.
+ */
+typedef void (*digest_verify_cb)(digest_t *digest, int result, void *userdata);
+
+/**
+ * Start the verification pool.
+ *
+ * @param int n_threads Number of worker threads, 0 for one per online CPU.
+ * @param digest_lookup_fn lookup Function to look up the HA1 of a user.
+ * @param void *lookup_arg First argument to lookup.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_verify_pool_start(int n_threads, digest_lookup_fn lookup, void *lookup_arg);
+
+/**
+ * Set the function to look up users of headers sent with userhash=true.
+ *
+ * It is called like lookup, with H(username:realm) as the username, for
+ * example through digest_credstore_lookup_userhash(). Without it, such
+ * headers fail. Call after digest_verify_pool_start(), before submitting.
+ *
+ * @param digest_lookup_fn lookup Function to look up the HA1 of a user by
+ *        userhash, NULL to fail userhash headers.
+ *
+ * @returns int 0 on success, -1 if the pool is not started.
+ */
+extern int digest_verify_pool_lookup_userhash(digest_lookup_fn lookup);
+
+/**
+ * Get the eventfd that becomes readable when verifications are done.
+ *
+ * @returns int The file descriptor, -1 if the pool is not started.
+ */
+extern int digest_verify_pool_fd(void);
+
+/**
+ * Submit a parsed Authorization header for verification.
+ *
+ * The method must be set on the context. The context must stay valid and
+ * unchanged until the callback has run.
+ *
+ * @param digest_t *digest The parsed digest context.
+ * @param digest_verify_cb cb Function to call with the result.
+ * @param void *userdata Passed to cb.
+ *
+ * @returns int 0 on success, otherwise -1.
+ */
+extern int digest_verify_submit(digest_t *digest, digest_verify_cb cb, void *userdata);
+
+/**
+ * Run the callbacks of finished verifications.
+ *
+ * Call from the event-loop thread when the eventfd is readable.
+ *
+ * @returns int The number of callbacks run.
+ */
+extern int digest_verify_complete(void);
+
+/**
+ * Stop the verification pool.
+ *
+ * Verifications already submitted are finished and their callbacks are run
+ * on the calling thread.
+ */
+extern void digest_verify_pool_stop(void);
+
+#endif  /* INC_DIGEST_VERIFY_H */
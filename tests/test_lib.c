@@ -1,11 +1,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <poll.h>
 
 #include <digest.h>
 #include <digest/client.h>
+#include <digest/server.h>
+#include <digest/credidx.h>
+#include <digest/credtab.h>
+#include <digest/throttle.h>
+#include <digest/verify.h>
+#include <digest/ha2cache.h>
+#include <digest/authcache.h>
+#include <digest/compact.h>
+#include <digest/nonce.h>
+#include <digest/realm.h>
+#include <digest/snapshot.h>
+#include <digest/capture.h>
+#include <digest/noncepolicy.h>
 #include "minunit.h"
 
+#define ARRAY_SIZE(a) (sizeof a / sizeof (a[0]))
+
 int tests_run = 0;
 
 static unsigned char *
@@ -16,6 +36,7 @@ test_digest_create_ok()
 	digest_s *dig;
 	char digest_str[] = "Digest realm=\"test\", qop=\"auth-int,auth\", nonce=\"9e9cb182c25b68148676a98cda86d501\" opaque=\"9bc51272c609b6b6bb3547fac2102e78\"";
 
+	digest_init(&d);
 	rc = digest_client_parse(&d, digest_str);
 	mu_assert("should be able to create a new digest object", -1 != rc);
 
@@ -28,12 +49,937 @@ test_digest_create_ok()
 	return 0;
 }
 
+static unsigned char *
+test_server_verify()
+{
+	digest_t client, server;
+	char header[1024];
+	char ha1[] = "1d860790e2e0921f2c576a503a40b2a0"; /* jack:test:Passw0rd */
+	char challenge[] = "Digest realm=\"test\", qop=\"auth\", nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\"";
+	char curl_style[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\", opaque=\"5ccc069c403ebaf9f0171e9517f40e41\"";
+
+	digest_init(&client);
+	digest_client_parse(&client, challenge);
+	digest_set_attr(&client, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&client, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&client, D_ATTR_URI, (digest_attr_value_t) "/api/resource");
+	digest_set_attr(&client, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_POST);
+	mu_assert("should generate an Authorization header", -1 != (int) digest_client_generate_header(&client, header, sizeof (header)));
+
+	digest_init(&server);
+	digest_server_parse(&server, header);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_POST);
+	mu_assert("should parse the username", 0 == strcmp(server.username, "jack"));
+	mu_assert("should verify a correct response", 0 == digest_server_verify(&server, ha1));
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	mu_assert("should reject a response for another method", -1 == digest_server_verify(&server, ha1));
+
+	/* The example from rfc2617, password "Circle Of Life" */
+	digest_init(&server);
+	digest_server_parse(&server, curl_style);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	mu_assert("should verify the rfc2617 example", 0 == digest_server_verify(&server, "939e7578ed9e3c518a452acee763bce9"));
+
+	return 0;
+}
+
+static unsigned char *
+test_server_generate_header()
+{
+	digest_t server, client, d;
+	char challenge[512], header[1024];
+
+	digest_init(&server);
+	digest_set_attr(&server, D_ATTR_REALM, (digest_attr_value_t) "test");
+	digest_set_attr(&server, D_ATTR_NONCE, (digest_attr_value_t) "9e9cb182c25b68148676a98cda86d501");
+	digest_set_attr(&server, D_ATTR_QOP, (digest_attr_value_t) DIGEST_QOP_AUTH);
+	mu_assert("should generate a challenge", -1 != (int) digest_server_generate_header(&server, challenge, sizeof (challenge)));
+	mu_assert("should generate the challenge parameters", 0 == strcmp(challenge,
+	    "Digest realm=\"test\", nonce=\"9e9cb182c25b68148676a98cda86d501\", algorithm=\"MD5\", qop=\"auth\""));
+
+	digest_init(&client);
+	digest_client_parse(&client, challenge);
+	digest_set_attr(&client, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&client, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&client, D_ATTR_URI, (digest_attr_value_t) "/");
+	digest_set_attr(&client, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_client_generate_header(&client, header, sizeof (header));
+
+	digest_init(&d);
+	digest_server_parse_in_place(&d, header);
+	digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	mu_assert("should verify a response to the challenge", 0 == digest_server_verify(&d, "1d860790e2e0921f2c576a503a40b2a0"));
+	return 0;
+}
+
+static unsigned char *
+test_challenge_template()
+{
+	digest_t server;
+	digest_challenge_t ch;
+	char header[1024], expected[1024];
+
+	digest_init(&server);
+	digest_set_attr(&server, D_ATTR_REALM, (digest_attr_value_t) "test");
+	digest_set_attr(&server, D_ATTR_OPAQUE, (digest_attr_value_t) "5ccc069c403ebaf9f0171e9517f40e41");
+	digest_set_attr(&server, D_ATTR_QOP, (digest_attr_value_t) DIGEST_QOP_AUTH);
+	mu_assert("should pre-render a challenge", 0 == digest_challenge_init(&ch, &server, 32));
+
+	digest_set_attr(&server, D_ATTR_NONCE, (digest_attr_value_t) "9e9cb182c25b68148676a98cda86d501");
+	digest_server_generate_header(&server, expected, sizeof (expected));
+	mu_assert("should render the same as generating", -1 != (int) digest_challenge_render(&ch, "9e9cb182c25b68148676a98cda86d501", 0, header, sizeof (header))
+	    && 0 == strcmp(header, expected));
+
+	digest_set_attr(&server, D_ATTR_STALE, (digest_attr_value_t) 1);
+	digest_server_generate_header(&server, expected, sizeof (expected));
+	digest_challenge_render(&ch, "9e9cb182c25b68148676a98cda86d501", 1, header, sizeof (header));
+	mu_assert("should render stale challenges", 0 == strcmp(header, expected));
+
+	mu_assert("should refuse nonces of another length", -1 == (int) digest_challenge_render(&ch, "9e9cb182", 0, header, sizeof (header)));
+	return 0;
+}
+
+static unsigned char *
+test_auth_info()
+{
+	digest_t client, server;
+	char header[1024], info[512];
+	char ha1[] = "1d860790e2e0921f2c576a503a40b2a0"; /* jack:test:Passw0rd */
+	char challenge[] = "Digest realm=\"test\", qop=\"auth\", nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\"";
+
+	digest_init(&client);
+	digest_client_parse(&client, challenge);
+	digest_set_attr(&client, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&client, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&client, D_ATTR_URI, (digest_attr_value_t) "/api/resource");
+	digest_set_attr(&client, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_client_generate_header(&client, header, sizeof (header));
+
+	digest_init(&server);
+	digest_server_parse(&server, header);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	mu_assert("should generate Authentication-Info for a correct response",
+	    -1 != (int) digest_server_verify_auth_info(&server, ha1, "0011223344556677", info, sizeof (info)));
+	mu_assert("should not generate Authentication-Info for a wrong response",
+	    -1 == (int) digest_server_verify_auth_info(&server, "00000000000000000000000000000000", NULL, header, sizeof (header)));
+
+	mu_assert("should accept the rspauth of the server", 0 == digest_client_parse_auth_info(&client, info));
+	memset(info, 'x', sizeof (info) - 1);
+	mu_assert("should adopt nextnonce into the context", 0 == strcmp(client.nonce, "0011223344556677") && 1 == client.nc
+	    && client.nonce == client.nonce_buffer);
+
+	mu_assert("should reject a wrong rspauth", -1 == digest_client_parse_auth_info(&client, "rspauth=\"00000000000000000000000000000000\", qop=auth, nc=00000001"));
+	mu_assert("should count up nc without nextnonce", 0 == digest_client_parse_auth_info(&client, "qop=auth") && 2 == client.nc);
+
+	return 0;
+}
+
+static unsigned char *
+test_verify_resume()
+{
+	digest_verify_t v;
+	const char *username, *realm;
+	char header[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+	char copy[sizeof (header)], long_header[DIGEST_VERIFY_HEADER_MAX + 2];
+
+	strcpy(copy, header);
+	mu_assert("should wait for the credential", DIGEST_VERIFY_NEED_CREDENTIAL == digest_verify_start(&v, header, DIGEST_METHOD_GET));
+	mu_assert("should tell which credential", 0 == digest_verify_key(&v, &username, &realm)
+	    && 0 == strcmp(username, "Mufasa") && 0 == strcmp(realm, "testrealm@host.com"));
+	mu_assert("should finish with the HA1", DIGEST_VERIFY_OK == digest_verify_resume(&v, "939e7578ed9e3c518a452acee763bce9"));
+	mu_assert("should only finish once", DIGEST_VERIFY_FAILED == digest_verify_resume(&v, "939e7578ed9e3c518a452acee763bce9"));
+
+	digest_verify_start(&v, header, DIGEST_METHOD_GET);
+	mu_assert("should fail for an unknown user", DIGEST_VERIFY_FAILED == digest_verify_resume(&v, NULL));
+	mu_assert("should fail without a response", DIGEST_VERIFY_FAILED == digest_verify_start(&v, "Digest username=\"Mufasa\"", DIGEST_METHOD_GET));
+	mu_assert("should fail without parameters", DIGEST_VERIFY_FAILED == digest_verify_start(&v, "Digest", DIGEST_METHOD_GET));
+
+	/* The context keeps its own copy */
+	mu_assert("should wait again", DIGEST_VERIFY_NEED_CREDENTIAL == digest_verify_start(&v, copy, DIGEST_METHOD_GET));
+	memset(copy, 'x', strlen(copy));
+	mu_assert("should not point into the header", v.digest.username >= v.header && v.digest.username < v.header + sizeof (v.header));
+	mu_assert("should finish after the header is gone", DIGEST_VERIFY_OK == digest_verify_resume(&v, "939e7578ed9e3c518a452acee763bce9"));
+
+	memset(long_header, 'a', sizeof (long_header) - 1);
+	memcpy(long_header, "Digest ", 7);
+	long_header[sizeof (long_header) - 1] = '\0';
+	mu_assert("should fail for a header too long", DIGEST_VERIFY_FAILED == digest_verify_start(&v, long_header, DIGEST_METHOD_GET));
+
+	return 0;
+}
+
+static int
+_test_lookup(void *arg, const char *username, const char *realm, char *ha1)
+{
+	if (0 != strcmp(username, "Mufasa")) {
+		return -1;
+	}
+
+	strcpy(ha1, "939e7578ed9e3c518a452acee763bce9");
+	return 0;
+}
+
+static void
+_test_verify_cb(digest_t *digest, int result, void *userdata)
+{
+	int *counts = (int *) userdata;
+
+	counts[0 == result ? 0 : 1]++;
+}
+
+/**
+ * Runs callbacks until n verifications are done.
+ */
+static void
+_test_verify_wait(int *counts, int n)
+{
+	struct pollfd pfd;
+
+	pfd.fd = digest_verify_pool_fd();
+	pfd.events = POLLIN;
+	while (n > counts[0] + counts[1] && 0 < poll(&pfd, 1, 5000)) {
+		digest_verify_complete();
+	}
+}
+
+static int
+_test_lookup_userhash(void *arg, const char *userhash, const char *realm, char *ha1)
+{
+	return digest_credstore_lookup_userhash((digest_credstore_t *) arg, userhash, realm, NULL, 0, ha1);
+}
+
+static unsigned char *
+test_verify_pool()
+{
+	digest_t digests[200];
+	int counts[2] = { 0, 0 };
+	int i;
+	char good[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+	char bad[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000002, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+
+	mu_assert("should start the verification pool", 0 == digest_verify_pool_start(4, _test_lookup, NULL));
+
+	for (i = 0; i < 200; ++i) {
+		digest_init(&digests[i]);
+		digest_server_parse(&digests[i], i % 2 ? bad : good);
+		digest_set_attr(&digests[i], D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+		digest_verify_submit(&digests[i], _test_verify_cb, counts);
+	}
+
+	_test_verify_wait(counts, 200);
+	mu_assert("should verify all submitted headers", 100 == counts[0] && 100 == counts[1]);
+
+	digest_verify_pool_stop();
+	return 0;
+}
+
+static unsigned char *
+test_ha2_cache()
+{
+	digest_t d;
+	char header[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+	int i, ok = 1;
+
+	mu_assert("should enable the HA2 cache", 0 == digest_ha2_cache_init(4096));
+
+	digest_init(&d);
+	digest_server_parse(&d, header);
+	for (i = 0; i < 3; ++i) {
+		digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+		ok &= 0 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9");
+		digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_POST);
+		ok &= -1 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9");
+	}
+	mu_assert("should verify the same with cached HA2 values", ok);
+
+	digest_ha2_cache_destroy();
+	return 0;
+}
+
+static unsigned char *
+test_midstate_cache()
+{
+	digest_t d;
+	char header[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+	int i, ok = 1;
+
+	mu_assert("should enable the midstate cache", 0 == digest_midstate_cache_init(4096));
+
+	digest_init(&d);
+	digest_server_parse(&d, header);
+	digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	for (i = 0; i < 3; ++i) {
+		ok &= 0 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9");
+		ok &= -1 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce8");
+	}
+	mu_assert("should verify the same with cached midstates", ok);
+
+	digest_set_attr(&d, D_ATTR_NONCE_COUNT, (digest_attr_value_t) 2);
+	mu_assert("should hash the rest after the cached block", -1 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9"));
+
+	digest_midstate_cache_destroy();
+	return 0;
+}
+
+static unsigned char *
+test_client_batch()
+{
+	digest_t d;
+	char challenge[] = "Digest realm=\"test\", qop=\"auth\", nonce=\"9e9cb182c25b68148676a98cda86d501\"";
+	const char *uris[] = { "/a", "/b", "/a" };
+	unsigned int methods[] = { DIGEST_METHOD_GET, DIGEST_METHOD_POST, DIGEST_METHOD_GET };
+	char arena[2048], header[1024];
+	size_t offsets[3], i, used, size;
+	int same = 1, fails = 1, untouched = 1;
+
+	digest_init(&d);
+	digest_client_parse(&d, challenge);
+	digest_set_attr(&d, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&d, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&d, D_ATTR_NONCE_COUNT, (digest_attr_value_t) 5);
+
+	mu_assert("should generate a batch", -1 != (int) (used = digest_client_generate_headers_batch(&d, methods, uris, 3, arena, sizeof (arena), offsets)));
+	mu_assert("should advance the nonce count", 8 == d.nc);
+
+	for (i = 0; i < 3; ++i) {
+		digest_set_attr(&d, D_ATTR_NONCE_COUNT, (digest_attr_value_t) (int) (5 + i));
+		digest_set_attr(&d, D_ATTR_URI, (digest_attr_value_t) uris[i]);
+		digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) (int) methods[i]);
+		digest_client_generate_header(&d, header, sizeof (header));
+		same &= 0 == strcmp(header, arena + offsets[i]);
+	}
+	mu_assert("should generate the same headers as one by one", same);
+
+	mu_assert("should fail if the arena is too small", -1 == (int) digest_client_generate_headers_batch(&d, methods, uris, 3, arena, 300, offsets));
+	mu_assert("should keep the nonce count on failure", 7 == d.nc);
+
+	/* Short by any number of bytes, nothing may be written past the arena */
+	for (size = 1; size < used; ++size) {
+		memset(arena, 'x', sizeof (arena));
+		fails &= -1 == (int) digest_client_generate_headers_batch(&d, methods, uris, 3, arena, size, offsets);
+		for (i = size; i < sizeof (arena); ++i) {
+			untouched &= 'x' == arena[i];
+		}
+	}
+	mu_assert("should fail for every arena too small", fails);
+	mu_assert("should not write past a short arena", untouched);
+	return 0;
+}
+
+static unsigned char *
+test_authcache()
+{
+	digest_t d, s;
+	digest_authcache_t cache;
+	char challenge[] = "Digest realm=\"test\", qop=\"auth\", domain=\"/api\", nonce=\"abc123\"";
+	char header[1024];
+
+	mu_assert("should init an authentication cache", 0 == digest_authcache_init(&cache, 4));
+
+	digest_init(&d);
+	digest_client_parse(&d, challenge);
+	digest_set_attr(&d, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&d, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&d, D_ATTR_URI, (digest_attr_value_t) "/api/a");
+	mu_assert("should cache a protection space", 0 == digest_authcache_put(&cache, "http://h", &d));
+
+	mu_assert("should not cover URIs outside of the domain",
+	    (size_t) -1 == digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/other", header, sizeof (header)));
+	mu_assert("should not cover other origins",
+	    (size_t) -1 == digest_authcache_generate(&cache, "http://g", DIGEST_METHOD_GET, "/api/b", header, sizeof (header)));
+
+	digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/api/b", header, sizeof (header));
+	mu_assert("should generate a header with the next nonce count",
+	    (size_t) -1 != digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/api/b", header, sizeof (header)));
+	digest_init(&s);
+	digest_server_parse(&s, header);
+	digest_set_attr(&s, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	mu_assert("should generate a valid preemptive header", 0 == digest_server_verify(&s, "1d860790e2e0921f2c576a503a40b2a0"));
+	mu_assert("should count nonces", 2 == *(unsigned int *) digest_get_attr(&s, D_ATTR_NONCE_COUNT));
+
+	mu_assert("should keep the space on a stale nonce",
+	    0 == digest_authcache_challenge(&cache, "http://h", "Digest realm=\"test\", qop=\"auth\", nonce=\"def456\", stale=true"));
+	digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/x", header, sizeof (header));
+	digest_init(&s);
+	digest_server_parse(&s, header);
+	mu_assert("should adopt the new nonce", 0 == strcmp("def456", (char *) digest_get_attr(&s, D_ATTR_NONCE)));
+	mu_assert("should reset the nonce count", 1 == *(unsigned int *) digest_get_attr(&s, D_ATTR_NONCE_COUNT));
+
+	mu_assert("should evict the space on a new challenge",
+	    -1 == digest_authcache_challenge(&cache, "http://h", "Digest realm=\"test\", nonce=\"ghi789\""));
+	mu_assert("should not generate after eviction",
+	    (size_t) -1 == digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/api/b", header, sizeof (header)));
+
+	digest_authcache_destroy(&cache);
+	return 0;
+}
+
+static unsigned char *
+test_compact()
+{
+	digest_t d, u;
+	digest_compact_t c;
+	char buffer[DIGEST_COMPACT_BUFFER_SIZE];
+	char challenge[] = "Digest realm=\"test\", qop=\"auth\", nonce=\"9e9cb182c25b68148676a98cda86d501\", opaque=\"9bc5\"";
+
+	mu_assert("should fit in a cache line", 64 == sizeof (digest_compact_t));
+
+	digest_init(&d);
+	digest_client_parse(&d, challenge);
+	digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_PUT);
+	mu_assert("should pack a digest context", 0 == digest_compact_pack(&c, &d));
+
+	digest_compact_unpack(&c, &u, buffer);
+	mu_assert("should unpack the nonce", 0 == strcmp("9e9cb182c25b68148676a98cda86d501", (char *) digest_get_attr(&u, D_ATTR_NONCE)));
+	mu_assert("should unpack the opaque", 0 == strcmp("9bc5", (char *) digest_get_attr(&u, D_ATTR_OPAQUE)));
+	mu_assert("should keep the realm", 0 == strcmp("test", (char *) digest_get_attr(&u, D_ATTR_REALM)));
+	mu_assert("should unpack the packed attributes", DIGEST_QOP_AUTH == u.qop && DIGEST_METHOD_PUT == u.method
+	    && DIGEST_ALGORITHM_MD5 == u.algorithm && d.cnonce == u.cnonce && 1 == u.nc);
+
+	mu_assert("should match the nonce", 0 == digest_compact_nonce_cmp(&c, "9e9cb182c25b68148676a98cda86d501"));
+	mu_assert("should not match another nonce", -1 == digest_compact_nonce_cmp(&c, "9e9cb182c25b68148676a98cda86d50"));
+
+	digest_set_attr(&d, D_ATTR_NONCE, (digest_attr_value_t) "not-hex");
+	mu_assert("should refuse nonces that are not hex", -1 == digest_compact_pack(&c, &d));
+	return 0;
+}
+
+static unsigned char *
+test_nonce()
+{
+	digest_t d;
+	digest_compact_t c;
+	char nonce[DIGEST_NONCE_LENGTH + 1], previous[DIGEST_NONCE_LENGTH + 1];
+	int i, ok = 1;
+
+	mu_assert("should generate a nonce inline", 0 == digest_nonce_generate(nonce) && DIGEST_NONCE_LENGTH == strlen(nonce));
+	mu_assert("should accept its own nonce", DIGEST_NONCE_VALID == digest_nonce_check(nonce, 60));
+
+	nonce[DIGEST_NONCE_LENGTH - 1] = '0' == nonce[DIGEST_NONCE_LENGTH - 1] ? '1' : '0';
+	mu_assert("should reject a tampered nonce", DIGEST_NONCE_INVALID == digest_nonce_check(nonce, 60));
+	mu_assert("should reject a foreign nonce", DIGEST_NONCE_INVALID == digest_nonce_check("9e9cb182c25b68148676a98cda86d501", 0));
+
+	mu_assert("should start the supply", 0 == digest_nonce_start(64, 2, "s3cret", 6));
+	usleep(20000);
+	for (i = 0; i < 300; ++i) {
+		strcpy(previous, nonce);
+		if (0 != digest_nonce_generate(nonce) || 0 == strcmp(nonce, previous)
+		    || DIGEST_NONCE_VALID != digest_nonce_check(nonce, 60)) {
+			ok = 0;
+		}
+	}
+	mu_assert("should hand out distinct valid nonces", ok);
+
+	digest_init(&d);
+	mu_assert("should generate the nonce of a context", 0 == digest_server_generate_nonce(&d));
+	mu_assert("should fit a compact context", 0 == digest_compact_pack(&c, &d));
+	digest_nonce_stop();
+
+	mu_assert("should check nonces after stopping", DIGEST_NONCE_VALID == digest_nonce_check(d.nonce, 60));
+	return 0;
+}
+
+static unsigned char *
+test_nonce_policy()
+{
+	digest_nonce_policy_t p;
+	digest_nonce_policy_config_t config = { 60, 10, 240, 100, 10, 400, 10, 1000, 1 };
+	digest_nonce_policy_metrics_t m;
+	char nonce[DIGEST_NONCE_LENGTH + 1];
+	time_t t;
+	int i;
+
+	config.min_lifetime = 90;
+	mu_assert("should refuse a lifetime below its minimum", -1 == digest_nonce_policy_init(&p, &config));
+	config.min_lifetime = 10;
+	mu_assert("should init a policy", 0 == digest_nonce_policy_init(&p, &config));
+
+	/* Decide at explicit times, after the clock */
+	t = time(NULL) + 1000;
+	digest_nonce_policy_update(&p, t);
+	digest_nonce_generate(nonce);
+	mu_assert("should accept a fresh nonce", DIGEST_NONCE_VALID == digest_nonce_policy_check(&p, nonce, 100));
+	mu_assert("should refuse a nonce used too often", DIGEST_NONCE_STALE == digest_nonce_policy_check(&p, nonce, 101));
+	for (i = 0; i < 48; ++i) {
+		digest_nonce_policy_check(&p, nonce, 1);
+	}
+
+	digest_nonce_policy_update(&p, t + 1);
+	digest_nonce_policy_metrics(&p, &m);
+	mu_assert("should extend reuse under overload", DIGEST_NONCE_POLICY_EXTEND == m.decision && 500 == m.load
+	    && 120 == m.lifetime && 200 == m.nc_limit && 1 == m.extended);
+	mu_assert("should accept more requests per nonce", DIGEST_NONCE_VALID == digest_nonce_policy_check(&p, nonce, 101));
+
+	digest_nonce_policy_set_tracker(&p, 950);
+	digest_nonce_policy_update(&p, t + 2);
+	digest_nonce_policy_update(&p, t + 3);
+	digest_nonce_policy_metrics(&p, &m);
+	mu_assert("should shorten lifetimes under memory pressure", DIGEST_NONCE_POLICY_SHORTEN == m.decision
+	    && 95 == m.pressure && 30 == m.lifetime && 50 == m.nc_limit && 2 == m.shortened);
+
+	digest_nonce_policy_set_tracker(&p, 100);
+	digest_nonce_policy_update(&p, t + 4);
+	mu_assert("should move back toward the base", 45 == digest_nonce_policy_lifetime(&p) && 75 == digest_nonce_policy_nc_limit(&p));
+	for (i = 5; i < 12; ++i) {
+		digest_nonce_policy_update(&p, t + i);
+	}
+	mu_assert("should return to the base", 60 == digest_nonce_policy_lifetime(&p) && 100 == digest_nonce_policy_nc_limit(&p));
+
+	digest_nonce_policy_update(&p, t + 11);
+	digest_nonce_policy_metrics(&p, &m);
+	mu_assert("should decide once per interval", 9 == m.relaxed);
+	mu_assert("should count stale nonces", 1 == m.stale_nc && 0 == m.stale_lifetime && 51 == m.requests);
+	mu_assert("should refuse a foreign nonce", DIGEST_NONCE_INVALID == digest_nonce_policy_check(&p, "9e9cb182c25b68148676a98cda86d501", 1));
+	return 0;
+}
+
+static unsigned char *
+test_realm_registry()
+{
+	digest_realm_registry_t registry;
+	digest_realm_config_t config = { "a.example.com", "test", NULL, DIGEST_ALGORITHM_MD5, DIGEST_QOP_AUTH, 300, "/tmp/test_lib_realm" };
+	digest_realm_t *r;
+	digest_t client, server;
+	char challenge[DIGEST_CHALLENGE_MAX], header[1024];
+	FILE *fp;
+
+	fp = fopen(config.htdigest, "w");
+	fprintf(fp, "jack:test:1d860790e2e0921f2c576a503a40b2a0\n");
+	fclose(fp);
+
+	mu_assert("should init a registry", 0 == digest_realm_registry_init(&registry, 4));
+	mu_assert("should add a realm of a host", NULL != digest_realm_add(&registry, &config));
+	mu_assert("should refuse a realm twice", NULL == digest_realm_add(&registry, &config));
+	config.host = NULL;
+	config.realm = "other";
+	config.opaque = "5ccc";
+	config.htdigest = NULL;
+	mu_assert("should add a realm of any host", NULL != digest_realm_add(&registry, &config));
+
+	mu_assert("should find the default realm of a host", NULL != (r = digest_realm_lookup(&registry, "a.example.com", NULL))
+	    && 0 == strcmp("test", r->realm));
+	mu_assert("should fall back to realms of any host", NULL != (r = digest_realm_lookup(&registry, "b.example.com", NULL))
+	    && 0 == strcmp("other", r->realm) && NULL != digest_realm_lookup(&registry, "a.example.com", "other"));
+	mu_assert("should not find a realm of another host", NULL == digest_realm_lookup(&registry, "b.example.com", "test"));
+
+	r = digest_realm_lookup(&registry, "a.example.com", NULL);
+	mu_assert("should generate a challenge", -1 != (int) digest_realm_challenge(r, 0, challenge, sizeof (challenge)));
+
+	digest_init(&client);
+	digest_client_parse(&client, challenge);
+	digest_set_attr(&client, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&client, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&client, D_ATTR_URI, (digest_attr_value_t) "/");
+	digest_set_attr(&client, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_client_generate_header(&client, header, sizeof (header));
+
+	digest_init(&server);
+	digest_server_parse_in_place(&server, header);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	r = digest_realm_lookup(&registry, "a.example.com", server.realm);
+	mu_assert("should authenticate against the realm", NULL != r && DIGEST_REALM_OK == digest_realm_authenticate(r, &server));
+	mu_assert("should reject the header in another realm", DIGEST_REALM_FAILED
+	    == digest_realm_authenticate(digest_realm_lookup(&registry, NULL, "other"), &server));
+	server.nonce = "9e9cb182c25b68148676a98cda86d501";
+	mu_assert("should reject a nonce it did not issue", DIGEST_REALM_FAILED == digest_realm_authenticate(r, &server));
+
+	digest_realm_registry_destroy(&registry);
+	return 0;
+}
+
+static unsigned char *
+test_snapshot()
+{
+	digest_t d;
+	char header[] = "Digest username=\"Mufasa\", realm=\"testrealm@host.com\", "
+	    "nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", uri=\"/dir/index.html\", qop=auth, nc=00000001, "
+	    "cnonce=\"0a4f113b\", response=\"6629fae49393a05397450978507c4ef1\"";
+	char path[] = "/tmp/test_lib_snapshot", nonce[DIGEST_NONCE_LENGTH + 1];
+	FILE *fp;
+	long size;
+	int byte;
+
+	digest_ha2_cache_init(4096);
+	digest_midstate_cache_init(4096);
+	digest_init(&d);
+	digest_server_parse(&d, header);
+	digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9");
+	digest_nonce_generate(nonce);
+	mu_assert("should fill the caches", 1 == digest_ha2_cache_entries() && 1 == digest_midstate_cache_entries());
+
+	mu_assert("should save a snapshot", 0 == digest_snapshot_save(path));
+	digest_ha2_cache_destroy();
+	digest_midstate_cache_destroy();
+
+	/* Start over empty, with another secret */
+	digest_ha2_cache_init(4096);
+	digest_midstate_cache_init(4096);
+	digest_nonce_stop();
+	digest_nonce_start(1, 0, "another secret", 14);
+	mu_assert("should start empty", 0 == digest_ha2_cache_entries() && 0 == digest_midstate_cache_entries());
+	mu_assert("should not take nonces of another secret", DIGEST_NONCE_INVALID == digest_nonce_check(nonce, 60));
+
+	mu_assert("should load a snapshot", 0 == digest_snapshot_load(path));
+	mu_assert("should restore cache entries", 1 == digest_ha2_cache_entries() && 1 == digest_midstate_cache_entries());
+	mu_assert("should restore the nonce secret", DIGEST_NONCE_VALID == digest_nonce_check(nonce, 60));
+	mu_assert("should verify with restored cache entries", 0 == digest_server_verify(&d, "939e7578ed9e3c518a452acee763bce9"));
+	mu_assert("should not add entries when hitting", 1 == digest_ha2_cache_entries() && 1 == digest_midstate_cache_entries());
+
+	/* Flip a bit of the secret in the header, after magic and five counters */
+	digest_ha2_cache_destroy();
+	digest_midstate_cache_destroy();
+	digest_ha2_cache_init(4096);
+	digest_midstate_cache_init(4096);
+	digest_nonce_stop();
+	digest_nonce_start(1, 0, "another secret", 14);
+	fp = fopen(path, "r+");
+	fseek(fp, 28, SEEK_SET);
+	byte = fgetc(fp);
+	fseek(fp, 28, SEEK_SET);
+	fputc(byte ^ 1, fp);
+	fclose(fp);
+	mu_assert("should refuse a snapshot with a corrupt header", -1 == digest_snapshot_load(path));
+	mu_assert("should not adopt a corrupt secret", DIGEST_NONCE_INVALID == digest_nonce_check(nonce, 60));
+	mu_assert("should not adopt entries of a corrupt snapshot", 0 == digest_ha2_cache_entries() && 0 == digest_midstate_cache_entries());
+
+	fp = fopen(path, "r+");
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, size - 1, SEEK_SET);
+	fputc('x', fp);
+	fclose(fp);
+	mu_assert("should refuse a corrupt snapshot", -1 == digest_snapshot_load(path));
+	truncate(path, size - 1);
+	mu_assert("should refuse a truncated snapshot", -1 == digest_snapshot_load(path));
+	mu_assert("should refuse a missing snapshot", -1 == digest_snapshot_load("/tmp/test_lib_no_snapshot"));
+
+	digest_nonce_stop();
+	digest_ha2_cache_destroy();
+	digest_midstate_cache_destroy();
+	return 0;
+}
+
+static unsigned char *
+test_capture()
+{
+	digest_capture_t capture;
+	digest_replay_t replay;
+	digest_replay_record_t record;
+	char path[] = "/tmp/test_lib_capture";
+	char challenge[] = "Digest realm=\"test\", nonce=\"dcd98b7102dd2f0e8b11d0f600bfb0c093\", qop=\"auth\"";
+	char authorization[] = "Digest username=\"jack\", realm=\"test\", uri=\"/\", response=\"6629fae49393a05397450978507c4ef1\"";
+	struct stat st;
+
+	mu_assert("should create a capture", 0 == digest_capture_open(&capture, path));
+	mu_assert("should add a challenge", 0 == digest_capture_add(&capture, DIGEST_CAPTURE_CHALLENGE, DIGEST_METHOD_GET, challenge));
+	mu_assert("should add an authorization", 0 == digest_capture_add(&capture, DIGEST_CAPTURE_AUTHORIZATION, DIGEST_METHOD_POST, authorization));
+	mu_assert("should refuse unknown kinds", -1 == digest_capture_add(&capture, 3, DIGEST_METHOD_GET, challenge));
+	mu_assert("should close a capture", 0 == digest_capture_close(&capture));
+
+	mu_assert("should open a capture", 0 == digest_replay_open(&replay, path));
+	mu_assert("should read the challenge", 0 == digest_replay_next(&replay, &record)
+	    && DIGEST_CAPTURE_CHALLENGE == record.kind && DIGEST_METHOD_GET == record.method
+	    && strlen(challenge) == record.length && 0 == strcmp(challenge, record.value));
+	mu_assert("should read the authorization", 0 == digest_replay_next(&replay, &record)
+	    && DIGEST_CAPTURE_AUTHORIZATION == record.kind && DIGEST_METHOD_POST == record.method
+	    && 0 == strcmp(authorization, record.value));
+	mu_assert("should end after the last record", -1 == digest_replay_next(&replay, &record));
+	digest_replay_rewind(&replay);
+	mu_assert("should rewind", 0 == digest_replay_next(&replay, &record) && DIGEST_CAPTURE_CHALLENGE == record.kind);
+	digest_replay_close(&replay);
+
+	stat(path, &st);
+	truncate(path, st.st_size - 1);
+	digest_replay_open(&replay, path);
+	digest_replay_next(&replay, &record);
+	mu_assert("should end at the last complete record", -1 == digest_replay_next(&replay, &record));
+	digest_replay_close(&replay);
+
+	mu_assert("should refuse other files", -1 == digest_replay_open(&replay, "/dev/null"));
+	return 0;
+}
+
+static unsigned char *
+test_userhash()
+{
+	digest_t client, server, unpacked;
+	digest_credstore_t store;
+	digest_compact_t compact;
+	digest_authcache_t cache;
+	char challenge[512], header[1024], username[64], ha1[33], buffer[DIGEST_COMPACT_BUFFER_SIZE];
+	char path[] = "/tmp/test_lib_userhash";
+	int counts[2] = { 0, 0 };
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	fprintf(fp, "joe:test:00000000000000000000000000000000\n");
+	fprintf(fp, "jack:test:1d860790e2e0921f2c576a503a40b2a0\n");
+	fclose(fp);
+
+	digest_init(&server);
+	digest_set_attr(&server, D_ATTR_REALM, (digest_attr_value_t) "test");
+	digest_set_attr(&server, D_ATTR_NONCE, (digest_attr_value_t) "dcd98b7102dd2f0e8b11d0f600bfb0c093");
+	digest_set_attr(&server, D_ATTR_QOP, (digest_attr_value_t) DIGEST_QOP_AUTH);
+	digest_set_attr(&server, D_ATTR_USERHASH, (digest_attr_value_t) 1);
+	digest_server_generate_header(&server, challenge, sizeof (challenge));
+	mu_assert("should ask for a userhash", NULL != strstr(challenge, ", userhash=true"));
+
+	digest_init(&client);
+	digest_client_parse(&client, challenge);
+	mu_assert("should parse userhash", 1 == client.userhash);
+	digest_set_attr(&client, D_ATTR_USERNAME, (digest_attr_value_t) "jack");
+	digest_set_attr(&client, D_ATTR_PASSWORD, (digest_attr_value_t) "Passw0rd");
+	digest_set_attr(&client, D_ATTR_URI, (digest_attr_value_t) "/");
+	digest_set_attr(&client, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_client_generate_header(&client, header, sizeof (header));
+	mu_assert("should not send the username", NULL == strstr(header, "jack") && NULL != strstr(header, ", userhash=true"));
+
+	digest_init(&server);
+	digest_server_parse_in_place(&server, header);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+
+	digest_credstore_init(&store, 1);
+	digest_credstore_index_userhash(&store);
+	digest_credstore_load(&store, path);
+	mu_assert("should find the user by userhash", 0 == digest_credstore_lookup_userhash(&store, server.username, "test", username, sizeof (username), ha1)
+	    && 0 == strcmp("jack", username));
+	mu_assert("should verify with the HA1 found", 0 == digest_server_verify(&server, ha1));
+	mu_assert("should not find the userhash in another realm", -1 == digest_credstore_lookup_userhash(&store, server.username, "other", NULL, 0, ha1));
+	mu_assert("should still find users by name", 0 == digest_credstore_lookup(&store, "joe", "test", ha1));
+
+	/* Packed and unpacked challenges keep asking for a userhash */
+	unpacked = client;
+	digest_set_attr(&unpacked, D_ATTR_NONCE, (digest_attr_value_t) "9e9cb182c25b68148676a98cda86d501");
+	mu_assert("should pack userhash", 0 == digest_compact_pack(&compact, &unpacked));
+	digest_compact_unpack(&compact, &unpacked, buffer);
+	mu_assert("should unpack userhash", 1 == unpacked.userhash);
+
+	/* Preemptive headers hash the username too */
+	digest_authcache_init(&cache, 4);
+	digest_authcache_put(&cache, "http://h", &client);
+	digest_authcache_generate(&cache, "http://h", DIGEST_METHOD_GET, "/", header, sizeof (header));
+	mu_assert("should not send the username preemptively", NULL == strstr(header, "jack") && NULL != strstr(header, ", userhash=true"));
+	digest_authcache_destroy(&cache);
+
+	/* The pool looks userhash headers up by userhash */
+	digest_init(&server);
+	digest_server_parse_in_place(&server, header);
+	digest_set_attr(&server, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+	digest_verify_pool_start(1, _test_lookup, &store);
+	digest_verify_submit(&server, _test_verify_cb, counts);
+	_test_verify_wait(counts, 1);
+	mu_assert("should fail userhash headers without a userhash lookup", 1 == counts[1]);
+	digest_verify_pool_lookup_userhash(_test_lookup_userhash);
+	digest_verify_submit(&server, _test_verify_cb, counts);
+	_test_verify_wait(counts, 2);
+	mu_assert("should verify userhash headers in the pool", 1 == counts[0]);
+	digest_verify_pool_stop();
+
+	digest_credstore_destroy(&store);
+	return 0;
+}
+
+static unsigned char *
+test_throttle()
+{
+	digest_throttle_t th;
+	int i;
+
+	mu_assert("should init a throttle", 0 == digest_throttle_init(&th, 1024, 100, 0.001, 3));
+	mu_assert("should pass anyone before users are added", DIGEST_THROTTLE_PASS == digest_throttle_check(&th, "joe", "10.0.0.1"));
+
+	digest_throttle_add_user(&th, "jack");
+	mu_assert("should reject unknown users", DIGEST_THROTTLE_UNKNOWN_USER == digest_throttle_check(&th, "joe", "10.0.0.1"));
+	mu_assert("should pass known users", DIGEST_THROTTLE_PASS == digest_throttle_check(&th, "jack", "10.0.0.1"));
+
+	digest_throttle_fail(&th, "jack", "10.0.0.1");
+	digest_throttle_fail(&th, "jack", "10.0.0.1");
+	mu_assert("should pass until the bucket is empty", DIGEST_THROTTLE_PASS == digest_throttle_check(&th, "jack", "10.0.0.1"));
+	digest_throttle_fail(&th, "jack", "10.0.0.1");
+	mu_assert("should limit after burst failures", DIGEST_THROTTLE_LIMITED == digest_throttle_check(&th, "jack", "10.0.0.1"));
+	mu_assert("should keep clients apart", DIGEST_THROTTLE_PASS == digest_throttle_check(&th, "jack", "10.0.0.2"));
+	digest_throttle_destroy(&th);
+
+	mu_assert("should refuse a rate of 0", -1 == digest_throttle_init(&th, 1024, 100, 0, 3));
+
+	/* One token in 20s, well below what 4 fractional bits per second hold */
+	mu_assert("should init a throttle below one token per second", 0 == digest_throttle_init(&th, 8, 100, 0.05, 1));
+	digest_throttle_fail(&th, "jack", "10.0.0.1");
+	mu_assert("should limit until a token is back", DIGEST_THROTTLE_LIMITED == digest_throttle_check(&th, "jack", "10.0.0.1"));
+	/* Age the bucket by 30s rather than waiting */
+	for (i = 0; i < DIGEST_THROTTLE_SET_SIZE; ++i) {
+		if (0 != th.buckets[i]) {
+			th.buckets[i] = (th.buckets[i] & ~0xffffffffULL) | (unsigned int) (th.buckets[i] - 30000);
+		}
+	}
+	mu_assert("should refill below one token per second", DIGEST_THROTTLE_PASS == digest_throttle_check(&th, "jack", "10.0.0.1"));
+	digest_throttle_destroy(&th);
+
+	return 0;
+}
+
+static unsigned char *
+test_credidx_build_lookup()
+{
+	digest_credidx_t idx;
+	char ha1[33];
+	char path[] = "/tmp/test_lib_credidx.bin";
+	unsigned int flags = 1, n_slots, i;
+	int fd;
+	digest_credential_t creds[] = {
+		{ "jack", "test", "939e7578ed9e3c518a452acee763bce9" },
+		{ "jill", "test", "5c4f1ec0c9ea1fb7d7f9f77a88e60a35" },
+		{ "jack", "other", "0123456789abcdef0123456789ABCDEF" }
+	};
+
+	mu_assert("should build a credential index", 0 == digest_credidx_build(path, creds, ARRAY_SIZE(creds)));
+	mu_assert("should open and verify the index", 0 == digest_credidx_open(&idx, path, DIGEST_CREDIDX_VERIFY));
+	mu_assert("should find a user", 0 == digest_credidx_lookup(&idx, "jill", "test", ha1)
+	    && 0 == strcmp(ha1, "5c4f1ec0c9ea1fb7d7f9f77a88e60a35"));
+	mu_assert("should tell realms apart", 0 == digest_credidx_lookup(&idx, "jack", "other", ha1)
+	    && 0 == strcmp(ha1, "0123456789abcdef0123456789abcdef"));
+	mu_assert("should not find an unknown user", -1 == digest_credidx_lookup(&idx, "joe", "test", ha1));
+	n_slots = idx.header->n_slots;
+	digest_credidx_close(&idx);
+
+	/* Mark every slot used, as a corrupt index could */
+	fd = open(path, O_RDWR);
+	for (i = 0; i < n_slots; ++i) {
+		pwrite(fd, &flags, sizeof (flags), sizeof (digest_credidx_header_s)
+		    + i * sizeof (digest_credidx_slot_s) + offsetof(digest_credidx_slot_s, flags));
+	}
+	close(fd);
+	mu_assert("should open a corrupt index without verification", 0 == digest_credidx_open(&idx, path, 0));
+	mu_assert("should stop probing a full index", -1 == digest_credidx_lookup(&idx, "joe", "test", ha1));
+	mu_assert("should still find a user in a full index", 0 == digest_credidx_lookup(&idx, "jill", "test", ha1));
+	digest_credidx_close(&idx);
+	mu_assert("should refuse a corrupt index with verification", -1 == digest_credidx_open(&idx, path, DIGEST_CREDIDX_VERIFY));
+
+	unlink(path);
+	return 0;
+}
+
+static unsigned char *
+test_credstore_load_reload()
+{
+	digest_credstore_t store;
+	char ha1[33];
+	char path[] = "/tmp/test_lib_htdigest";
+	FILE *fp;
+	int i;
+
+	/* Big enough to be split across threads */
+	fp = fopen(path, "w");
+	for (i = 0; i < 20000; ++i) {
+		fprintf(fp, "user%d:test:%032x\n", i, i);
+	}
+	fprintf(fp, "user7:test:ffffffffffffffffffffffffffffffff\n");
+	fprintf(fp, "malformed line\n");
+	fclose(fp);
+
+	mu_assert("should init a credential store", 0 == digest_credstore_init(&store, 4));
+	mu_assert("should load an htdigest file", 0 == digest_credstore_load(&store, path));
+	mu_assert("should skip duplicates and malformed lines", 20000 == digest_credstore_size(&store));
+	mu_assert("should find a user", 0 == digest_credstore_lookup(&store, "user19999", "test", ha1)
+	    && 0 == strcmp(ha1, "00000000000000000000000000004e1f"));
+	mu_assert("should keep the first of two lines", 0 == digest_credstore_lookup(&store, "user7", "test", ha1)
+	    && 0 == strcmp(ha1, "00000000000000000000000000000007"));
+
+	fp = fopen(path, "w");
+	fprintf(fp, "jack:test:939e7578ed9e3c518a452acee763bce9\n");
+	fclose(fp);
+
+	mu_assert("should start a background reload", 0 == digest_credstore_reload_async(&store, path));
+	while (1 != digest_credstore_size(&store)) {
+		usleep(1000);
+	}
+	mu_assert("should swap in the reloaded table", 0 == digest_credstore_lookup(&store, "jack", "test", ha1)
+	    && -1 == digest_credstore_lookup(&store, "user1", "test", ha1));
+
+	digest_credstore_destroy(&store);
+	unlink(path);
+	return 0;
+}
+
 static unsigned char *
 all_tests()
 {
 	mu_group("digest_create()");
 	mu_run_test(test_digest_create_ok);
 
+	mu_group("digest_server_verify()");
+	mu_run_test(test_server_verify);
+
+	mu_group("digest_server_generate_header()");
+	mu_run_test(test_server_generate_header);
+
+	mu_group("digest_challenge_render()");
+	mu_run_test(test_challenge_template);
+
+	mu_group("Authentication-Info");
+	mu_run_test(test_auth_info);
+
+	mu_group("digest_verify_resume()");
+	mu_run_test(test_verify_resume);
+
+	mu_group("digest_verify_submit()");
+	mu_run_test(test_verify_pool);
+
+	mu_group("digest_ha2_cache");
+	mu_run_test(test_ha2_cache);
+
+	mu_group("digest_midstate_cache");
+	mu_run_test(test_midstate_cache);
+
+	mu_group("digest_client_generate_headers_batch()");
+	mu_run_test(test_client_batch);
+
+	mu_group("digest_authcache");
+	mu_run_test(test_authcache);
+
+	mu_group("digest_compact");
+	mu_run_test(test_compact);
+
+	mu_group("digest_nonce");
+	mu_run_test(test_nonce);
+
+	mu_group("digest_nonce_policy");
+	mu_run_test(test_nonce_policy);
+
+	mu_group("digest_realm_registry");
+	mu_run_test(test_realm_registry);
+
+	mu_group("digest_snapshot");
+	mu_run_test(test_snapshot);
+
+	mu_group("digest_capture");
+	mu_run_test(test_capture);
+
+	mu_group("digest_credidx");
+	mu_run_test(test_credidx_build_lookup);
+
+	mu_group("digest_credstore");
+	mu_run_test(test_credstore_load_reload);
+
+	mu_group("userhash");
+	mu_run_test(test_userhash);
+
+	mu_group("digest_throttle");
+	mu_run_test(test_throttle);
+
 	return 0;
 }
 
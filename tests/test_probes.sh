@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Checks the bpftrace scripts in tools/bpftrace against the probes of
+# libdigest: every probe they attach to is documented in src/trace.h,
+# fired in the sources, and only its documented arguments are read. If the
+# library was built with <sys/sdt.h>, the probes must also be in its notes.
+#
+#   sh tests/test_probes.sh [libdigest.so]
+
+LIB=${1:-./libdigest.so}
+failed=0
+
+# name:arguments, from the list in src/trace.h
+probes=$(sed -n 's/^ \*   \([a-z_]*\)(\(.*\))$/\1:\2/p' src/trace.h | awk -F: '{ print $1 ":" split($2, a, ",") }')
+
+notes=
+if readelf -n "$LIB" 2>/dev/null | grep -q stapsdt; then
+	notes=$(readelf -n "$LIB" | sed -n 's/^ *Name: *//p')
+else
+	echo "test_probes: $LIB has no stapsdt notes, built without <sys/sdt.h>"
+fi
+
+for script in tools/bpftrace/*.bt; do
+	# probe:highest argument read in its block
+	uses=$(awk '
+		/^usdt:/ { split($0, p, ":"); probe = p[4]; max[probe] += 0; next }
+		/^[a-z]/ { probe = "" }
+		probe != "" {
+			line = $0
+			while (match(line, /arg[0-9]/)) {
+				n = substr(line, RSTART + 3, 1) + 1
+				if (n > max[probe]) max[probe] = n
+				line = substr(line, RSTART + 4)
+			}
+		}
+		END { for (probe in max) print probe ":" max[probe] }' "$script")
+
+	for use in $uses; do
+		name=${use%%:*}
+		n=${use#*:}
+		args=$(echo "$probes" | sed -n "s/^$name:\([0-9]*\)$/\1/p")
+		if [ -z "$args" ]; then
+			echo "$script: $name is not a libdigest probe"
+			failed=1
+			continue
+		fi
+		if [ "$n" -gt "$args" ]; then
+			echo "$script: $name has $args arguments, arg$((n - 1)) is read"
+			failed=1
+		fi
+		if ! grep -q "TRACE[0-9](${name}," src/*.c; then
+			echo "$script: $name is never fired"
+			failed=1
+		fi
+		if [ -n "$notes" ] && ! echo "$notes" | grep -qx "$name"; then
+			echo "$script: $name is not in the notes of $LIB"
+			failed=1
+		fi
+	done
+done
+
+if [ 0 -eq $failed ]; then
+	echo "test_probes: $(ls tools/bpftrace/*.bt | wc -l) scripts OK"
+fi
+exit $failed
@@ -0,0 +1,501 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <digest.h>
+#include <digest/server.h>
+#include <digest/credtab.h>
+#include <digest/ha2cache.h>
+
+/*
+ * Re-verifies logged Authorization headers against an htdigest file.
+ *
+ *   digestaudit [-t threads] [-m mismatch file] [-r replay file] <htdigest file> <log file>
+ *
+ * Each log line is the request method and the Authorization header value:
+ *
+ *   GET Digest username="jack", realm="api", nonce="...", ...
+ *
+ * The log is mapped and split into one range of lines per thread. A
+ * summary per user is written to stdout. The mismatch file lists each line
+ * that did not verify, and the replay file each line that repeats the
+ * nonce, nonce count, cnonce and response of an earlier line.
+ */
+
+#define LINE_MAX_LENGTH	4096
+#define USERNAME_MAX	256
+
+typedef struct {
+	char *username;
+	unsigned long total;
+	unsigned long failed;
+	unsigned long replayed;
+} user_stats_s;
+
+/* An authenticated request, sorted to find replays */
+typedef struct {
+	unsigned long long key[2];
+	unsigned long long line;
+	unsigned int user;
+} request_key_s;
+
+typedef struct {
+	pthread_t thread;
+	const char *start;
+	const char *end;
+	unsigned long long first_line;
+	digest_credstore_t *store;
+
+	/* Users, open addressing on the name */
+	user_stats_s *users;
+	unsigned int *user_slots;
+	unsigned int n_users;
+	unsigned int user_slots_mask;
+
+	request_key_s *requests;
+	size_t n_requests;
+	size_t requests_cap;
+
+	char *mismatches;
+	size_t mismatches_size;
+	FILE *mismatch_fp;
+} audit_part_s;
+
+static const char *_methods[] = { NULL, "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE" };
+
+static unsigned long long
+_fnv1a64(unsigned long long hash, const char *s)
+{
+	while ('\0' != *s) {
+		hash ^= (unsigned char) *(s++);
+		hash *= 1099511628211ULL;
+	}
+	hash ^= 0xff; /* Field separator */
+	hash *= 1099511628211ULL;
+	return hash;
+}
+
+static int
+_method_from_name(const char *name, size_t len)
+{
+	unsigned int i;
+
+	for (i = 1; i < sizeof (_methods) / sizeof (_methods[0]); ++i) {
+		if (strlen(_methods[i]) == len && 0 == strncmp(_methods[i], name, len)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Finds or adds a user of a partition.
+ *
+ * Returns the index of the user, -1 if out of memory.
+ */
+static int
+_part_user(audit_part_s *p, const char *username)
+{
+	unsigned int i, *slots, mask;
+	user_stats_s *users;
+
+	if (2 * (p->n_users + 1) > p->user_slots_mask + 1) {
+		mask = p->user_slots_mask ? p->user_slots_mask * 2 + 1 : 1023;
+		if (NULL == (slots = malloc((mask + 1) * sizeof (unsigned int)))) {
+			return -1;
+		}
+		memset(slots, 0xff, (mask + 1) * sizeof (unsigned int));
+		if (NULL == (users = realloc(p->users, (mask + 1) / 2 * sizeof (user_stats_s)))) {
+			free(slots);
+			return -1;
+		}
+		for (i = 0; i < p->n_users; ++i) {
+			unsigned int h = (unsigned int) _fnv1a64(14695981039346656037ULL, users[i].username) & mask;
+			while (-1U != slots[h]) {
+				h = (h + 1) & mask;
+			}
+			slots[h] = i;
+		}
+		free(p->user_slots);
+		p->user_slots = slots;
+		p->users = users;
+		p->user_slots_mask = mask;
+	}
+
+	i = (unsigned int) _fnv1a64(14695981039346656037ULL, username) & p->user_slots_mask;
+	while (-1U != p->user_slots[i]) {
+		if (0 == strcmp(p->users[p->user_slots[i]].username, username)) {
+			return p->user_slots[i];
+		}
+		i = (i + 1) & p->user_slots_mask;
+	}
+
+	memset(&p->users[p->n_users], 0, sizeof (user_stats_s));
+	if (NULL == (p->users[p->n_users].username = strdup(username))) {
+		return -1;
+	}
+	p->user_slots[i] = p->n_users;
+	return p->n_users++;
+}
+
+static int
+_part_add_request(audit_part_s *p, const digest_t *d, unsigned long long line, unsigned int user)
+{
+	const digest_s *dig = (const digest_s *) d;
+	request_key_s *r;
+	char nc[9];
+
+	if (p->n_requests == p->requests_cap) {
+		p->requests_cap = p->requests_cap ? p->requests_cap * 2 : 4096;
+		if (NULL == (r = realloc(p->requests, p->requests_cap * sizeof (request_key_s)))) {
+			return -1;
+		}
+		p->requests = r;
+	}
+
+	snprintf(nc, sizeof (nc), "%08x", dig->nc);
+	r = &p->requests[p->n_requests++];
+	r->key[0] = _fnv1a64(_fnv1a64(_fnv1a64(14695981039346656037ULL, dig->nonce), nc), dig->cnonce_value ? dig->cnonce_value : "");
+	r->key[1] = _fnv1a64(_fnv1a64(r->key[0], dig->response), dig->username);
+	r->line = line;
+	r->user = user;
+	return 0;
+}
+
+/**
+ * Verifies one log line.
+ */
+static void
+_audit_line(audit_part_s *p, char *line, unsigned long long line_no)
+{
+	digest_t d;
+	char *header, ha1[33];
+	int method, user;
+
+	if (NULL == (header = strchr(line, ' ')) || -1 == (method = _method_from_name(line, header - line))) {
+		fprintf(p->mismatch_fp, "%llu\t-\tmalformed\n", line_no);
+		return;
+	}
+	header++;
+
+	digest_init(&d);
+	if (-1 == digest_is_digest(header)) {
+		fprintf(p->mismatch_fp, "%llu\t-\tmalformed\n", line_no);
+		return;
+	}
+	digest_server_parse_in_place(&d, header);
+	d.method = method;
+
+	if (NULL == d.username || NULL == d.realm || NULL == d.nonce || NULL == d.response
+	    || strlen(d.username) >= USERNAME_MAX) {
+		fprintf(p->mismatch_fp, "%llu\t-\tmalformed\n", line_no);
+		return;
+	}
+	if (-1 == (user = _part_user(p, d.username))) {
+		return;
+	}
+	p->users[user].total++;
+
+	if (-1 == digest_credstore_lookup(p->store, d.username, d.realm, ha1)) {
+		p->users[user].failed++;
+		fprintf(p->mismatch_fp, "%llu\t%s\tunknown-user\n", line_no, d.username);
+		return;
+	}
+	if (0 != digest_server_verify(&d, ha1)) {
+		p->users[user].failed++;
+		fprintf(p->mismatch_fp, "%llu\t%s\tmismatch\n", line_no, d.username);
+		return;
+	}
+
+	_part_add_request(p, &d, line_no, user);
+}
+
+static int
+_request_cmp(const void *a, const void *b)
+{
+	const request_key_s *x = a, *y = b;
+
+	if (x->key[0] != y->key[0]) {
+		return x->key[0] < y->key[0] ? -1 : 1;
+	}
+	if (x->key[1] != y->key[1]) {
+		return x->key[1] < y->key[1] ? -1 : 1;
+	}
+	return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static void *
+_count_lines(void *arg)
+{
+	audit_part_s *p = (audit_part_s *) arg;
+	const char *cursor = p->start;
+	unsigned long long n = 0;
+
+	while (cursor < p->end && NULL != (cursor = memchr(cursor, '\n', p->end - cursor))) {
+		cursor++;
+		n++;
+	}
+	if (p->end > p->start && '\n' != p->end[-1]) {
+		n++;
+	}
+
+	p->first_line = n;
+	return NULL;
+}
+
+static void *
+_audit(void *arg)
+{
+	audit_part_s *p = (audit_part_s *) arg;
+	const char *cursor = p->start, *eol;
+	unsigned long long line_no = p->first_line;
+	char line[LINE_MAX_LENGTH];
+	size_t len;
+
+	p->mismatch_fp = open_memstream(&p->mismatches, &p->mismatches_size);
+
+	while (cursor < p->end) {
+		if (NULL == (eol = memchr(cursor, '\n', p->end - cursor))) {
+			eol = p->end;
+		}
+		len = eol - cursor;
+		if (len > 0 && '\r' == cursor[len - 1]) {
+			len--;
+		}
+
+		if (len >= sizeof (line)) {
+			fprintf(p->mismatch_fp, "%llu\t-\tmalformed\n", line_no);
+		} else if (len > 0) {
+			memcpy(line, cursor, len);
+			line[len] = '\0';
+			_audit_line(p, line, line_no);
+		}
+
+		cursor = eol + 1;
+		line_no++;
+	}
+
+	fclose(p->mismatch_fp);
+	qsort(p->requests, p->n_requests, sizeof (request_key_s), _request_cmp);
+	return NULL;
+}
+
+/**
+ * Merges the sorted requests of all partitions and reports repeats.
+ */
+static void
+_find_replays(audit_part_s *parts, int n_parts, FILE *out)
+{
+	size_t *pos = calloc(n_parts, sizeof (size_t));
+	request_key_s *min, *prev = NULL;
+	int i, min_part;
+
+	if (NULL == pos) {
+		return;
+	}
+
+	for (;;) {
+		min = NULL;
+		min_part = -1;
+		for (i = 0; i < n_parts; ++i) {
+			if (pos[i] < parts[i].n_requests
+			    && (NULL == min || _request_cmp(&parts[i].requests[pos[i]], min) < 0)) {
+				min = &parts[i].requests[pos[i]];
+				min_part = i;
+			}
+		}
+		if (NULL == min) {
+			break;
+		}
+		pos[min_part]++;
+
+		if (NULL != prev && prev->key[0] == min->key[0] && prev->key[1] == min->key[1]) {
+			parts[min_part].users[min->user].replayed++;
+			if (NULL != out) {
+				fprintf(out, "%llu\t%s\treplay-of\t%llu\n", min->line,
+				    parts[min_part].users[min->user].username, prev->line);
+			}
+			/* Keep prev, so every repeat refers to the first line */
+		} else {
+			prev = min;
+		}
+	}
+
+	free(pos);
+}
+
+/**
+ * Prints the users of all partitions, adding up their counts.
+ */
+static void
+_print_summary(audit_part_s *parts, int n_parts)
+{
+	audit_part_s total;
+	user_stats_s *u;
+	unsigned int i;
+	int j, k;
+
+	memset(&total, 0, sizeof (total));
+	for (j = 0; j < n_parts; ++j) {
+		for (i = 0; i < parts[j].n_users; ++i) {
+			if (-1 == (k = _part_user(&total, parts[j].users[i].username))) {
+				return;
+			}
+			total.users[k].total += parts[j].users[i].total;
+			total.users[k].failed += parts[j].users[i].failed;
+			total.users[k].replayed += parts[j].users[i].replayed;
+		}
+	}
+
+	printf("# username\trequests\tfailed\treplayed\n");
+	for (i = 0; i < total.n_users; ++i) {
+		u = &total.users[i];
+		printf("%s\t%lu\t%lu\t%lu\n", u->username, u->total, u->failed, u->replayed);
+		free(u->username);
+	}
+	free(total.users);
+	free(total.user_slots);
+}
+
+int
+main(int argc, char **argv)
+{
+	digest_credstore_t store;
+	audit_part_s *parts;
+	const char *mismatch_path = NULL, *replay_path = NULL, *map, *cursor;
+	unsigned long long line_no;
+	FILE *mismatch_fp = NULL, *replay_fp = NULL;
+	struct stat st;
+	int opt, n_threads = sysconf(_SC_NPROCESSORS_ONLN), fd, i;
+	unsigned int j;
+
+	while (-1 != (opt = getopt(argc, argv, "t:m:r:"))) {
+		switch (opt) {
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		case 'm':
+			mismatch_path = optarg;
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2 || n_threads < 1) {
+		goto usage;
+	}
+
+	if ((NULL != mismatch_path && NULL == (mismatch_fp = fopen(mismatch_path, "w")))
+	    || (NULL != replay_path && NULL == (replay_fp = fopen(replay_path, "w")))) {
+		fprintf(stderr, "Could not open the report files!\n");
+		return 1;
+	}
+
+	if (-1 == digest_credstore_init(&store, n_threads) || -1 == digest_credstore_load(&store, argv[optind])) {
+		fprintf(stderr, "Could not load %s!\n", argv[optind]);
+		return 1;
+	}
+	digest_ha2_cache_init(1 << 22);
+
+	if (-1 == (fd = open(argv[optind + 1], O_RDONLY)) || -1 == fstat(fd, &st)) {
+		fprintf(stderr, "Could not open %s!\n", argv[optind + 1]);
+		return 1;
+	}
+	if (0 == st.st_size) {
+		map = "";
+	} else if (MAP_FAILED == (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+		fprintf(stderr, "Could not map %s!\n", argv[optind + 1]);
+		return 1;
+	} else {
+		madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	if (NULL == (parts = calloc(n_threads, sizeof (audit_part_s)))) {
+		return 1;
+	}
+
+	/* Split at line boundaries */
+	cursor = map;
+	for (i = 0; i < n_threads; ++i) {
+		parts[i].store = &store;
+		parts[i].start = cursor;
+		if (i == n_threads - 1) {
+			cursor = map + st.st_size;
+		} else {
+			cursor = map + (st.st_size / n_threads) * (i + 1);
+			if (cursor < parts[i].start) {
+				cursor = parts[i].start;
+			}
+			while (cursor < map + st.st_size && '\n' != *cursor) {
+				cursor++;
+			}
+			if (cursor < map + st.st_size) {
+				cursor++;
+			}
+		}
+		parts[i].end = cursor;
+	}
+
+	/* Number the lines, then verify them */
+	for (i = 0; i < n_threads; ++i) {
+		pthread_create(&parts[i].thread, NULL, _count_lines, &parts[i]);
+	}
+	line_no = 1;
+	for (i = 0; i < n_threads; ++i) {
+		unsigned long long n;
+
+		pthread_join(parts[i].thread, NULL);
+		n = parts[i].first_line;
+		parts[i].first_line = line_no;
+		line_no += n;
+	}
+
+	for (i = 0; i < n_threads; ++i) {
+		pthread_create(&parts[i].thread, NULL, _audit, &parts[i]);
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(parts[i].thread, NULL);
+		if (NULL != mismatch_fp) {
+			fwrite(parts[i].mismatches, 1, parts[i].mismatches_size, mismatch_fp);
+		}
+	}
+
+	_find_replays(parts, n_threads, replay_fp);
+	_print_summary(parts, n_threads);
+
+	for (i = 0; i < n_threads; ++i) {
+		for (j = 0; j < parts[i].n_users; ++j) {
+			free(parts[i].users[j].username);
+		}
+		free(parts[i].users);
+		free(parts[i].user_slots);
+		free(parts[i].requests);
+		free(parts[i].mismatches);
+	}
+	free(parts);
+
+	if (NULL != mismatch_fp) {
+		fclose(mismatch_fp);
+	}
+	if (NULL != replay_fp) {
+		fclose(replay_fp);
+	}
+	if (st.st_size > 0) {
+		munmap((void *) map, st.st_size);
+	}
+	close(fd);
+	digest_ha2_cache_destroy();
+	digest_credstore_destroy(&store);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-t threads] [-m mismatch file] [-r replay file] <htdigest file> <log file>\n", argv[0]);
+	return 1;
+}
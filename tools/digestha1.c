@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <digest.h>
+#include <digest/server.h>
+#include <digest/credidx.h>
+
+/*
+ * Recomputes HA1 values from a password export, for realm migrations.
+ *
+ *   digestha1 [-t threads] [-r realm] [-x] <export file> <output file>
+ *
+ * Each export line is username:realm:password, or username:password with
+ * the realm given by -r. The output is an htdigest file, or a binary
+ * credential index with -x, in the order of the export. The export is
+ * mapped and split into one range of lines per thread, and the hashing
+ * rate is reported at the end.
+ */
+
+typedef struct {
+	pthread_t thread;
+	char *start;
+	char *end;
+	const char *realm;		/* -r, or NULL */
+	int index;			/* -x */
+
+	/* htdigest lines */
+	char *out;
+	size_t out_size;
+
+	/* Credentials for the index, the HA1s are set after the run */
+	digest_credential_t *creds;
+	char (*ha1s)[33];
+	unsigned int n_creds;
+	unsigned int cap;
+	char *tail;			/* Copy of a last line without newline */
+
+	unsigned long hashes;
+	unsigned long malformed;
+	int failed;
+} ha1_part_s;
+
+static double
+_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+_add_credential(ha1_part_s *p, const char *username, const char *realm, const char *ha1)
+{
+	digest_credential_t *creds;
+	char (*ha1s)[33];
+
+	if (p->n_creds == p->cap) {
+		p->cap = p->cap ? p->cap * 2 : 4096;
+		creds = realloc(p->creds, p->cap * sizeof (digest_credential_t));
+		if (NULL != creds) {
+			p->creds = creds;
+		}
+		ha1s = realloc(p->ha1s, p->cap * sizeof (p->ha1s[0]));
+		if (NULL != ha1s) {
+			p->ha1s = ha1s;
+		}
+		if (NULL == creds || NULL == ha1s) {
+			return -1;
+		}
+	}
+
+	p->creds[p->n_creds].username = username;
+	p->creds[p->n_creds].realm = realm;
+	memcpy(p->ha1s[p->n_creds], ha1, 33);
+	p->n_creds++;
+	return 0;
+}
+
+/**
+ * Hashes the lines of one part. Lines are split in place.
+ */
+static void *
+_hash_part(void *arg)
+{
+	ha1_part_s *p = (ha1_part_s *) arg;
+	char *line, *next, *eol, *realm, *password, ha1[33];
+	FILE *out = NULL;
+
+	if (!p->index && NULL == (out = open_memstream(&p->out, &p->out_size))) {
+		p->failed = 1;
+		return NULL;
+	}
+
+	for (line = p->start; line < p->end; line = next) {
+		if (NULL != (eol = memchr(line, '\n', p->end - line))) {
+			next = eol + 1;
+		} else {
+			/* The mapping may end right after it, leaving no room for a null byte */
+			next = p->end;
+			if (NULL == (p->tail = strndup(line, p->end - line))) {
+				p->failed = 1;
+				break;
+			}
+			line = p->tail;
+			eol = line + strlen(line);
+		}
+		*eol = '\0';
+		if (eol > line && '\r' == eol[-1]) {
+			eol[-1] = '\0';
+		}
+		if ('\0' == *line || '#' == *line) {
+			continue;
+		}
+
+		if (NULL == (password = strchr(line, ':'))) {
+			p->malformed++;
+			continue;
+		}
+		*(password++) = '\0';
+		if (NULL != p->realm) {
+			realm = (char *) p->realm;
+		} else {
+			realm = password;
+			if (NULL == (password = strchr(realm, ':'))) {
+				p->malformed++;
+				continue;
+			}
+			*(password++) = '\0';
+		}
+
+		if (-1 == digest_server_generate_ha1(ha1, line, realm, password)) {
+			p->malformed++;
+			continue;
+		}
+		p->hashes++;
+
+		if (p->index) {
+			if (-1 == _add_credential(p, line, realm, ha1)) {
+				p->failed = 1;
+				return NULL;
+			}
+		} else {
+			fprintf(out, "%s:%s:%s\n", line, realm, ha1);
+		}
+	}
+
+	if (NULL != out && 0 != fclose(out)) {
+		p->failed = 1;
+	}
+	return NULL;
+}
+
+/**
+ * Writes the credentials of all parts to a credential index.
+ */
+static int
+_write_index(ha1_part_s *parts, int n_parts, const char *path)
+{
+	digest_credential_t *all;
+	unsigned int n = 0, i;
+	int k, rc;
+
+	for (k = 0; k < n_parts; ++k) {
+		n += parts[k].n_creds;
+	}
+	if (NULL == (all = malloc((n + 1) * sizeof (digest_credential_t)))) {
+		return -1;
+	}
+	for (k = 0, n = 0; k < n_parts; ++k) {
+		for (i = 0; i < parts[k].n_creds; ++i) {
+			all[n] = parts[k].creds[i];
+			all[n++].ha1 = parts[k].ha1s[i];
+		}
+	}
+
+	rc = digest_credidx_build(path, all, n);
+	free(all);
+	return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+	ha1_part_s *parts;
+	const char *realm = NULL;
+	char *map, *cursor;
+	unsigned long hashes = 0, malformed = 0;
+	double start, elapsed;
+	struct stat st;
+	FILE *fp = NULL;
+	int opt, n_threads = sysconf(_SC_NPROCESSORS_ONLN), index = 0, fd, i, rc = 0;
+
+	while (-1 != (opt = getopt(argc, argv, "t:r:x"))) {
+		switch (opt) {
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		case 'r':
+			realm = optarg;
+			break;
+		case 'x':
+			index = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 2 || n_threads < 1) {
+		goto usage;
+	}
+
+	if (-1 == (fd = open(argv[optind], O_RDONLY)) || -1 == fstat(fd, &st)) {
+		fprintf(stderr, "Could not open %s!\n", argv[optind]);
+		return 1;
+	}
+	if (0 == st.st_size) {
+		map = "";
+	} else if (MAP_FAILED == (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0))) {
+		fprintf(stderr, "Could not map %s!\n", argv[optind]);
+		return 1;
+	} else {
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	if (!index && NULL == (fp = fopen(argv[optind + 1], "w"))) {
+		fprintf(stderr, "Could not open %s!\n", argv[optind + 1]);
+		return 1;
+	}
+	if (NULL == (parts = calloc(n_threads, sizeof (ha1_part_s)))) {
+		return 1;
+	}
+
+	/* Split at line boundaries */
+	cursor = map;
+	for (i = 0; i < n_threads; ++i) {
+		parts[i].realm = realm;
+		parts[i].index = index;
+		parts[i].start = cursor;
+		if (i == n_threads - 1) {
+			cursor = map + st.st_size;
+		} else {
+			cursor = map + (st.st_size / n_threads) * (i + 1);
+			if (cursor < parts[i].start) {
+				cursor = parts[i].start;
+			}
+			while (cursor < map + st.st_size && '\n' != *cursor) {
+				cursor++;
+			}
+			if (cursor < map + st.st_size) {
+				cursor++;
+			}
+		}
+		parts[i].end = cursor;
+	}
+
+	start = _now();
+	for (i = 0; i < n_threads; ++i) {
+		pthread_create(&parts[i].thread, NULL, _hash_part, &parts[i]);
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(parts[i].thread, NULL);
+		hashes += parts[i].hashes;
+		malformed += parts[i].malformed;
+		rc |= parts[i].failed;
+	}
+	elapsed = _now() - start;
+
+	if (0 == rc && index) {
+		rc = (-1 == _write_index(parts, n_threads, argv[optind + 1]));
+	} else if (0 == rc) {
+		for (i = 0; i < n_threads; ++i) {
+			fwrite(parts[i].out, 1, parts[i].out_size, fp);
+		}
+		rc = (0 != fclose(fp));
+		fp = NULL;
+	}
+	if (0 != rc) {
+		fprintf(stderr, "Could not write %s!\n", argv[optind + 1]);
+	}
+
+	fprintf(stderr, "%lu hashes in %.2f s with %d threads, %.0f hashes/s, %lu malformed lines\n",
+	    hashes, elapsed, n_threads, elapsed > 0 ? hashes / elapsed : 0, malformed);
+
+	for (i = 0; i < n_threads; ++i) {
+		free(parts[i].out);
+		free(parts[i].creds);
+		free(parts[i].ha1s);
+		free(parts[i].tail);
+	}
+	free(parts);
+	if (NULL != fp) {
+		fclose(fp);
+	}
+	if (st.st_size > 0) {
+		munmap(map, st.st_size);
+	}
+	close(fd);
+	return rc;
+
+usage:
+	fprintf(stderr, "Usage: %s [-t threads] [-r realm] [-x] <export file> <output file>\n", argv[0]);
+	return 1;
+}
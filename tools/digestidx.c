@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <digest.h>
+#include <digest/credidx.h>
+
+/*
+ * Builds a binary credential index from an Apache htdigest file
+ * (username:realm:HA1, one per line).
+ *
+ *   digestidx <htdigest file> <index file>
+ *   digestidx -l <index file> <username> <realm>
+ */
+
+static int
+_lookup(const char *path, const char *username, const char *realm)
+{
+	digest_credidx_t idx;
+	char ha1[33];
+
+	if (-1 == digest_credidx_open(&idx, path, DIGEST_CREDIDX_VERIFY)) {
+		fprintf(stderr, "Could not open index %s!\n", path);
+		return 1;
+	}
+
+	if (-1 == digest_credidx_lookup(&idx, username, realm, ha1)) {
+		fprintf(stderr, "No such user.\n");
+		digest_credidx_close(&idx);
+		return 1;
+	}
+
+	printf("%s:%s:%s\n", username, realm, ha1);
+	digest_credidx_close(&idx);
+	return 0;
+}
+
+static int
+_build(const char *in_path, const char *out_path)
+{
+	digest_credential_t *creds = NULL, *tmp;
+	unsigned int n = 0, cap = 0, lineno = 0, i;
+	char *line = NULL, *realm, *ha1;
+	size_t line_cap = 0;
+	ssize_t len;
+	FILE *fp;
+	int rc = 1;
+
+	if (NULL == (fp = fopen(in_path, "r"))) {
+		fprintf(stderr, "Could not open %s!\n", in_path);
+		return 1;
+	}
+
+	while (-1 != (len = getline(&line, &line_cap, fp))) {
+		lineno++;
+		while (len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1])) {
+			line[--len] = '\0';
+		}
+		if (0 == len || '#' == line[0]) {
+			continue;
+		}
+
+		if (NULL == (realm = strchr(line, ':')) || NULL == (ha1 = strchr(realm + 1, ':'))
+		    || 32 != strlen(ha1 + 1)) {
+			fprintf(stderr, "%s:%u: malformed line, skipping\n", in_path, lineno);
+			continue;
+		}
+		*(realm++) = '\0';
+		*(ha1++) = '\0';
+
+		if (n == cap) {
+			cap = cap ? cap * 2 : 1024;
+			if (NULL == (tmp = realloc(creds, cap * sizeof (digest_credential_t)))) {
+				goto out;
+			}
+			creds = tmp;
+		}
+		creds[n].username = strdup(line);
+		creds[n].realm = strdup(realm);
+		creds[n].ha1 = strdup(ha1);
+		n++;
+	}
+
+	if (-1 == digest_credidx_build(out_path, creds, n)) {
+		fprintf(stderr, "Could not write index %s!\n", out_path);
+		goto out;
+	}
+
+	printf("Wrote %u credentials to %s\n", n, out_path);
+	rc = 0;
+out:
+	for (i = 0; i < n; ++i) {
+		free((char *) creds[i].username);
+		free((char *) creds[i].realm);
+		free((char *) creds[i].ha1);
+	}
+	free(creds);
+	free(line);
+	fclose(fp);
+	return rc;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (5 == argc && 0 == strcmp(argv[1], "-l")) {
+		return _lookup(argv[2], argv[3], argv[4]);
+	}
+
+	if (3 != argc) {
+		fprintf(stderr, "usage: %s <htdigest file> <index file>\n", argv[0]);
+		fprintf(stderr, "       %s -l <index file> <username> <realm>\n", argv[0]);
+		return 1;
+	}
+
+	return _build(argv[1], argv[2]);
+}
@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <digest.h>
+#include <digest/client.h>
+
+/*
+ * Load generator for digest protected HTTP servers.
+ *
+ *   digestload [-t threads] [-d seconds] [-u username:password] [-p port] [path]
+ *
+ * Each thread keeps its own keep-alive connection to 127.0.0.1 and its own
+ * client session: it takes the challenge of the first 401, then sends
+ * authenticated GET requests back to back with an increasing nonce count.
+ * A new challenge, like a stale nonce, is parsed and the session goes on;
+ * the same challenge twice means the credentials are wrong.
+ * At the end it prints requests per second and latency percentiles.
+ *
+ * The reference server in examples/server.c is a matching target.
+ */
+
+#define BUFFER_SIZE	8192
+
+typedef struct {
+	pthread_t thread;
+	const char *username;
+	const char *password;
+	const char *path;
+	int port;
+	double deadline;
+
+	unsigned long requests;
+	unsigned long failures;
+	unsigned int *latencies;	/* Microseconds */
+	size_t n_latencies;
+	size_t latencies_cap;
+} load_thread_s;
+
+static double
+_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+_connect(int port)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	if (-1 == (fd = socket(AF_INET, SOCK_STREAM, 0))) {
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+	memset(&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (-1 == connect(fd, (struct sockaddr *) &addr, sizeof (addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Reads one response. If it is a challenge, its value is copied to
+ * challenge.
+ *
+ * Returns the status code, -1 on failure.
+ */
+static int
+_read_response(int fd, char *buffer, char *challenge, size_t challenge_size)
+{
+	size_t length = 0, body;
+	char *end, *header, *eol;
+	ssize_t n;
+	int status;
+
+	while (NULL == (end = memmem(buffer, length, "\r\n\r\n", 4))) {
+		if (length == BUFFER_SIZE - 1 || 0 >= (n = read(fd, buffer + length, BUFFER_SIZE - 1 - length))) {
+			return -1;
+		}
+		length += n;
+	}
+	buffer[length] = '\0';
+	end[2] = '\0';
+
+	if (1 != sscanf(buffer, "HTTP/1.1 %d", &status)) {
+		return -1;
+	}
+
+	body = 0;
+	if (NULL != (header = strcasestr(buffer, "\r\nContent-Length:"))) {
+		body = strtoul(header + 17, NULL, 10);
+	}
+	if (401 == status && NULL != (header = strcasestr(buffer, "\r\nWWW-Authenticate:"))) {
+		header += 19;
+		while (' ' == *header) {
+			header++;
+		}
+		if (NULL != (eol = strstr(header, "\r\n")) && (size_t) (eol - header) < challenge_size) {
+			memcpy(challenge, header, eol - header);
+			challenge[eol - header] = '\0';
+		}
+	}
+
+	/* Skip the body; responses are not pipelined, so nothing follows it */
+	length -= end - buffer + 4;
+	while (length < body) {
+		if (0 >= (n = read(fd, buffer, BUFFER_SIZE - 1))) {
+			return -1;
+		}
+		length += n;
+	}
+
+	return status;
+}
+
+static void
+_add_latency(load_thread_s *t, double seconds)
+{
+	unsigned int *l;
+
+	if (t->n_latencies == t->latencies_cap) {
+		t->latencies_cap = t->latencies_cap ? t->latencies_cap * 2 : 65536;
+		if (NULL == (l = realloc(t->latencies, t->latencies_cap * sizeof (unsigned int)))) {
+			return;
+		}
+		t->latencies = l;
+	}
+	t->latencies[t->n_latencies++] = seconds * 1e6;
+}
+
+static void *
+_run(void *arg)
+{
+	load_thread_s *t = (load_thread_s *) arg;
+	char buffer[BUFFER_SIZE], challenge[1024], session[1024], header[2048], request[4096];
+	digest_t d;
+	int fd, n, status, have_challenge = 0;
+	double start;
+
+	if (-1 == (fd = _connect(t->port))) {
+		perror("connect");
+		t->failures++;
+		return NULL;
+	}
+
+	while (_now() < t->deadline) {
+		if (have_challenge) {
+			if (-1 == (int) digest_client_generate_header(&d, header, sizeof (header))) {
+				break;
+			}
+			n = snprintf(request, sizeof (request), "GET %s HTTP/1.1\r\nHost: localhost\r\nAuthorization: %s\r\n\r\n", t->path, header);
+		} else {
+			n = snprintf(request, sizeof (request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", t->path);
+		}
+
+		start = _now();
+		if (n != write(fd, request, n) || -1 == (status = _read_response(fd, buffer, challenge, sizeof (challenge)))) {
+			t->failures++;
+			break;
+		}
+
+		if (200 == status) {
+			_add_latency(t, _now() - start);
+			t->requests++;
+			d.nc++;
+		} else if (401 == status) {
+			if (have_challenge) {
+				t->failures++;
+				if (0 == strcmp(challenge, session)) {
+					/* Same challenge again, the credentials are wrong */
+					break;
+				}
+			}
+			/* New session with the challenge */
+			strcpy(session, challenge);
+			digest_init(&d);
+			if (-1 == digest_is_digest(challenge) || -1 == digest_client_parse(&d, challenge)) {
+				break;
+			}
+			digest_set_attr(&d, D_ATTR_USERNAME, (digest_attr_value_t) t->username);
+			digest_set_attr(&d, D_ATTR_PASSWORD, (digest_attr_value_t) t->password);
+			digest_set_attr(&d, D_ATTR_URI, (digest_attr_value_t) t->path);
+			digest_set_attr(&d, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+			d.cnonce ^= (unsigned int) (size_t) t;
+			have_challenge = 1;
+		} else {
+			t->failures++;
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int
+_uint_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+int
+main(int argc, char **argv)
+{
+	load_thread_s *threads;
+	unsigned int *all;
+	unsigned long requests = 0, failures = 0;
+	size_t n_all = 0, k;
+	double seconds = 10, start, elapsed;
+	const double percentiles[] = { 50, 90, 99, 99.9 };
+	char *username = "jack", *password = "Passw0rd", *path = "/";
+	int opt, n_threads = sysconf(_SC_NPROCESSORS_ONLN), port = 8080, i;
+
+	while (-1 != (opt = getopt(argc, argv, "t:d:u:p:"))) {
+		switch (opt) {
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'u':
+			username = optarg;
+			if (NULL == (password = strchr(optarg, ':'))) {
+				goto usage;
+			}
+			*(password++) = '\0';
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc) {
+		path = argv[optind];
+	}
+	if (n_threads < 1 || seconds <= 0) {
+		goto usage;
+	}
+
+	if (NULL == (threads = calloc(n_threads, sizeof (load_thread_s)))) {
+		return 1;
+	}
+
+	start = _now();
+	for (i = 0; i < n_threads; ++i) {
+		threads[i].username = username;
+		threads[i].password = password;
+		threads[i].path = path;
+		threads[i].port = port;
+		threads[i].deadline = start + seconds;
+		pthread_create(&threads[i].thread, NULL, _run, &threads[i]);
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		requests += threads[i].requests;
+		failures += threads[i].failures;
+		n_all += threads[i].n_latencies;
+	}
+	elapsed = _now() - start;
+
+	if (NULL == (all = malloc((n_all + 1) * sizeof (unsigned int)))) {
+		return 1;
+	}
+	for (i = 0, n_all = 0; i < n_threads; ++i) {
+		memcpy(all + n_all, threads[i].latencies, threads[i].n_latencies * sizeof (unsigned int));
+		n_all += threads[i].n_latencies;
+		free(threads[i].latencies);
+	}
+	qsort(all, n_all, sizeof (unsigned int), _uint_cmp);
+
+	printf("%lu requests in %.2f s with %d threads, %lu failed\n", requests, elapsed, n_threads, failures);
+	printf("%.0f requests/s\n", requests / elapsed);
+	if (n_all > 0) {
+		for (k = 0; k < sizeof (percentiles) / sizeof (percentiles[0]); ++k) {
+			printf("p%-5g %u us\n", percentiles[k], all[(size_t) (percentiles[k] / 100 * (n_all - 1))]);
+		}
+		printf("max    %u us\n", all[n_all - 1]);
+	}
+
+	free(all);
+	free(threads);
+	return failures > 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-t threads] [-d seconds] [-u username:password] [-p port] [path]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <digest.h>
+#include <digest/client.h>
+#include <digest/server.h>
+#include <digest/credtab.h>
+#include <digest/capture.h>
+
+/*
+ * Replays a header capture through parsing, generation and verification.
+ *
+ *   digestreplay [-n passes] [-c htdigest file] [-u uri] <capture file>
+ *   digestreplay -w <log file> <capture file>
+ *
+ * The capture is mapped and each pass runs three stages over all of its
+ * records, one after the other: every header value is parsed, then a
+ * header is generated from every parsed value (an Authorization header
+ * for a challenge, a challenge for an Authorization header), then every
+ * Authorization header is verified. The records per second and bytes per
+ * second of each stage are printed at the end. Nothing depends on the
+ * clock or on randomness, so runs on the same capture do the same work.
+ *
+ * Responses are verified against the HA1 from the htdigest file given with
+ * -c, or against a fixed HA1, which costs the same but fails.
+ *
+ * With -w, a capture is written from a text log instead. Each line is the
+ * request method followed by the Authorization header value, as for
+ * digestaudit, or "401", the method and the WWW-Authenticate header value.
+ */
+
+#define USERNAME	"replay"
+#define PASSWORD	"replay"
+#define HA1_UNKNOWN	"00000000000000000000000000000000"
+#define BUFFER_SIZE	4096
+
+static const char *_methods[] = { NULL, "OPTIONS", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE" };
+
+typedef struct {
+	const char *name;
+	unsigned long records;
+	unsigned long failed;
+	unsigned long long bytes;
+	double seconds;
+} replay_stage_s;
+
+typedef struct {
+	digest_replay_t replay;
+	unsigned long n_records;
+	size_t value_bytes;
+	const char *uri;
+
+	char *arena;			/* Copies of the values, parsed in place */
+	digest_t *digests;
+	unsigned char *kinds;
+	char (*ha1s)[33];
+} replay_s;
+
+static double
+_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+_method_from_name(const char *name, size_t len)
+{
+	unsigned int i;
+
+	for (i = 1; i < sizeof (_methods) / sizeof (_methods[0]); ++i) {
+		if (strlen(_methods[i]) == len && 0 == strncmp(_methods[i], name, len)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Writes a capture from a text log.
+ */
+static int
+_write_capture(const char *log_path, const char *path)
+{
+	digest_capture_t capture;
+	FILE *log;
+	char *line = NULL, *method, *value;
+	size_t line_size = 0;
+	ssize_t len;
+	unsigned long written = 0, skipped = 0;
+	int kind, m, rc;
+
+	if (NULL == (log = fopen(log_path, "r"))) {
+		fprintf(stderr, "Could not open %s!\n", log_path);
+		return 1;
+	}
+	if (-1 == digest_capture_open(&capture, path)) {
+		fprintf(stderr, "Could not open %s!\n", path);
+		fclose(log);
+		return 1;
+	}
+
+	while (-1 != (len = getline(&line, &line_size, log))) {
+		while (len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1])) {
+			line[--len] = '\0';
+		}
+
+		method = line;
+		kind = DIGEST_CAPTURE_AUTHORIZATION;
+		if (0 == strncmp(line, "401 ", 4)) {
+			method = line + 4;
+			kind = DIGEST_CAPTURE_CHALLENGE;
+		}
+		if (NULL == (value = strchr(method, ' ')) || -1 == (m = _method_from_name(method, value - method))
+		    || -1 == digest_capture_add(&capture, kind, m, value + 1)) {
+			skipped++;
+			continue;
+		}
+		written++;
+	}
+	free(line);
+	fclose(log);
+
+	rc = digest_capture_close(&capture);
+	fprintf(stderr, "%lu records written, %lu lines skipped\n", written, skipped);
+	return -1 == rc;
+}
+
+/**
+ * Parses every record of the capture into the digests.
+ */
+static void
+_stage_parse(replay_s *r, replay_stage_s *stage)
+{
+	digest_replay_record_t record;
+	digest_t *d;
+	char *value = r->arena;
+	unsigned long i = 0;
+
+	digest_replay_rewind(&r->replay);
+	while (0 == digest_replay_next(&r->replay, &record)) {
+		d = &r->digests[i];
+		r->kinds[i++] = record.kind;
+
+		/* Same as the copy parse_digest() makes, without the leak */
+		memcpy(value, record.value, record.length + 1);
+		digest_init(d);
+		if (0 != digest_is_digest(value) || record.length < 8 || -1 == digest_server_parse_in_place(d, value)) {
+			stage->failed++;
+		}
+		d->method = record.method;
+		if (DIGEST_CAPTURE_CHALLENGE == record.kind) {
+			/* The defaults of digest_client_parse(), but not from the clock */
+			d->nc = 1;
+			d->cnonce = 0x5eed;
+		}
+
+		value += record.length + 1;
+		stage->bytes += record.length;
+	}
+	stage->records += i;
+}
+
+/**
+ * Generates a header from every parsed record.
+ */
+static void
+_stage_generate(replay_s *r, replay_stage_s *stage)
+{
+	char result[BUFFER_SIZE];
+	digest_t *d;
+	size_t length;
+	unsigned long i;
+
+	for (i = 0; i < r->n_records; ++i) {
+		d = &r->digests[i];
+		if (DIGEST_CAPTURE_CHALLENGE == r->kinds[i]) {
+			d->username = USERNAME;
+			d->password = PASSWORD;
+			d->uri = (char *) r->uri;
+			length = digest_client_generate_header(d, result, sizeof (result));
+		} else {
+			length = digest_server_generate_header(d, result, sizeof (result));
+		}
+
+		if ((size_t) -1 == length) {
+			stage->failed++;
+		} else {
+			stage->bytes += length;
+		}
+	}
+	stage->records += r->n_records;
+}
+
+/**
+ * Verifies every parsed Authorization header.
+ */
+static void
+_stage_verify(replay_s *r, replay_stage_s *stage)
+{
+	unsigned long i;
+
+	for (i = 0; i < r->n_records; ++i) {
+		if (DIGEST_CAPTURE_AUTHORIZATION != r->kinds[i]) {
+			continue;
+		}
+		if (0 != digest_server_verify(&r->digests[i], r->ha1s[i])) {
+			stage->failed++;
+		}
+		stage->records++;
+	}
+}
+
+/**
+ * Looks up the HA1 of every Authorization header, before timing.
+ */
+static void
+_resolve_ha1s(replay_s *r, digest_credstore_t *store)
+{
+	replay_stage_s setup;
+	digest_t *d;
+	unsigned long i;
+
+	memset(&setup, 0, sizeof (setup));
+	_stage_parse(r, &setup);
+
+	for (i = 0; i < r->n_records; ++i) {
+		d = &r->digests[i];
+		if (NULL == store || NULL == d->username || NULL == d->realm
+		    || -1 == digest_credstore_lookup(store, d->username, d->realm, r->ha1s[i])) {
+			memcpy(r->ha1s[i], HA1_UNKNOWN, 33);
+		}
+	}
+}
+
+static void
+_print_stage(const replay_stage_s *stage)
+{
+	printf("%-10s %12lu %10lu %10.3f %14.0f", stage->name, stage->records, stage->failed, stage->seconds,
+	    stage->seconds > 0 ? stage->records / stage->seconds : 0);
+	/* Verification produces no bytes */
+	if (0 == stage->bytes) {
+		printf(" %10s\n", "-");
+	} else {
+		printf(" %10.1f\n", stage->seconds > 0 ? stage->bytes / stage->seconds / 1e6 : 0);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	replay_s r;
+	replay_stage_s stages[3] = { { .name = "parse" }, { .name = "generate" }, { .name = "verify" } };
+	digest_replay_record_t record;
+	digest_credstore_t store;
+	const char *htdigest = NULL, *log = NULL;
+	unsigned long n_challenges = 0;
+	double start;
+	int opt, passes = 1, pass, i;
+
+	memset(&r, 0, sizeof (r));
+	r.uri = "/";
+
+	while (-1 != (opt = getopt(argc, argv, "n:c:u:w:"))) {
+		switch (opt) {
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'c':
+			htdigest = optarg;
+			break;
+		case 'u':
+			r.uri = optarg;
+			break;
+		case 'w':
+			log = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1 || passes < 1) {
+		goto usage;
+	}
+	if (NULL != log) {
+		return _write_capture(log, argv[optind]);
+	}
+
+	if (-1 == digest_replay_open(&r.replay, argv[optind])) {
+		fprintf(stderr, "Could not open %s!\n", argv[optind]);
+		return 1;
+	}
+	while (0 == digest_replay_next(&r.replay, &record)) {
+		r.n_records++;
+		r.value_bytes += record.length + 1;
+		n_challenges += (DIGEST_CAPTURE_CHALLENGE == record.kind);
+	}
+
+	r.arena = malloc(r.value_bytes + 1);
+	r.digests = malloc((r.n_records + 1) * sizeof (digest_t));
+	r.kinds = malloc(r.n_records + 1);
+	r.ha1s = malloc((r.n_records + 1) * sizeof (r.ha1s[0]));
+	if (NULL == r.arena || NULL == r.digests || NULL == r.kinds || NULL == r.ha1s) {
+		fprintf(stderr, "Out of memory!\n");
+		return 1;
+	}
+
+	if (NULL != htdigest) {
+		if (-1 == digest_credstore_init(&store, 1) || -1 == digest_credstore_load(&store, htdigest)) {
+			fprintf(stderr, "Could not load %s!\n", htdigest);
+			return 1;
+		}
+		_resolve_ha1s(&r, &store);
+		digest_credstore_destroy(&store);
+	} else {
+		_resolve_ha1s(&r, NULL);
+	}
+
+	for (pass = 0; pass < passes; ++pass) {
+		start = _now();
+		_stage_parse(&r, &stages[0]);
+		stages[0].seconds += _now() - start;
+
+		start = _now();
+		_stage_generate(&r, &stages[1]);
+		stages[1].seconds += _now() - start;
+
+		start = _now();
+		_stage_verify(&r, &stages[2]);
+		stages[2].seconds += _now() - start;
+	}
+
+	printf("%lu records, %lu challenges, %lu authorizations, %.0f bytes per value, %d passes\n",
+	    r.n_records, n_challenges, r.n_records - n_challenges,
+	    r.n_records > 0 ? (double) (r.value_bytes - r.n_records) / r.n_records : 0, passes);
+	printf("%-10s %12s %10s %10s %14s %10s\n", "stage", "records", "failed", "seconds", "records/s", "MB/s");
+	for (i = 0; i < 3; ++i) {
+		_print_stage(&stages[i]);
+	}
+
+	free(r.arena);
+	free(r.digests);
+	free(r.kinds);
+	free(r.ha1s);
+	digest_replay_close(&r.replay);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n passes] [-c htdigest file] [-u uri] <capture file>\n", argv[0]);
+	fprintf(stderr, "       %s -w <log file> <capture file>\n", argv[0]);
+	return 1;
+}
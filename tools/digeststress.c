@@ -0,0 +1,480 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include <digest.h>
+#include <digest/client.h>
+#include <digest/server.h>
+#include <digest/ha2cache.h>
+#include <digest/nonce.h>
+
+/*
+ * Scaling and contention stress harness.
+ *
+ *   digeststress [-t threads] [-d seconds] [-w workload] [-c] [-C bytes] [-o file]
+ *
+ * Runs parsing, header generation and verification on 1 to N threads, for
+ * some seconds at each thread count, twice: with per-thread contexts, where
+ * each thread parses and owns its own set of requests, and with shared
+ * contexts, where all threads generate and verify from one set. Both modes
+ * share the library state: the nonce supply, and the HA2 and midstate
+ * caches with -c, of 1 MiB each or of -C bytes each. A cache smaller
+ * than the requests keeps evicting, so lookups race with inserts. The
+ * workload is parse, generate, verify or all.
+ *
+ * For each run it prints operations per second, the speedup over one
+ * thread and a bar. Where perf counters can be read, cache misses per
+ * operation are printed too, and a run whose misses per operation grow
+ * while it scales badly is flagged as likely false sharing. -o writes
+ * thread count and operations per second of both modes as columns, for
+ * gnuplot.
+ *
+ * Every verification must succeed and every header must be generated; any
+ * error is counted and makes the exit status non-zero. `make check-tsan`
+ * runs this under ThreadSanitizer.
+ */
+
+#define N_REQUESTS	64
+#define USERNAME	"jack"
+#define PASSWORD	"Passw0rd"
+#define REALM		"stress"
+#define BUFFER_SIZE	1024
+#define CACHE_LINE	64
+
+#define WORK_PARSE	1
+#define WORK_GENERATE	2
+#define WORK_VERIFY	4
+
+/* One set of requests, parsed */
+typedef struct {
+	char *headers[N_REQUESTS];	/* Authorization header values */
+	char *parsed[N_REQUESTS];	/* Copies the contexts point into */
+	digest_t requests[N_REQUESTS];	/* Parsed Authorization headers */
+	digest_t challenges[N_REQUESTS];	/* Parsed challenges, for the client */
+	char uris[N_REQUESTS][32];
+} stress_set_s;
+
+typedef struct {
+	pthread_t thread;
+	int index;
+	int work;
+	double deadline;
+	const char *ha1;
+	stress_set_s *set;		/* Shared, or this thread's own */
+	const stress_set_s *source;	/* The headers to parse */
+	unsigned long ops;
+	unsigned long errors;
+} __attribute__((aligned(CACHE_LINE))) stress_thread_s;
+
+typedef struct {
+	double ops_per_second;
+	double misses_per_op;		/* -1 without perf counters */
+	unsigned long errors;
+} stress_result_s;
+
+static double
+_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Opens a cache miss counter for this process, inherited by the threads
+ * it creates from now on.
+ *
+ * Returns the counter, -1 if perf counters are not available.
+ */
+static int
+_perf_open(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof (attr));
+	attr.size = sizeof (attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static long long
+_perf_read(int fd)
+{
+	long long count;
+
+	if (-1 == fd || sizeof (count) != read(fd, &count, sizeof (count))) {
+		return -1;
+	}
+	return count;
+}
+
+/**
+ * Parses a copy of each header of the set into its contexts.
+ */
+static int
+_set_parse(stress_set_s *set, const stress_set_s *source)
+{
+	int i;
+
+	for (i = 0; i < N_REQUESTS; ++i) {
+		if (NULL == (set->parsed[i] = strdup(source->headers[i]))) {
+			return -1;
+		}
+		digest_init(&set->requests[i]);
+		if (-1 == digest_server_parse_in_place(&set->requests[i], set->parsed[i])) {
+			return -1;
+		}
+		set->requests[i].method = DIGEST_METHOD_GET;
+
+		if (set != source) {
+			set->challenges[i] = source->challenges[i];
+			memcpy(set->uris[i], source->uris[i], sizeof (set->uris[i]));
+			set->challenges[i].uri = set->uris[i];
+		}
+	}
+	return 0;
+}
+
+static void
+_set_free(stress_set_s *set)
+{
+	int i;
+
+	for (i = 0; i < N_REQUESTS; ++i) {
+		free(set->parsed[i]);
+		set->parsed[i] = NULL;
+	}
+}
+
+/**
+ * Builds the requests: one challenge and one Authorization header each,
+ * with their own URI.
+ */
+static int
+_set_build(stress_set_s *set, char *nonce)
+{
+	digest_t server;
+	char challenge[BUFFER_SIZE], header[BUFFER_SIZE];
+	int i;
+
+	memset(set, 0, sizeof (stress_set_s));
+	if (-1 == digest_nonce_generate(nonce)) {
+		return -1;
+	}
+
+	digest_init(&server);
+	digest_set_attr(&server, D_ATTR_REALM, (digest_attr_value_t) REALM);
+	digest_set_attr(&server, D_ATTR_NONCE, (digest_attr_value_t) nonce);
+	digest_set_attr(&server, D_ATTR_OPAQUE, (digest_attr_value_t) "5ccc069c403ebaf9f0171e9517f40e41");
+	digest_set_attr(&server, D_ATTR_ALGORITHM, (digest_attr_value_t) DIGEST_ALGORITHM_MD5);
+	digest_set_attr(&server, D_ATTR_QOP, (digest_attr_value_t) DIGEST_QOP_AUTH);
+	if (-1 == (int) digest_server_generate_header(&server, challenge, sizeof (challenge))) {
+		return -1;
+	}
+
+	for (i = 0; i < N_REQUESTS; ++i) {
+		digest_t *c = &set->challenges[i];
+
+		snprintf(set->uris[i], sizeof (set->uris[i]), "/api/items/%d", i);
+		digest_init(c);
+		if (-1 == digest_client_parse(c, challenge)) {
+			return -1;
+		}
+		digest_set_attr(c, D_ATTR_USERNAME, (digest_attr_value_t) USERNAME);
+		digest_set_attr(c, D_ATTR_PASSWORD, (digest_attr_value_t) PASSWORD);
+		digest_set_attr(c, D_ATTR_URI, (digest_attr_value_t) set->uris[i]);
+		digest_set_attr(c, D_ATTR_METHOD, (digest_attr_value_t) DIGEST_METHOD_GET);
+		c->nc = i + 1;
+
+		if (-1 == (int) digest_client_generate_header(c, header, sizeof (header))
+		    || NULL == (set->headers[i] = strdup(header))) {
+			return -1;
+		}
+	}
+
+	return _set_parse(set, set);
+}
+
+static void *
+_run(void *arg)
+{
+	stress_thread_s *t = (stress_thread_s *) arg;
+	digest_t parsed;
+	char scratch[BUFFER_SIZE], result[BUFFER_SIZE], nonce[DIGEST_NONCE_LENGTH + 1];
+	unsigned long ops = 0, errors = 0;
+	unsigned int i;
+
+	/* Threads start at different requests */
+	for (i = t->index * 7; ; ++i) {
+		const unsigned int r = i % N_REQUESTS;
+
+		if (0 == (ops & 63) && _now() >= t->deadline) {
+			break;
+		}
+
+		if (WORK_PARSE & t->work) {
+			strcpy(scratch, t->source->headers[r]);
+			digest_init(&parsed);
+			if (-1 == digest_server_parse_in_place(&parsed, scratch) || NULL == parsed.response) {
+				errors++;
+			}
+		}
+		if (WORK_GENERATE & t->work) {
+			if (-1 == (int) digest_client_generate_header(&t->set->challenges[r], result, sizeof (result))
+			    || -1 == digest_nonce_generate(nonce)) {
+				errors++;
+			}
+		}
+		if (WORK_VERIFY & t->work) {
+			if (0 != digest_server_verify(&t->set->requests[r], t->ha1)) {
+				errors++;
+			}
+		}
+		ops++;
+	}
+
+	t->ops = ops;
+	t->errors = errors;
+	return NULL;
+}
+
+/**
+ * Runs the workload on n_threads threads for some seconds.
+ */
+static int
+_run_threads(stress_set_s *shared, int shared_mode, int n_threads, int work, double seconds,
+    const char *ha1, stress_result_s *result)
+{
+	stress_thread_s *threads;
+	stress_set_s *own = NULL;
+	long long misses_start, misses_end;
+	unsigned long ops = 0;
+	double start, elapsed;
+	int fd, i, rc = 0;
+
+	if (0 != posix_memalign((void **) &threads, CACHE_LINE, n_threads * sizeof (stress_thread_s))) {
+		return -1;
+	}
+	memset(threads, 0, n_threads * sizeof (stress_thread_s));
+	if (!shared_mode && NULL == (own = calloc(n_threads, sizeof (stress_set_s)))) {
+		free(threads);
+		return -1;
+	}
+
+	for (i = 0; i < n_threads && 0 == rc; ++i) {
+		threads[i].index = i;
+		threads[i].work = work;
+		threads[i].ha1 = ha1;
+		threads[i].source = shared;
+		threads[i].set = shared;
+		if (!shared_mode) {
+			memcpy(own[i].headers, shared->headers, sizeof (shared->headers));
+			rc = _set_parse(&own[i], shared);
+			threads[i].source = &own[i];
+			threads[i].set = &own[i];
+		}
+	}
+
+	fd = _perf_open();
+	misses_start = _perf_read(fd);
+	start = _now();
+	for (i = 0; i < n_threads && 0 == rc; ++i) {
+		threads[i].deadline = start + seconds;
+		if (0 != pthread_create(&threads[i].thread, NULL, _run, &threads[i])) {
+			rc = -1;
+			n_threads = i;
+		}
+	}
+	for (i = 0; i < n_threads; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+		result->errors += threads[i].errors;
+	}
+	elapsed = _now() - start;
+	misses_end = _perf_read(fd);
+	if (-1 != fd) {
+		close(fd);
+	}
+
+	result->ops_per_second = elapsed > 0 ? ops / elapsed : 0;
+	result->misses_per_op = -1;
+	if (-1 != misses_start && -1 != misses_end && ops > 0) {
+		result->misses_per_op = (double) (misses_end - misses_start) / ops;
+	}
+
+	if (NULL != own) {
+		for (i = 0; i < n_threads; ++i) {
+			_set_free(&own[i]);
+		}
+		free(own);
+	}
+	free(threads);
+	return rc;
+}
+
+static int
+_parse_workload(const char *name)
+{
+	if (0 == strcmp(name, "parse")) {
+		return WORK_PARSE;
+	} else if (0 == strcmp(name, "generate")) {
+		return WORK_GENERATE;
+	} else if (0 == strcmp(name, "verify")) {
+		return WORK_VERIFY;
+	} else if (0 == strcmp(name, "all")) {
+		return WORK_PARSE | WORK_GENERATE | WORK_VERIFY;
+	}
+	return -1;
+}
+
+static void
+_print_result(const char *mode, int n_threads, const stress_result_s *r, const stress_result_s *one, double max)
+{
+	double speedup = one->ops_per_second > 0 ? r->ops_per_second / one->ops_per_second : 0;
+	char bar[41];
+	int width;
+
+	width = max > 0 ? (int) (40 * r->ops_per_second / max + 0.5) : 0;
+	memset(bar, '#', width);
+	bar[width] = '\0';
+
+	printf("%-10s %7d %12.0f %7.2fx", mode, n_threads, r->ops_per_second, speedup);
+	if (r->misses_per_op < 0) {
+		printf(" %10s", "n/a");
+	} else {
+		printf(" %10.1f", r->misses_per_op);
+	}
+	printf(" %6lu  |%-40s", r->errors, bar);
+
+	/* More cache misses per operation as threads are added, and poor scaling */
+	if (n_threads > 1 && r->misses_per_op >= 0 && one->misses_per_op >= 0
+	    && r->misses_per_op > 2 * one->misses_per_op + 1 && speedup < 0.75 * n_threads) {
+		printf("  false sharing?");
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	stress_set_s *shared;
+	stress_result_s *results[2];
+	const char *modes[2] = { "per-thread", "shared" }, *output = NULL;
+	char ha1[33], nonce[DIGEST_NONCE_LENGTH + 1];
+	unsigned long errors = 0;
+	double seconds = 1, max = 0;
+	FILE *fp;
+	int opt, n_threads = sysconf(_SC_NPROCESSORS_ONLN), work = WORK_PARSE | WORK_GENERATE | WORK_VERIFY;
+	size_t cache_size = 0;
+	int mode, i;
+
+	while (-1 != (opt = getopt(argc, argv, "t:d:w:cC:o:"))) {
+		switch (opt) {
+		case 't':
+			n_threads = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atof(optarg);
+			break;
+		case 'w':
+			if (-1 == (work = _parse_workload(optarg))) {
+				goto usage;
+			}
+			break;
+		case 'c':
+			cache_size = 1 << 20;
+			break;
+		case 'C':
+			cache_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc != optind || n_threads < 1 || seconds <= 0) {
+		goto usage;
+	}
+
+	if (0 != cache_size && (-1 == digest_ha2_cache_init(cache_size) || -1 == digest_midstate_cache_init(cache_size))) {
+		fprintf(stderr, "Could not enable the caches!\n");
+		return 1;
+	}
+	if (-1 == digest_nonce_start(4096, 1, NULL, 0)) {
+		fprintf(stderr, "Could not start the nonce supply!\n");
+		return 1;
+	}
+	if (NULL == (shared = calloc(1, sizeof (stress_set_s))) || -1 == _set_build(shared, nonce)
+	    || -1 == digest_server_generate_ha1(ha1, USERNAME, REALM, PASSWORD)) {
+		fprintf(stderr, "Could not build the requests!\n");
+		return 1;
+	}
+	results[0] = calloc(n_threads + 1, sizeof (stress_result_s));
+	results[1] = calloc(n_threads + 1, sizeof (stress_result_s));
+	if (NULL == results[0] || NULL == results[1]) {
+		return 1;
+	}
+
+	for (mode = 0; mode < 2; ++mode) {
+		for (i = 1; i <= n_threads; ++i) {
+			if (-1 == _run_threads(shared, mode, i, work, seconds, ha1, &results[mode][i])) {
+				fprintf(stderr, "Could not run %d threads!\n", i);
+				return 1;
+			}
+			if (results[mode][i].ops_per_second > max) {
+				max = results[mode][i].ops_per_second;
+			}
+			errors += results[mode][i].errors;
+		}
+	}
+
+	printf("%-10s %7s %12s %8s %10s %6s\n", "contexts", "threads", "ops/s", "speedup", "misses/op", "errors");
+	for (mode = 0; mode < 2; ++mode) {
+		for (i = 1; i <= n_threads; ++i) {
+			_print_result(modes[mode], i, &results[mode][i], &results[mode][1], max);
+		}
+	}
+
+	if (NULL != output) {
+		if (NULL == (fp = fopen(output, "w"))) {
+			fprintf(stderr, "Could not open %s!\n", output);
+			return 1;
+		}
+		fprintf(fp, "# threads\tper-thread\tshared\n");
+		for (i = 1; i <= n_threads; ++i) {
+			fprintf(fp, "%d\t%.0f\t%.0f\n", i, results[0][i].ops_per_second, results[1][i].ops_per_second);
+		}
+		fclose(fp);
+	}
+
+	digest_nonce_stop();
+	_set_free(shared);
+	for (i = 0; i < N_REQUESTS; ++i) {
+		free(shared->headers[i]);
+	}
+	free(shared);
+	free(results[0]);
+	free(results[1]);
+	return 0 != errors;
+
+usage:
+	fprintf(stderr, "Usage: %s [-t threads] [-d seconds] [-w parse|generate|verify|all] [-c] [-C bytes] [-o file]\n", argv[0]);
+	return 1;
+}